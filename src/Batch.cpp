@@ -0,0 +1,166 @@
+//
+// Created by praza on 18.10.2026.
+//
+
+#include "Batch.h"
+#include "BoundedQueue.h"
+#include <algorithm>
+#include <functional>
+#include <thread>
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define BATCH_MMAP
+#endif
+
+namespace {
+/// Lines of the input answered together
+struct Block {
+  /// the text of the lines unless the input is mapped into memory
+  std::string storage;
+  std::vector<std::string_view> lines;
+  std::string output;
+  std::atomic<bool> done = false;
+};
+
+/// Appends the lines of \p text without their terminators to \p lines
+void SplitLines(std::string_view text, std::vector<std::string_view> &lines) {
+  while (!text.empty()) {
+	size_t end = text.find('\n');
+	std::string_view line = text.substr(0, end);
+	if (line.ends_with('\r')) line.remove_suffix(1);
+	lines.push_back(line);
+	if (end == std::string_view::npos) break;
+	text.remove_prefix(end + 1);
+  }
+}
+
+/// Reads \p path into blocks by mapping it into memory, the lines of the blocks point into the mapping
+/// \return false if the file cannot be mapped
+bool ReadMapped(const std::string &path, std::function<void(std::unique_ptr<Block>)> &submit) {
+#ifdef BATCH_MMAP
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st{};
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+	close(fd);
+	return false;
+  }
+  size_t size = st.st_size;
+  if (size == 0) {
+	close(fd);
+	submit(nullptr);
+	return true;
+  }
+  void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) return false;
+  madvise(mapping, size, MADV_SEQUENTIAL);
+  std::string_view text(static_cast<const char *>(mapping), size);
+  while (!text.empty()) {
+	// a block ends with the first newline after BATCH_BLOCK_SIZE bytes
+	size_t end = text.find('\n', std::min(text.size(), size_t{BATCH_BLOCK_SIZE}));
+	end = end == std::string_view::npos ? text.size() : end + 1;
+	auto block = std::make_unique<Block>();
+	SplitLines(text.substr(0, end), block->lines);
+	submit(std::move(block));
+	text.remove_prefix(end);
+  }
+  // returns after the last block was written
+  submit(nullptr);
+  munmap(mapping, size);
+  return true;
+#else
+  return false;
+#endif
+}
+
+/// Reads \p file into blocks in chunks of BATCH_BLOCK_SIZE bytes
+void ReadStream(FILE *file, std::function<void(std::unique_ptr<Block>)> &submit) {
+  std::string carry;
+  bool eof = false;
+  while (!eof) {
+	auto block = std::make_unique<Block>();
+	block->storage = std::move(carry);
+	size_t size = block->storage.size();
+	block->storage.resize(size + BATCH_BLOCK_SIZE);
+	size_t read = fread(block->storage.data() + size, 1, BATCH_BLOCK_SIZE, file);
+	block->storage.resize(size + read);
+	// fread reads less only at the end of the input or on an error
+	eof = read < BATCH_BLOCK_SIZE;
+	// the incomplete last line moves to the next block
+	size_t newline = block->storage.rfind('\n');
+	size_t end = eof ? block->storage.size() : newline == std::string::npos ? 0 : newline + 1;
+	carry = block->storage.substr(end);
+	block->storage.resize(end);
+	SplitLines(block->storage, block->lines);
+	submit(std::move(block));
+  }
+  submit(nullptr);
+}
+}
+
+bool Batch::Run(const GrammarFormGuesser &guesser, const std::string &path, unsigned threads, FILE *out,
+				OutputFormat format) {
+  threads = std::max(threads, 1u);
+  // the blocks in flight are bounded, and so is the memory
+  BoundedQueue<Block *> work(4 * threads);
+  BoundedQueue<Block *> ordered(4 * threads);
+  // finished blocks, the writer waits on it for the next block in order
+  std::atomic<size_t> finished = 0;
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < threads; ++i) {
+	workers.emplace_back([&] {
+	  while (Block *block = work.Pop()) {
+		for (auto line : block->lines) ResultSerializer::Append(guesser.GuessQuery(line), format, block->output);
+		// the writer may delete the block as soon as it is done
+		block->done.store(true, std::memory_order_release);
+		finished.fetch_add(1, std::memory_order_release);
+		finished.notify_all();
+	  }
+	});
+  }
+  std::atomic<bool> written = false;
+  std::thread writer([&] {
+	while (Block *block = ordered.Pop()) {
+	  while (!block->done.load(std::memory_order_acquire)) {
+		size_t seen = finished.load(std::memory_order_acquire);
+		if (!block->done.load(std::memory_order_acquire)) finished.wait(seen);
+	  }
+	  fwrite(block->output.data(), 1, block->output.size(), out);
+	  delete block;
+	}
+	fflush(out);
+	written.store(true, std::memory_order_release);
+	written.notify_one();
+  });
+  // nullptr ends the pipeline and waits until everything is written
+  std::function<void(std::unique_ptr<Block>)> submit = [&](std::unique_ptr<Block> block) {
+	if (block == nullptr) {
+	  for (unsigned i = 0; i < threads; ++i) work.Push(nullptr);
+	  ordered.Push(nullptr);
+	  written.wait(false, std::memory_order_acquire);
+	  return;
+	}
+	// the writer takes the blocks in the order of the input, whichever worker finishes first
+	Block *raw = block.release();
+	ordered.Push(raw);
+	work.Push(raw);
+  };
+  bool read = true;
+  if (path.empty() || !ReadMapped(path, submit)) {
+	FILE *file = path.empty() ? stdin : fopen(path.c_str(), "rb");
+	if (file == nullptr) {
+	  read = false;
+	  submit(nullptr);
+	} else {
+	  ReadStream(file, submit);
+	  if (file != stdin) fclose(file);
+	}
+  }
+  for (auto &worker : workers) worker.join();
+  writer.join();
+  return read;
+}
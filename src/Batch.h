@@ -0,0 +1,27 @@
+//
+// Created by praza on 18.10.2026.
+//
+
+#ifndef OSHI_CPP__BATCH_H_
+#define OSHI_CPP__BATCH_H_
+
+#include "GrammarFormGuesser.h"
+#include "ResultSerializer.h"
+#include <cstdio>
+
+/// Bytes of input per block of lines passed through the pipeline
+#define BATCH_BLOCK_SIZE (256 * 1024)
+
+/// Non-interactive processing of one query per line.
+/// A reader splits the input into blocks of whole lines, worker threads answer the blocks taken from a bounded
+/// lock-free queue, and the results are written in the input order, a block per write.
+class Batch {
+ public:
+  /// Answers every line of the file at \p path (mapped into memory where possible), or of stdin if \p path is empty,
+  /// on \p threads worker threads and writes the results to \p out in \p format
+  /// \return false if the input cannot be read
+  static bool Run(const GrammarFormGuesser &guesser, const std::string &path, unsigned threads, FILE *out,
+				  OutputFormat format = OutputFormat::TEXT);
+};
+
+#endif //OSHI_CPP__BATCH_H_
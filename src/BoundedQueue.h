@@ -0,0 +1,108 @@
+//
+// Created by praza on 18.10.2026.
+//
+
+#ifndef OSHI_CPP__BOUNDEDQUEUE_H_
+#define OSHI_CPP__BOUNDEDQUEUE_H_
+
+#include <atomic>
+#include <memory>
+
+/// A lock-free queue of fixed capacity for any number of producers and consumers (Vyukov's bounded MPMC queue).
+/// Every cell carries a sequence number telling whether it is ready to be written or read in the current lap,
+/// so a push or pop is one compare-and-swap of a position. Blocking Push and Pop wait on counters of completed
+/// operations.
+template<class T>
+class BoundedQueue {
+ public:
+  /// \param capacity Rounded up to a power of two
+  explicit BoundedQueue(size_t capacity) {
+	size_t size = 2;
+	while (size < capacity) size *= 2;
+	mask_ = size - 1;
+	cells_ = std::make_unique<Cell[]>(size);
+	for (size_t i = 0; i < size; ++i) cells_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  BoundedQueue(const BoundedQueue &other) = delete;
+  BoundedQueue &operator=(const BoundedQueue &other) = delete;
+
+  /// Moves from \p value only if it succeeds
+  /// \return false if the queue is full
+  bool TryPush(T &&value) {
+	size_t pos = push_pos_.load(std::memory_order_relaxed);
+	while (true) {
+	  Cell &cell = cells_[pos & mask_];
+	  size_t sequence = cell.sequence.load(std::memory_order_acquire);
+	  if (sequence == pos) {
+		// the cell is free in this lap, claim it
+		if (push_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+		  cell.value = std::move(value);
+		  cell.sequence.store(pos + 1, std::memory_order_release);
+		  pushed_.fetch_add(1, std::memory_order_release);
+		  pushed_.notify_all();
+		  return true;
+		}
+	  } else if (sequence < pos) {
+		// the cell still holds a value of the previous lap
+		return false;
+	  } else {
+		pos = push_pos_.load(std::memory_order_relaxed);
+	  }
+	}
+  }
+  /// \return false if the queue is empty
+  bool TryPop(T &value) {
+	size_t pos = pop_pos_.load(std::memory_order_relaxed);
+	while (true) {
+	  Cell &cell = cells_[pos & mask_];
+	  size_t sequence = cell.sequence.load(std::memory_order_acquire);
+	  if (sequence == pos + 1) {
+		if (pop_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+		  value = std::move(cell.value);
+		  // free the cell for the next lap
+		  cell.sequence.store(pos + mask_ + 1, std::memory_order_release);
+		  popped_.fetch_add(1, std::memory_order_release);
+		  popped_.notify_all();
+		  return true;
+		}
+	  } else if (sequence < pos + 1) {
+		return false;
+	  } else {
+		pos = pop_pos_.load(std::memory_order_relaxed);
+	  }
+	}
+  }
+  /// Waits while the queue is full
+  void Push(T value) {
+	while (true) {
+	  size_t popped = popped_.load(std::memory_order_acquire);
+	  if (TryPush(std::move(value))) return;
+	  popped_.wait(popped);
+	}
+  }
+  /// Waits while the queue is empty
+  T Pop() {
+	T value;
+	while (true) {
+	  size_t pushed = pushed_.load(std::memory_order_acquire);
+	  if (TryPop(value)) return value;
+	  pushed_.wait(pushed);
+	}
+  }
+
+ private:
+  struct Cell {
+	std::atomic<size_t> sequence;
+	T value;
+  };
+  std::unique_ptr<Cell[]> cells_;
+  size_t mask_;
+  // the positions are written by different threads, keep them on separate cache lines
+  alignas(64) std::atomic<size_t> push_pos_ = 0;
+  alignas(64) std::atomic<size_t> pop_pos_ = 0;
+  /// Completed pushes and pops, a waiting thread wakes up when they change
+  alignas(64) std::atomic<size_t> pushed_ = 0;
+  alignas(64) std::atomic<size_t> popped_ = 0;
+};
+
+#endif //OSHI_CPP__BOUNDEDQUEUE_H_
@@ -3,6 +3,150 @@
 //
 
 #include "Dictionary.h"
+#include "Metrics.h"
+#include "Normalizer.h"
+#include "glob-cpp/glob.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <span>
+#include <tuple>
+#include <unordered_set>
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define DICTIONARY_MMAP
+#endif
+
+namespace {
+constexpr char image_magic[8] = {'O', 'S', 'H', 'I', 'D', 'I', 'C', 0};
+/// Increased whenever the layout of the image or the form of its keys changes
+constexpr uint32_t image_version = 7;
+constexpr uint32_t empty_slot = UINT32_MAX;
+
+/// FNV-1a, the table in the image must not depend on the standard library
+uint32_t HashKey(std::string_view key) {
+  uint32_t hash = 2166136261u;
+  for (char c : key) hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+  return hash;
+}
+
+/// Ranks a writing or a reading by its JMdict priority markers (the \p marker children of \p element), higher for
+/// the more common words: the markers of the common words (news1, ichi1, spec1, spec2, gai1) weigh the most, then
+/// the second halves of the lists (news2, ichi2, gai2), then the frequency rank in the newspapers (nf01 to nf48)
+uint32_t Priority(const pugi::xml_node &element, const char *marker) {
+  uint32_t priority = 0;
+  for (auto xml_marker : element.children(marker)) {
+	std::string_view name(xml_marker.child_value());
+	if (name == "news1" || name == "ichi1" || name == "spec1" || name == "spec2" || name == "gai1") priority += 100;
+	else if (name == "news2" || name == "ichi2" || name == "gai2") priority += 10;
+	else if (name.starts_with("nf")) priority += 49 - std::min(std::strtoul(name.data() + 2, nullptr, 10), 48ul);
+  }
+  return priority;
+}
+
+/// Sorts \p indices of \p keys (CompletionKey or alike) best first, see Dictionary::Complete, and keeps the first
+/// \p k of distinct entries
+template<class Keys>
+void KeepBestCompletions(std::vector<uint32_t> &indices, const Keys &keys, size_t k) {
+  std::sort(indices.begin(), indices.end(), [&](uint32_t a, uint32_t b) {
+	if (keys[a].priority != keys[b].priority) return keys[a].priority > keys[b].priority;
+	if (keys[a].key.size() != keys[b].key.size()) return keys[a].key.size() < keys[b].key.size();
+	return a < b;
+  });
+  size_t kept = 0;
+  for (size_t i = 0; i < indices.size() && kept < k; ++i) {
+	auto entry = keys[indices[i]].entry;
+	if (std::none_of(indices.begin(), indices.begin() + kept, [&](uint32_t j) { return keys[j].entry == entry; }))
+	  indices[kept++] = indices[i];
+  }
+  indices.resize(kept);
+}
+
+/// The gram of the code point \p first followed by \p second, see Dictionary::GramPostings
+uint64_t Gram(char32_t first, char32_t second = 0) { return uint64_t{first} << 32 | second; }
+
+/// Splits \p pattern into the runs of literal code points every key matching the glob contains, in order. Anything
+/// that may match something else than itself ends a run, conservatively: the wildcards, the sets, the groups, the
+/// operators and the escaped characters.
+/// \return whether the pattern starts with a literal run, a prefix of every matching key then
+bool LiteralRuns(std::u32string_view pattern, std::vector<std::u32string> &runs) {
+  auto literal = [](char32_t c) { return std::u32string_view(U"*?[]()|!+@-\\").find(c) == std::u32string_view::npos; };
+  runs.assign(1, {});
+  bool in_set = false;
+  int depth = 0;
+  for (size_t i = 0; i < pattern.size(); ++i) {
+	char32_t c = pattern[i];
+	if (!in_set && depth == 0 && literal(c)) {
+	  runs.back() += c;
+	  continue;
+	}
+	if (!runs.back().empty()) runs.emplace_back();
+	if (in_set) in_set = c != ']';
+	else if (c == '[') in_set = true;
+	else if (c == '(') ++depth;
+	else if (c == ')') depth = std::max(depth - 1, 0);
+	// the escaped character too
+	else if (c == '\\') ++i;
+  }
+  if (runs.back().empty()) runs.pop_back();
+  return !pattern.empty() && literal(pattern[0]);
+}
+
+/// Calls \p f with each word of \p text in lowercase, see Dictionary::GlossSearch
+template<class F>
+void ForEachWord(std::string_view text, F &&f) {
+  auto in_word = [](unsigned char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c >= 0x80;
+  };
+  std::string word;
+  for (size_t pos = 0; pos < text.size();) {
+	if (!in_word(text[pos])) {
+	  ++pos;
+	  continue;
+	}
+	word.clear();
+	for (; pos < text.size() && in_word(text[pos]); ++pos)
+	  word += text[pos] >= 'A' && text[pos] <= 'Z' ? static_cast<char>(text[pos] - 'A' + 'a') : text[pos];
+	f(word);
+  }
+}
+
+/// Appends \p value as a LEB128 varint
+void AppendVarint(uint32_t value, std::vector<uint8_t> &out) {
+  for (; value >= 0x80; value >>= 7) out.push_back(static_cast<uint8_t>(value | 0x80));
+  out.push_back(static_cast<uint8_t>(value));
+}
+/// Reads a LEB128 varint at \p p and moves \p p past it
+uint32_t ReadVarint(const uint8_t *&p) {
+  uint32_t value = 0;
+  for (unsigned shift = 0;; shift += 7) {
+	uint8_t byte = *p++;
+	value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+	if (byte < 0x80) return value;
+  }
+}
+
+/// Writes \p strings into the image as the array at \p array_position
+void WriteStrings(FlatImageWriter &writer, size_t array_position, const std::vector<std::string> &strings) {
+  size_t first = writer.Allocate<FlatString>(strings.size());
+  writer.Link<FlatString>(array_position, first, strings.size());
+  for (size_t i = 0; i < strings.size(); ++i) writer.LinkString(first + i * sizeof(FlatString), strings[i]);
+}
+}
+
+std::string Dictionary::ImagePath(unsigned key_flags) {
+  return JMDICT_IMAGE_STEM "." + std::to_string(key_flags) + ".oshi";
+}
 bool Dictionary::InflateDictionary() {
   FILE *jmdict_gz = fopen(JMDICT_GZ, "rb");
   if (!jmdict_gz) return false;
@@ -13,15 +157,25 @@ bool Dictionary::InflateDictionary() {
   fclose(jmdict_gz);
   return inflation_err == 0;
 }
-void Dictionary::LoadDictionary(pugi::xml_document &doc) {
+void Dictionary::LoadDictionary(pugi::xml_document &doc, unsigned key_flags) {
   auto root = doc.child("JMdict");
+  std::vector<ParsedEntry> entries;
+  std::vector<std::string> pos_tags;
+  std::unordered_map<std::string, size_t> pos_bits;
   for (auto xml_entry : root.children("entry")) {
-	DictionaryEntry entry;
-	for (auto r_ele : xml_entry.children("r_ele")) entry.readings.emplace_back(r_ele.child_value("reb"));
-	for (auto k_ele : xml_entry.children("k_ele")) entry.writings.emplace_back(k_ele.child_value("keb"));
+	ParsedEntry entry;
+	entry.id = std::strtoul(xml_entry.child_value("ent_seq"), nullptr, 10);
+	for (auto r_ele : xml_entry.children("r_ele")) {
+	  entry.readings.emplace_back(r_ele.child_value("reb"));
+	  entry.reading_priorities.push_back(Priority(r_ele, "re_pri"));
+	}
+	for (auto k_ele : xml_entry.children("k_ele")) {
+	  entry.writings.emplace_back(k_ele.child_value("keb"));
+	  entry.writing_priorities.push_back(Priority(k_ele, "ke_pri"));
+	}
 
 	for (auto xml_sense : xml_entry.children("sense")) {
-	  DictionaryEntrySense sense;
+	  ParsedSense sense;
 	  for (auto pos : xml_sense.children("pos")) {
 		std::string pos_string(pos.child_value());
 		// POS tags are XML entities like &v5k;, but pugixml (thankfully) does not expand these,
@@ -32,25 +186,753 @@ void Dictionary::LoadDictionary(pugi::xml_document &doc) {
 	  if (sense.part_of_speech.empty() && !entry.senses.empty())
 		// copy the previous pos
 		sense.part_of_speech = entry.senses[entry.senses.size() - 1].part_of_speech;
+	  for (auto &pos : sense.part_of_speech) {
+		auto [it, inserted] = pos_bits.try_emplace(pos, std::min(pos_tags.size(), size_t{POS_MASK_BITS - 1}));
+		if (inserted) pos_tags.push_back(pos);
+		entry.pos_mask.set(it->second);
+	  }
 	  for (auto gloss : xml_sense.children("gloss")) sense.glosses.emplace_back(gloss.child_value());
 	  entry.senses.push_back(std::move(sense));
 	}
 	entries.push_back(std::move(entry));
   }
 
-  PrepareLookupMap();
+  BuildImage(entries, pos_tags, key_flags);
 }
-void Dictionary::PrepareLookupMap() {
-  for (auto &entry : entries) {
-	for (auto &writing : entry.writings) entry_map.insert(std::make_pair(writing, &entry));
+void Dictionary::BuildImage(const std::vector<ParsedEntry> &entries, const std::vector<std::string> &pos_tags,
+							unsigned key_flags) {
+  FlatImageWriter writer;
+  size_t header = writer.Allocate<ImageHeader>();
+  {
+	auto &h = writer.At<ImageHeader>(header);
+	std::memcpy(h.magic, image_magic, sizeof(h.magic));
+	h.version = image_version;
+	h.header_size = sizeof(ImageHeader);
+	h.entry_size = sizeof(DictionaryEntry);
+	h.key_size = sizeof(IndexedKey);
+	h.key_flags = key_flags;
+  }
+
+  size_t first_entry = writer.Allocate<DictionaryEntry>(entries.size());
+  writer.Link<DictionaryEntry>(header + offsetof(ImageHeader, entries), first_entry, entries.size());
+  // the normalized writings in lexicographic order with the indices of the entries written so
+  std::map<std::string, std::vector<uint32_t>> keys;
+  std::string normalized;
+  for (size_t i = 0; i < entries.size(); ++i) {
+	size_t entry = first_entry + i * sizeof(DictionaryEntry);
+	writer.At<DictionaryEntry>(entry).id = entries[i].id;
+	writer.At<DictionaryEntry>(entry).pos_mask = entries[i].pos_mask;
+	WriteStrings(writer, entry + offsetof(DictionaryEntry, readings), entries[i].readings);
+	WriteStrings(writer, entry + offsetof(DictionaryEntry, writings), entries[i].writings);
+	size_t first_sense = writer.Allocate<DictionaryEntrySense>(entries[i].senses.size());
+	writer.Link<DictionaryEntrySense>(entry + offsetof(DictionaryEntry, senses), first_sense, entries[i].senses.size());
+	for (size_t j = 0; j < entries[i].senses.size(); ++j) {
+	  size_t sense = first_sense + j * sizeof(DictionaryEntrySense);
+	  WriteStrings(writer, sense + offsetof(DictionaryEntrySense, part_of_speech), entries[i].senses[j].part_of_speech);
+	  WriteStrings(writer, sense + offsetof(DictionaryEntrySense, glosses), entries[i].senses[j].glosses);
+	}
+	for (auto &writing : entries[i].writings) {
+	  // normalized like the queries
+	  if (!Normalizer::Normalize(writing, normalized, key_flags)) normalized = writing;
+	  auto &indices = keys[normalized];
+	  // an entry may list the same writing twice, the spellings are mostly the same
+	  if (indices.empty() || indices.back() != i) indices.push_back(i);
+	}
+  }
+
+  size_t first_key = writer.Allocate<IndexedKey>(keys.size());
+  writer.Link<IndexedKey>(header + offsetof(ImageHeader, keys), first_key, keys.size());
+  size_t key = first_key;
+  for (auto &[writing, indices] : keys) {
+	writer.LinkString(key + offsetof(IndexedKey, key), writing);
+	size_t first_index = writer.Allocate<uint32_t>(indices.size());
+	std::memcpy(&writer.At<uint32_t>(first_index), indices.data(), indices.size() * sizeof(uint32_t));
+	writer.Link<uint32_t>(key + offsetof(IndexedKey, entries), first_index, indices.size());
+	for (auto index : indices) writer.At<IndexedKey>(key).pos_mask |= entries[index].pos_mask;
+	key += sizeof(IndexedKey);
+  }
+
+  // at most half full, so that a miss ends at an empty slot soon
+  size_t table_size = 1;
+  while (table_size < 2 * keys.size()) table_size *= 2;
+  size_t table = writer.Allocate<uint32_t>(table_size);
+  std::memset(&writer.At<uint32_t>(table), 0xFF, table_size * sizeof(uint32_t));
+  writer.Link<uint32_t>(header + offsetof(ImageHeader, key_table), table, table_size);
+  uint32_t index = 0;
+  for (auto &[writing, indices] : keys) {
+	size_t slot = HashKey(writing) & (table_size - 1);
+	while (writer.At<uint32_t>(table + slot * sizeof(uint32_t)) != empty_slot) slot = (slot + 1) & (table_size - 1);
+	writer.At<uint32_t>(table + slot * sizeof(uint32_t)) = index++;
+  }
+
+  WriteStrings(writer, header + offsetof(ImageHeader, pos_tags), pos_tags);
+  WriteCompletions(writer, header, entries);
+  WriteGlossIndex(writer, header, entries);
+  WriteKanjiIndex(writer, header, entries);
+
+  auto bytes = std::make_shared<std::vector<char>>(writer.Release());
+  reinterpret_cast<ImageHeader *>(bytes->data())->image_size = bytes->size();
+  SetImage(bytes, bytes->data(), bytes->size());
+}
+void Dictionary::WriteCompletions(FlatImageWriter &writer, size_t header, const std::vector<ParsedEntry> &entries) {
+  struct Key {
+	std::string key;
+	uint32_t entry, priority;
+  };
+  std::vector<Key> keys;
+  std::string normalized;
+  unsigned key_flags = writer.At<ImageHeader>(header).key_flags;
+  for (uint32_t i = 0; i < entries.size(); ++i) {
+	auto add = [&](const std::vector<std::string> &strings, const std::vector<uint32_t> &priorities) {
+	  for (size_t j = 0; j < strings.size(); ++j) {
+		// normalized like the writings in the lookup table
+		if (!Normalizer::Normalize(strings[j], normalized, key_flags)) normalized = strings[j];
+		if (!normalized.empty()) keys.push_back({normalized, i, priorities[j]});
+	  }
+	};
+	add(entries[i].writings, entries[i].writing_priorities);
+	add(entries[i].readings, entries[i].reading_priorities);
+  }
+  // a key of an entry once, with its highest priority
+  std::sort(keys.begin(), keys.end(), [](const Key &a, const Key &b) {
+	return std::tie(a.key, a.entry, b.priority) < std::tie(b.key, b.entry, a.priority);
+  });
+  keys.erase(std::unique(keys.begin(), keys.end(), [](const Key &a, const Key &b) {
+	return a.key == b.key && a.entry == b.entry;
+  }), keys.end());
+
+  // The keys sharing a prefix are a contiguous range, a node of the implicit trie of the keys. The best completions
+  // of a node are the best of those of its children and of the keys equal to its prefix, so they are computed
+  // bottom-up, reading every key only in the nodes of at most completion_scan_limit keys.
+  std::vector<std::pair<std::string_view, std::vector<uint32_t>>> nodes;
+  auto complete = [&](auto &self, size_t begin, size_t end, size_t prefix_length) -> std::vector<uint32_t> {
+	std::vector<uint32_t> best;
+	if (end - begin <= completion_scan_limit) {
+	  for (size_t i = begin; i < end; ++i) best.push_back(i);
+	  KeepBestCompletions(best, keys, completion_top_k);
+	  return best;
+	}
+	// the nodes in preorder are sorted by the prefix
+	size_t node = nodes.size();
+	nodes.emplace_back(std::string_view(keys[begin].key).substr(0, prefix_length), std::vector<uint32_t>{});
+	size_t i = begin;
+	for (; i < end && keys[i].key.size() == prefix_length; ++i) best.push_back(i);
+	while (i < end) {
+	  size_t child_length = prefix_length;
+	  Utilities::DecodeUtf8(keys[i].key, child_length);
+	  std::string_view child = std::string_view(keys[i].key).substr(0, child_length);
+	  size_t child_end = std::partition_point(keys.begin() + i, keys.begin() + end, [&](const Key &key) {
+		return key.key.starts_with(child);
+	  }) - keys.begin();
+	  auto child_best = self(self, i, child_end, child_length);
+	  best.insert(best.end(), child_best.begin(), child_best.end());
+	  i = child_end;
+	}
+	KeepBestCompletions(best, keys, completion_top_k);
+	nodes[node].second = best;
+	return best;
+  };
+  complete(complete, 0, keys.size(), 0);
+
+  // the grams of each distinct key
+  std::unordered_map<uint64_t, std::vector<uint32_t>> grams;
+  std::vector<uint64_t> key_grams;
+  for (uint32_t i = 0; i < keys.size(); ++i) {
+	if (i > 0 && keys[i].key == keys[i - 1].key) continue;
+	key_grams.clear();
+	char32_t previous = 0;
+	for (size_t pos = 0; pos < keys[i].key.size();) {
+	  char32_t c = Utilities::DecodeUtf8(keys[i].key, pos);
+	  key_grams.push_back(Gram(c));
+	  if (previous != 0) key_grams.push_back(Gram(previous, c));
+	  previous = c;
+	}
+	std::sort(key_grams.begin(), key_grams.end());
+	key_grams.erase(std::unique(key_grams.begin(), key_grams.end()), key_grams.end());
+	for (auto gram : key_grams) grams[gram].push_back(i);
+  }
+  std::vector<uint64_t> sorted_grams;
+  for (auto &[gram, postings] : grams) sorted_grams.push_back(gram);
+  std::sort(sorted_grams.begin(), sorted_grams.end());
+
+  size_t first_key = writer.Allocate<CompletionKey>(keys.size());
+  writer.Link<CompletionKey>(header + offsetof(ImageHeader, completions), first_key, keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+	size_t key = first_key + i * sizeof(CompletionKey);
+	writer.At<CompletionKey>(key).entry = keys[i].entry;
+	writer.At<CompletionKey>(key).priority = keys[i].priority;
+	writer.LinkString(key + offsetof(CompletionKey, key), keys[i].key);
+  }
+  size_t first_node = writer.Allocate<CompletionNode>(nodes.size());
+  writer.Link<CompletionNode>(header + offsetof(ImageHeader, completion_nodes), first_node, nodes.size());
+  for (size_t i = 0; i < nodes.size(); ++i) {
+	size_t node = first_node + i * sizeof(CompletionNode);
+	writer.LinkString(node + offsetof(CompletionNode, prefix), nodes[i].first);
+	auto &top = nodes[i].second;
+	size_t first_index = writer.Allocate<uint32_t>(top.size());
+	std::memcpy(&writer.At<uint32_t>(first_index), top.data(), top.size() * sizeof(uint32_t));
+	writer.Link<uint32_t>(node + offsetof(CompletionNode, top), first_index, top.size());
+  }
+  size_t first_gram = writer.Allocate<GramPostings>(sorted_grams.size());
+  writer.Link<GramPostings>(header + offsetof(ImageHeader, grams), first_gram, sorted_grams.size());
+  for (size_t i = 0; i < sorted_grams.size(); ++i) {
+	size_t gram = first_gram + i * sizeof(GramPostings);
+	writer.At<GramPostings>(gram).gram = sorted_grams[i];
+	auto &postings = grams[sorted_grams[i]];
+	size_t first_index = writer.Allocate<uint32_t>(postings.size());
+	std::memcpy(&writer.At<uint32_t>(first_index), postings.data(), postings.size() * sizeof(uint32_t));
+	writer.Link<uint32_t>(gram + offsetof(GramPostings, keys), first_index, postings.size());
+  }
+}
+void Dictionary::WriteGlossIndex(FlatImageWriter &writer, size_t header, const std::vector<ParsedEntry> &entries) {
+  struct Term {
+	uint32_t entries = 0, last_entry = 0;
+	std::vector<uint8_t> postings;
+  };
+  std::unordered_map<std::string, Term> terms;
+  std::vector<uint32_t> lengths(entries.size());
+  uint64_t words = 0;
+  // the positions of each word in the glosses of an entry
+  std::unordered_map<std::string, std::vector<uint32_t>> positions;
+  for (uint32_t i = 0; i < entries.size(); ++i) {
+	positions.clear();
+	uint32_t position = 0;
+	for (auto &sense : entries[i].senses) {
+	  for (auto &gloss : sense.glosses) {
+		ForEachWord(gloss, [&](const std::string &word) {
+		  positions[word].push_back(position++);
+		  ++lengths[i];
+		});
+		++position;
+	  }
+	}
+	words += lengths[i];
+	for (auto &[word, occurrences] : positions) {
+	  auto &term = terms[word];
+	  AppendVarint(i - term.last_entry, term.postings);
+	  term.last_entry = i;
+	  ++term.entries;
+	  AppendVarint(occurrences.size(), term.postings);
+	  uint32_t previous = 0;
+	  for (auto occurrence : occurrences) {
+		AppendVarint(occurrence - previous, term.postings);
+		previous = occurrence;
+	  }
+	}
+  }
+  std::vector<const std::pair<const std::string, Term> *> sorted_terms;
+  for (auto &term : terms) sorted_terms.push_back(&term);
+  std::sort(sorted_terms.begin(), sorted_terms.end(), [](auto a, auto b) { return a->first < b->first; });
+
+  writer.At<ImageHeader>(header).gloss_words = words;
+  size_t first_term = writer.Allocate<GlossTerm>(sorted_terms.size());
+  writer.Link<GlossTerm>(header + offsetof(ImageHeader, gloss_terms), first_term, sorted_terms.size());
+  for (size_t i = 0; i < sorted_terms.size(); ++i) {
+	auto &[word, term] = *sorted_terms[i];
+	size_t position = first_term + i * sizeof(GlossTerm);
+	writer.At<GlossTerm>(position).entries = term.entries;
+	writer.LinkString(position + offsetof(GlossTerm, term), word);
+	size_t first_byte = writer.Allocate<uint8_t>(term.postings.size());
+	std::memcpy(&writer.At<uint8_t>(first_byte), term.postings.data(), term.postings.size());
+	writer.Link<uint8_t>(position + offsetof(GlossTerm, postings), first_byte, term.postings.size());
   }
+  size_t first_length = writer.Allocate<uint32_t>(lengths.size());
+  std::memcpy(&writer.At<uint32_t>(first_length), lengths.data(), lengths.size() * sizeof(uint32_t));
+  writer.Link<uint32_t>(header + offsetof(ImageHeader, gloss_lengths), first_length, lengths.size());
 }
-const DictionaryEntry *Dictionary::Query(const std::string &query) const {
-  auto found = entry_map.find(query);
-  if (found == entry_map.end()) return nullptr;
-  return found->second;
+void Dictionary::WriteKanjiIndex(FlatImageWriter &writer, size_t header, const std::vector<ParsedEntry> &entries) {
+  std::map<char32_t, std::vector<uint32_t>> kanji;
+  std::vector<char32_t> code_points;
+  for (uint32_t i = 0; i < entries.size(); ++i) {
+	code_points.clear();
+	for (auto &writing : entries[i].writings) {
+	  for (size_t pos = 0; pos < writing.size();) code_points.push_back(Utilities::DecodeUtf8(writing, pos));
+	}
+	std::sort(code_points.begin(), code_points.end());
+	code_points.erase(std::unique(code_points.begin(), code_points.end()), code_points.end());
+	for (auto c : code_points) kanji[c].push_back(i);
+  }
+
+  size_t first_postings = writer.Allocate<KanjiPostings>(kanji.size());
+  writer.Link<KanjiPostings>(header + offsetof(ImageHeader, kanji), first_postings, kanji.size());
+  size_t postings = first_postings;
+  for (auto &[c, indices] : kanji) {
+	auto bitmap = RoaringBitmap::FromSorted(indices);
+	writer.At<KanjiPostings>(postings).code_point = c;
+	writer.At<KanjiPostings>(postings).entries = indices.size();
+	auto &containers = bitmap.Containers();
+	size_t first_container = writer.Allocate<KanjiContainer>(containers.size());
+	writer.Link<KanjiContainer>(postings + offsetof(KanjiPostings, containers), first_container, containers.size());
+	for (size_t i = 0; i < containers.size(); ++i) {
+	  size_t container = first_container + i * sizeof(KanjiContainer);
+	  writer.At<KanjiContainer>(container).key = containers[i].key;
+	  auto &array = containers[i].array;
+	  size_t first_low = writer.Allocate<uint16_t>(array.size());
+	  std::memcpy(&writer.At<uint16_t>(first_low), array.data(), array.size() * sizeof(uint16_t));
+	  writer.Link<uint16_t>(container + offsetof(KanjiContainer, array), first_low, array.size());
+	  auto &words = containers[i].bitmap;
+	  size_t first_word = writer.Allocate<uint64_t>(words.size());
+	  std::memcpy(&writer.At<uint64_t>(first_word), words.data(), words.size() * sizeof(uint64_t));
+	  writer.Link<uint64_t>(container + offsetof(KanjiContainer, bitmap), first_word, words.size());
+	}
+	postings += sizeof(KanjiPostings);
+  }
+}
+bool Dictionary::SetImage(std::shared_ptr<const void> owner, const char *bytes, size_t size) {
+  auto header = reinterpret_cast<const ImageHeader *>(bytes);
+  if (size < sizeof(ImageHeader) || reinterpret_cast<uintptr_t>(bytes) % FlatImageWriter::alignment != 0
+	  || std::memcmp(header->magic, image_magic, sizeof(image_magic)) != 0 || header->version != image_version
+	  || header->header_size != sizeof(ImageHeader) || header->entry_size != sizeof(DictionaryEntry)
+	  || header->key_size != sizeof(IndexedKey) || header->image_size != size)
+	return false;
+  image_owner = std::move(owner);
+  image = header;
+  return true;
+}
+bool Dictionary::SaveImage(const std::string &path) const {
+  if (image == nullptr) return false;
+  // processes building the image at the same time write separate files
+  std::string temporary = path + ".tmp" + std::to_string(std::random_device{}());
+  FILE *file = fopen(temporary.c_str(), "wb");
+  if (file == nullptr) return false;
+  bool written = fwrite(image, 1, image->image_size, file) == image->image_size;
+  written = fclose(file) == 0 && written;
+  std::error_code error;
+  if (written) std::filesystem::rename(temporary, path, error);
+  if (!written || error) {
+	std::filesystem::remove(temporary, error);
+	return false;
+  }
+  return true;
+}
+bool Dictionary::LoadImage(const std::string &path) {
+#ifdef DICTIONARY_MMAP
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st{};
+  if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(ImageHeader))) {
+	close(fd);
+	return false;
+  }
+  size_t size = st.st_size;
+  // a shared read-only mapping is backed by the page cache, a single copy for all the processes
+  void *mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) return false;
+  std::shared_ptr<const void> owner(mapping, [size](const void *p) { munmap(const_cast<void *>(p), size); });
+  return SetImage(std::move(owner), static_cast<const char *>(mapping), size);
+#else
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file) return false;
+  auto bytes = std::make_shared<std::vector<char>>(static_cast<size_t>(file.tellg()));
+  file.seekg(0);
+  if (!file.read(bytes->data(), static_cast<std::streamsize>(bytes->size()))) return false;
+  return SetImage(bytes, bytes->data(), bytes->size());
+#endif
+}
+const Dictionary::IndexedKey *Dictionary::FindKey(std::string_view key) const {
+  Metrics::Add(Metrics::DICTIONARY_QUERIES);
+  thread_local unsigned queries = 0;
+  std::optional<Metrics::Timer> timer;
+  if (++queries % Metrics::dictionary_query_sample == 0) timer.emplace(Metrics::DICTIONARY_QUERY_LATENCY);
+  if (image == nullptr) return nullptr;
+  auto &table = image->key_table;
+  for (size_t slot = HashKey(key) & (table.size() - 1);; slot = (slot + 1) & (table.size() - 1)) {
+	if (table[slot] == empty_slot) return nullptr;
+	const IndexedKey &indexed = image->keys[table[slot]];
+	if (indexed.key == key) return &indexed;
+  }
+}
+const DictionaryEntry *Dictionary::Query(std::string_view query) const {
+  auto found = FindKey(query);
+  if (found == nullptr) return nullptr;
+  return &image->entries[found->entries.front()];
+}
+const DictionaryEntry *Dictionary::Query(std::string_view query, const PosMask &pos_mask) const {
+  auto found = FindKey(query);
+  // a single AND rejects the keys of other parts of speech
+  if (found == nullptr || (found->pos_mask & pos_mask).none()) return nullptr;
+  for (auto index : found->entries)
+	if ((image->entries[index].pos_mask & pos_mask).any()) return &image->entries[index];
+  return nullptr;
+}
+PosMask Dictionary::PosMaskMatching(const std::string &glob) const {
+  PosMask pos_mask;
+  if (image == nullptr) return pos_mask;
+  glob::dfa_glob_t g(glob);
+  for (size_t i = 0; i < image->pos_tags.size(); ++i)
+	if (glob::glob_match(std::string(image->pos_tags[i].view()), g)) pos_mask.set(std::min(i, size_t{POS_MASK_BITS - 1}));
+  return pos_mask;
+}
+bool Dictionary::HasKeyWithPrefix(std::string_view prefix) const {
+  if (image == nullptr) return false;
+  // the first key not less than the prefix starts with it if any key does
+  auto it = std::lower_bound(image->keys.begin(), image->keys.end(), prefix,
+							 [](const IndexedKey &key, std::string_view prefix) { return key.key.view() < prefix; });
+  return it != image->keys.end() && it->key.view().starts_with(prefix);
+}
+std::vector<Dictionary::Completion> Dictionary::Complete(std::string_view prefix, size_t k) const {
+  std::vector<Completion> completions;
+  if (image == nullptr || k == 0) return completions;
+  auto &keys = image->completions;
+  auto begin = std::lower_bound(keys.begin(), keys.end(), prefix,
+								[](const CompletionKey &key, std::string_view prefix) { return key.key.view() < prefix; });
+  auto end = std::partition_point(begin, keys.end(), [&](const CompletionKey &key) {
+	return key.key.view().starts_with(prefix);
+  });
+  std::vector<uint32_t> best;
+  if (end - begin > static_cast<ptrdiff_t>(completion_scan_limit)) {
+	auto &nodes = image->completion_nodes;
+	auto node = std::lower_bound(nodes.begin(), nodes.end(), prefix, [](const CompletionNode &node,
+																		   std::string_view prefix) {
+	  return node.prefix.view() < prefix;
+	});
+	// a prefix of more keys has a node, unless it ends inside a code point
+	if (node != nodes.end() && node->prefix == prefix)
+	  best.assign(node->top.begin(), node->top.begin() + std::min(k, node->top.size()));
+  }
+  if (best.empty()) {
+	for (auto it = begin; it != end; ++it) best.push_back(it - keys.begin());
+	KeepBestCompletions(best, keys, std::min(k, completion_top_k));
+  }
+  for (auto index : best) completions.push_back({keys[index].key.view(), &image->entries[keys[index].entry]});
+  return completions;
+}
+Dictionary::GlobStatus Dictionary::GlobSearch(std::string_view pattern, size_t limit,
+											  std::vector<Completion> &matches) const {
+  matches.clear();
+  std::u32string code_points;
+  // the byte offset of each code point
+  std::vector<size_t> offsets;
+  for (size_t pos = 0; pos < pattern.size();) {
+	offsets.push_back(pos);
+	code_points += Utilities::DecodeUtf8(pattern, pos);
+  }
+  offsets.push_back(pattern.size());
+  // the keys are not empty
+  if (code_points.empty()) return GlobStatus::OK;
+  std::optional<glob::basic_glob<char32_t, glob::dfa_glob<char32_t>>> automaton;
+  try {
+	automaton.emplace(code_points);
+  } catch (const glob::ComplexityError &) {
+	return GlobStatus::TOO_COMPLEX;
+  } catch (const glob::Error &) {
+	return GlobStatus::INVALID;
+  }
+  if (image == nullptr || limit == 0) return GlobStatus::OK;
+
+  std::vector<std::u32string> runs;
+  auto &keys = image->completions;
+  size_t begin = 0, end = keys.size();
+  if (LiteralRuns(code_points, runs)) {
+	std::string_view prefix = pattern.substr(0, offsets[runs[0].size()]);
+	begin = std::lower_bound(keys.begin(), keys.end(), prefix, [](const CompletionKey &key, std::string_view prefix) {
+	  return key.key.view() < prefix;
+	}) - keys.begin();
+	end = std::partition_point(keys.begin() + begin, keys.end(), [&](const CompletionKey &key) {
+	  return key.key.view().starts_with(prefix);
+	}) - keys.begin();
+  }
+  // the keys with the pairs of adjacent code points of the runs, or the code point of a run of one
+  std::vector<const FlatArray<uint32_t> *> postings;
+  for (auto &run : runs) {
+	for (size_t i = 0; i == 0 || i + 1 < run.size(); ++i) {
+	  uint64_t gram = run.size() == 1 ? Gram(run[0]) : Gram(run[i], run[i + 1]);
+	  auto it = std::lower_bound(image->grams.begin(), image->grams.end(), gram,
+								 [](const GramPostings &postings, uint64_t gram) { return postings.gram < gram; });
+	  if (it == image->grams.end() || it->gram != gram) return GlobStatus::OK;
+	  postings.push_back(&it->keys);
+	}
+  }
+  std::sort(postings.begin(), postings.end(), [](auto a, auto b) { return a->size() < b->size(); });
+
+  std::u32string key;
+  glob::MatchContext<char32_t> context;
+  std::unordered_set<uint32_t> found;
+  // matches the key at index i, returns true once there are enough matches
+  auto match = [&](size_t i) {
+	key.clear();
+	for (size_t pos = 0; pos < keys[i].key.size();) key += Utilities::DecodeUtf8(keys[i].key, pos);
+	if (!glob::glob_match(key, *automaton, context)) return false;
+	for (size_t j = i; j < keys.size() && keys[j].key.view() == keys[i].key.view(); ++j) {
+	  if (!found.insert(keys[j].entry).second) continue;
+	  matches.push_back({keys[j].key.view(), &image->entries[keys[j].entry]});
+	  if (matches.size() == limit) return true;
+	}
+	return false;
+  };
+  if (postings.empty() || end - begin <= postings[0]->size()) {
+	for (size_t i = begin; i < end; ++i) {
+	  if (i > begin && keys[i].key.view() == keys[i - 1].key.view()) continue;
+	  if (match(i)) break;
+	}
+	return GlobStatus::OK;
+  }
+  // the keys of the shortest postings in the prefix range and in all the other postings
+  for (auto it = std::lower_bound(postings[0]->begin(), postings[0]->end(), begin);
+	   it != postings[0]->end() && *it < end; ++it) {
+	if (!std::all_of(postings.begin() + 1, postings.end(),
+					 [&](auto other) { return std::binary_search(other->begin(), other->end(), *it); }))
+	  continue;
+	if (match(*it)) break;
+  }
+  return GlobStatus::OK;
+}
+std::vector<Dictionary::GlossMatch> Dictionary::GlossSearch(std::string_view query, size_t limit) const {
+  std::vector<GlossMatch> matches;
+  if (image == nullptr || limit == 0) return matches;
+  // the distinct words of the query, and its phrases as indices into words, a word outside the quotes is a phrase
+  std::vector<std::string> words;
+  std::vector<std::vector<size_t>> phrases;
+  bool quoted = false;
+  for (size_t start = 0, end; start <= query.size(); start = end + 1, quoted = !quoted) {
+	end = std::min(query.find('"', start), query.size());
+	if (quoted) phrases.emplace_back();
+	ForEachWord(query.substr(start, end - start), [&](const std::string &word) {
+	  size_t index = std::find(words.begin(), words.end(), word) - words.begin();
+	  if (index == words.size()) words.push_back(word);
+	  if (!quoted) phrases.emplace_back();
+	  phrases.back().push_back(index);
+	});
+	if (quoted && phrases.back().empty()) phrases.pop_back();
+  }
+  if (words.empty()) return matches;
+
+  // the decoded postings of each word, the occurrences in an entry are ends[k - 1] to ends[k], their positions are
+  // decoded only for the words of the phrases of more words
+  struct Postings {
+	uint32_t count;
+	bool positional = false;
+	std::vector<uint32_t> entries, ends, positions;
+	size_t cursor = 0;
+  };
+  std::vector<Postings> postings(words.size());
+  for (auto &phrase : phrases) {
+	if (phrase.size() > 1) for (auto i : phrase) postings[i].positional = true;
+  }
+  for (size_t i = 0; i < words.size(); ++i) {
+	auto term = std::lower_bound(image->gloss_terms.begin(), image->gloss_terms.end(), words[i],
+								 [](const GlossTerm &term, const std::string &word) { return term.term.view() < word; });
+	if (term == image->gloss_terms.end() || term->term != words[i]) return matches;
+	auto &decoded = postings[i];
+	decoded.count = term->entries;
+	decoded.entries.reserve(term->entries);
+	decoded.ends.reserve(term->entries);
+	uint32_t entry = 0, end = 0;
+	for (const uint8_t *p = term->postings.begin(); p < term->postings.end();) {
+	  entry += ReadVarint(p);
+	  decoded.entries.push_back(entry);
+	  uint32_t occurrences = ReadVarint(p), position = 0;
+	  decoded.ends.push_back(end += occurrences);
+	  for (uint32_t j = 0; j < occurrences; ++j) {
+		if (decoded.positional) decoded.positions.push_back(position += ReadVarint(p));
+		else while (*p++ >= 0x80);
+	  }
+	}
+  }
+  std::vector<size_t> rarest_first(words.size());
+  std::iota(rarest_first.begin(), rarest_first.end(), 0);
+  std::sort(rarest_first.begin(), rarest_first.end(),
+			[&](size_t a, size_t b) { return postings[a].count < postings[b].count; });
+
+  // the occurrences of word i in the entry at the cursors, and their positions for a positional word
+  auto frequency = [&](size_t i) {
+	auto &decoded = postings[i];
+	return decoded.ends[decoded.cursor] - (decoded.cursor == 0 ? 0 : decoded.ends[decoded.cursor - 1]);
+  };
+  auto occurrences = [&](size_t i) {
+	auto &decoded = postings[i];
+	auto first = decoded.positions.begin() + (decoded.cursor == 0 ? 0 : decoded.ends[decoded.cursor - 1]);
+	return std::span<const uint32_t>(first, decoded.positions.begin() + decoded.ends[decoded.cursor]);
+  };
+  auto contains_phrase = [&](const std::vector<size_t> &phrase) {
+	if (phrase.size() == 1) return true;
+	auto starts = occurrences(phrase[0]);
+	return std::any_of(starts.begin(), starts.end(), [&](uint32_t start) {
+	  for (size_t k = 1; k < phrase.size(); ++k) {
+		auto next = occurrences(phrase[k]);
+		if (!std::binary_search(next.begin(), next.end(), start + k)) return false;
+	  }
+	  return true;
+	});
+  };
+  // Okapi BM25 with the usual parameters
+  constexpr double k1 = 1.2, b = 0.75;
+  double entry_count = static_cast<double>(image->entries.size());
+  double average_length = static_cast<double>(image->gloss_words) / entry_count;
+  std::vector<double> idf(words.size());
+  for (size_t i = 0; i < words.size(); ++i) {
+	double count = postings[i].count;
+	idf[i] = std::log(1 + (entry_count - count + 0.5) / (count + 0.5));
+  }
+  auto &rarest = postings[rarest_first[0]];
+  for (rarest.cursor = 0; rarest.cursor < rarest.entries.size(); ++rarest.cursor) {
+	uint32_t entry = rarest.entries[rarest.cursor];
+	bool in_all = std::all_of(rarest_first.begin() + 1, rarest_first.end(), [&](size_t i) {
+	  auto &decoded = postings[i];
+	  decoded.cursor = std::lower_bound(decoded.entries.begin() + decoded.cursor, decoded.entries.end(), entry)
+		  - decoded.entries.begin();
+	  return decoded.cursor < decoded.entries.size() && decoded.entries[decoded.cursor] == entry;
+	});
+	if (!in_all || !std::all_of(phrases.begin(), phrases.end(), contains_phrase)) continue;
+	double score = 0;
+	double length = image->gloss_lengths[entry];
+	for (size_t i = 0; i < words.size(); ++i) {
+	  double tf = frequency(i);
+	  score += idf[i] * tf * (k1 + 1) / (tf + k1 * (1 - b + b * length / average_length));
+	}
+	matches.push_back({&image->entries[entry], score});
+  }
+  auto last = matches.begin() + static_cast<ptrdiff_t>(std::min(limit, matches.size()));
+  std::partial_sort(matches.begin(), last, matches.end(), [](const GlossMatch &a, const GlossMatch &b) {
+	return a.score != b.score ? a.score > b.score : a.entry < b.entry;
+  });
+  matches.erase(last, matches.end());
+  return matches;
+}
+const Dictionary::KanjiPostings *Dictionary::FindKanji(char32_t c) const {
+  auto &kanji = image->kanji;
+  auto it = std::lower_bound(kanji.begin(), kanji.end(), c,
+							 [](const KanjiPostings &postings, char32_t c) { return postings.code_point < c; });
+  return it == kanji.end() || it->code_point != c ? nullptr : it;
+}
+RoaringBitmap Dictionary::ToBitmap(const KanjiPostings &postings) {
+  RoaringBitmap bitmap;
+  for (auto &container : postings.containers) {
+	bitmap.AppendContainer(container.key, {container.array.begin(), container.array.end()},
+						   {container.bitmap.begin(), container.bitmap.end()});
+  }
+  return bitmap;
+}
+RoaringBitmap Dictionary::KanjiSearch(std::string_view all, std::string_view any, std::string_view none) const {
+  RoaringBitmap result;
+  if (image == nullptr || (all.empty() && any.empty())) return result;
+  std::vector<const KanjiPostings *> required;
+  for (size_t pos = 0; pos < all.size();) {
+	auto postings = FindKanji(Utilities::DecodeUtf8(all, pos));
+	if (postings == nullptr) return result;
+	required.push_back(postings);
+  }
+  // the intersection is never larger than the rarest set, so it starts there and the later ones are smaller
+  std::sort(required.begin(), required.end(), [](auto a, auto b) { return a->entries < b->entries; });
+  for (size_t i = 0; i < required.size(); ++i) {
+	if (i == 0) result = ToBitmap(*required[i]);
+	else result &= ToBitmap(*required[i]);
+	if (result.empty()) return result;
+  }
+  if (!any.empty()) {
+	RoaringBitmap alternatives;
+	for (size_t pos = 0; pos < any.size();) {
+	  if (auto postings = FindKanji(Utilities::DecodeUtf8(any, pos))) alternatives |= ToBitmap(*postings);
+	}
+	if (required.empty()) result = std::move(alternatives);
+	else result &= alternatives;
+  }
+  for (size_t pos = 0; pos < none.size() && !result.empty();) {
+	if (auto postings = FindKanji(Utilities::DecodeUtf8(none, pos))) result -= ToBitmap(*postings);
+  }
+  return result;
+}
+std::vector<Dictionary::FuzzyMatch> Dictionary::FuzzyQuery(std::string_view query, unsigned max_distance,
+															const PosMask &pos_mask, size_t limit) const {
+  std::vector<FuzzyMatch> matches;
+  if (image == nullptr || image->keys.empty() || limit == 0) return matches;
+  // the code points of the query and their UTF-8
+  std::vector<char32_t> target;
+  std::vector<std::string_view> target_bytes;
+  for (size_t pos = 0; pos < query.size();) {
+	size_t start = pos;
+	target.push_back(Utilities::DecodeUtf8(query, pos));
+	target_bytes.push_back(query.substr(start, pos - start));
+  }
+  // The state of the Levenshtein automaton of the query after reading a key prefix is the row of the edit distances
+  // between the prefix and every prefix of the query (Wagner-Fischer). The keys sharing a prefix are a contiguous
+  // range of the sorted keys, a node of the implicit trie. rows holds a row per depth of the walk.
+  const size_t width = target.size() + 1;
+  std::vector<unsigned> rows(width);
+  for (size_t j = 0; j < width; ++j) rows[j] = j;
+  auto &keys = image->keys;
+  // the prefix of the keys of the node and a child looked up
+  std::string prefix, child;
+  auto walk = [&](auto &self, size_t begin, size_t end, size_t depth) -> void {
+	size_t row = depth * width;
+	size_t i = begin;
+	// the key equal to the prefix is the first one of its range
+	if (keys[i].key.size() == prefix.size()) {
+	  if (rows[row + width - 1] <= max_distance && (keys[i].pos_mask & pos_mask).any()) {
+		for (auto index : keys[i].entries) {
+		  if ((image->entries[index].pos_mask & pos_mask).none()) continue;
+		  matches.push_back({keys[i].key.view(), &image->entries[index], rows[row + width - 1]});
+		  break;
+		}
+	  }
+	  ++i;
+	}
+	if (rows.size() < row + 2 * width) rows.resize(row + 2 * width);
+	// the keys in [child_begin, child_end) continue the prefix with c
+	auto visit = [&](size_t child_begin, size_t child_end, char32_t c, std::string_view c_bytes) {
+	  size_t next = row + width;
+	  rows[next] = rows[row] + 1;
+	  unsigned closest = rows[next];
+	  for (size_t j = 1; j < width; ++j) {
+		rows[next + j] = std::min({rows[row + j] + 1, rows[next + j - 1] + 1,
+								   rows[row + j - 1] + (target[j - 1] == c ? 0 : 1)});
+		closest = std::min(closest, rows[next + j]);
+	  }
+	  // every key of the subtree is farther than the closest prefix of the query
+	  if (closest > max_distance) return;
+	  prefix.append(c_bytes);
+	  self(self, child_begin, child_end, depth + 1);
+	  prefix.resize(prefix.size() - c_bytes.size());
+	};
+	// galloping from the start of the range, which is usually short, keeps the search near the keys just read
+	auto range_end = [&](size_t from, std::string_view child) {
+	  auto in_range = [&](const IndexedKey &key) { return key.key.view().starts_with(child); };
+	  size_t step = 1;
+	  while (from + step < end && in_range(keys[from + step])) from += step, step *= 2;
+	  return std::partition_point(keys.begin() + from, keys.begin() + std::min(from + step, end), in_range)
+		  - keys.begin();
+	};
+	unsigned closest = *std::min_element(rows.begin() + row, rows.begin() + row + width);
+	if (closest < max_distance) {
+	  // an edit is left, so any character may follow
+	  while (i < end) {
+		std::string_view key = keys[i].key.view();
+		size_t child_length = prefix.size();
+		char32_t c = Utilities::DecodeUtf8(key, child_length);
+		size_t child_end = range_end(i, key.substr(0, child_length));
+		visit(i, child_end, c, key.substr(prefix.size(), child_length - prefix.size()));
+		i = child_end;
+	  }
+	  return;
+	}
+	// Without an edit left only a character of the query matching at a prefix of the budget keeps a key close
+	// enough, so those children are looked up instead of reading every child.
+	auto candidate = [&](size_t j) { return rows[row + j] == max_distance; };
+	for (size_t j = 0; j + 1 < width; ++j) {
+	  if (!candidate(j)) continue;
+	  bool repeated = false;
+	  for (size_t k = 0; k < j && !repeated; ++k) repeated = candidate(k) && target[k] == target[j];
+	  if (repeated) continue;
+	  child.assign(prefix).append(target_bytes[j]);
+	  auto first = std::lower_bound(keys.begin() + i, keys.begin() + end, child,
+									[](const IndexedKey &key, const std::string &value) {
+									  return key.key.view() < value;
+									});
+	  auto child_begin = static_cast<size_t>(first - keys.begin());
+	  size_t child_end = range_end(child_begin, child);
+	  if (child_begin < child_end) visit(child_begin, child_end, target[j], target_bytes[j]);
+	}
+  };
+  walk(walk, 0, keys.size(), 0);
+  // the children are not always visited in the order of the keys
+  std::sort(matches.begin(), matches.end(), [](auto &a, auto &b) {
+	return std::tie(a.distance, a.key) < std::tie(b.distance, b.key);
+  });
+  if (matches.size() > limit) matches.resize(limit);
+  return matches;
 }
-std::ostream &operator<<(std::ostream &os, DictionaryEntrySense &sense) {
+std::ostream &operator<<(std::ostream &os, const DictionaryEntrySense &sense) {
   os << "(";
   Utilities::Join(sense.part_of_speech, " ", os);
   os << ") ";
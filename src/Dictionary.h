@@ -6,49 +6,273 @@
 #define OSHI_CPP__DICTIONARY_H_
 
 #include "Utilities.h"
+#include "FlatImage.h"
+#include "RoaringBitmap.h"
+#include "Normalizer.h"
 #include "pugixml.hpp"
 #include <iostream>
+#include <memory>
 #include <vector>
 #include <unordered_map>
+#include <bitset>
 
 #define JMDICT_GZ "JMdict_e.gz"
 #define JMDICT_XML "JMdict_e.xml"
+#define JMDICT_IMAGE_STEM "JMdict_e"
+#define POS_MASK_BITS 128
 
-/// A class representing individual possible senses of a single dictionary entry
+/// A set of POS tags, one bit per distinct tag in the dictionary (see Dictionary::PosMaskMatching)
+using PosMask = std::bitset<POS_MASK_BITS>;
+
+/// A class representing individual possible senses of a single dictionary entry.
+/// The dictionary entries live in the image of the Dictionary (see FlatImage.h), so they are referenced, not copied.
 class DictionaryEntrySense {
  public:
   /// POS tags
-  std::vector<std::string> part_of_speech;
+  FlatArray<FlatString> part_of_speech;
   /// that is "translations"
-  std::vector<std::string> glosses;
-  friend std::ostream &operator<<(std::ostream &os, DictionaryEntrySense &sense);
+  FlatArray<FlatString> glosses;
+  friend std::ostream &operator<<(std::ostream &os, const DictionaryEntrySense &sense);
 };
 
 class DictionaryEntry {
  public:
+  /// The JMdict entry ID (ent_seq), stable across dictionary releases
+  uint32_t id;
   /// Possible readings (kana) of the entry
-  std::vector<std::string> readings;
+  FlatArray<FlatString> readings;
   /// Possible writings (kanji+kana) of the entry
-  std::vector<std::string> writings;
-  std::vector<DictionaryEntrySense> senses;
+  FlatArray<FlatString> writings;
+  FlatArray<DictionaryEntrySense> senses;
+  /// Union of the POS tags of all senses
+  PosMask pos_mask;
 
   friend std::ostream &operator<<(std::ostream &os, const DictionaryEntry &entry);
 };
 
+/// Hash enabling std::string_view lookups in maps keyed by std::string, without constructing a std::string
+struct StringHash {
+  using is_transparent = void;
+  size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s); }
+};
+
+/// The dictionary is a single flat image (see FlatImage.h): the entries, the writings in lexicographic order with
+/// a hash table over them, the POS tags, and the writings and readings with the precomputed completions. It is
+/// built from the XML or mapped read-only from a file written by SaveImage, so processes mapping the same file share
+/// a single copy of it. Copies of a Dictionary share the image.
+/// The writings are keyed normalized by Normalizer with KeyFlags: their width folded, and with katakana converted to
+/// hiragana if the image was built so, so a query must be normalized with QueryFlags to be found.
 class Dictionary {
  private:
-  std::vector<DictionaryEntry> entries;
-  std::unordered_map<std::string, DictionaryEntry *> entry_map;
-  void PrepareLookupMap();
+  /// The entries written in the same way (after normalization) and the union of their POS tags
+  struct IndexedKey {
+	FlatString key;
+	/// indices into ImageHeader::entries, in the dictionary order
+	FlatArray<uint32_t> entries;
+	PosMask pos_mask;
+  };
+  /// A normalized writing or reading of an entry, for the completions
+  struct CompletionKey {
+	FlatString key;
+	/// index into ImageHeader::entries
+	uint32_t entry;
+	/// from the JMdict priority markers of the writing or the reading, higher for the more common words
+	uint32_t priority;
+  };
+  /// The best completions of a prefix of more than completion_scan_limit keys, a node of the trie of the keys
+  struct CompletionNode {
+	FlatString prefix;
+	/// indices into ImageHeader::completions, best first, an entry at most once
+	FlatArray<uint32_t> top;
+  };
+  /// The completion keys containing a code point or a pair of adjacent code points, for the glob searches
+  struct GramPostings {
+	/// the first code point in the upper half, the second one (0 for a single code point) in the lower half
+	uint64_t gram;
+	/// indices into ImageHeader::completions of the first of the equal keys, ascending
+	FlatArray<uint32_t> keys;
+  };
+  /// A word of the glosses and the entries with it, for the English lookups
+  struct GlossTerm {
+	/// lowercase
+	FlatString term;
+	/// the number of entries with the word
+	uint32_t entries;
+	/// For each entry with the word, ascending, the LEB128 varints of the entry index minus the previous one, of the
+	/// number of occurrences and of the position of each occurrence minus the previous one. The positions count the
+	/// words of all the glosses of the entry, skipping one between the glosses so that no phrase spans two.
+	FlatArray<uint8_t> postings;
+  };
+  /// A container of the Roaring bitmap of a code point, see RoaringBitmap
+  struct KanjiContainer {
+	/// the high 16 bits of the entry indices
+	uint32_t key;
+	/// the low 16 bits ascending, or the bitmap of them if there are more than RoaringBitmap::array_limit
+	FlatArray<uint16_t> array;
+	FlatArray<uint64_t> bitmap;
+  };
+  /// The entries with a writing containing a code point, for the kanji searches
+  struct KanjiPostings {
+	uint32_t code_point;
+	/// the number of the entries
+	uint32_t entries;
+	/// the indices into ImageHeader::entries as a Roaring bitmap, by the key
+	FlatArray<KanjiContainer> containers;
+  };
+  /// The start of the image
+  struct ImageHeader {
+	char magic[8];
+	/// must match sizeof of the image structures, which depend on the platform
+	uint32_t version, header_size, entry_size, key_size;
+	/// the Normalizer flags the keys are normalized with
+	uint32_t key_flags;
+	uint64_t image_size;
+	/// the number of words of all the glosses
+	uint64_t gloss_words;
+	FlatArray<DictionaryEntry> entries;
+	/// sorted by the key, for prefix searches
+	FlatArray<IndexedKey> keys;
+	/// open addressing table of indices into keys, UINT32_MAX is an empty slot, the size is a power of two
+	FlatArray<uint32_t> key_table;
+	/// Distinct POS tags, the position is the bit in PosMask. If there are more tags than bits,
+	/// the last bit is shared by the rest, which only makes the masks less precise.
+	FlatArray<FlatString> pos_tags;
+	/// sorted by the key and the entry, for the completions
+	FlatArray<CompletionKey> completions;
+	/// sorted by the prefix
+	FlatArray<CompletionNode> completion_nodes;
+	/// sorted by the gram
+	FlatArray<GramPostings> grams;
+	/// sorted by the term
+	FlatArray<GlossTerm> gloss_terms;
+	/// the number of words of the glosses of each entry
+	FlatArray<uint32_t> gloss_lengths;
+	/// sorted by the code point
+	FlatArray<KanjiPostings> kanji;
+  };
+  /// An entry parsed from the XML, before it is written into the image
+  struct ParsedSense {
+	std::vector<std::string> part_of_speech, glosses;
+  };
+  struct ParsedEntry {
+	uint32_t id = 0;
+	std::vector<std::string> readings, writings;
+	/// the priorities of the readings and the writings, see CompletionKey
+	std::vector<uint32_t> reading_priorities, writing_priorities;
+	std::vector<ParsedSense> senses;
+	PosMask pos_mask;
+  };
+  /// Keeps the memory or the mapping of the image alive
+  std::shared_ptr<const void> image_owner;
+  const ImageHeader *image = nullptr;
+  /// Makes \p bytes the image if it is a valid one
+  bool SetImage(std::shared_ptr<const void> owner, const char *bytes, size_t size);
+  void BuildImage(const std::vector<ParsedEntry> &entries, const std::vector<std::string> &pos_tags,
+				  unsigned key_flags);
+  /// Writes the completion keys, the completion nodes and the grams of the image with the header at \p header
+  static void WriteCompletions(FlatImageWriter &writer, size_t header, const std::vector<ParsedEntry> &entries);
+  /// Writes the gloss terms and the gloss lengths of the image with the header at \p header
+  static void WriteGlossIndex(FlatImageWriter &writer, size_t header, const std::vector<ParsedEntry> &entries);
+  /// Writes the kanji postings of the image with the header at \p header
+  static void WriteKanjiIndex(FlatImageWriter &writer, size_t header, const std::vector<ParsedEntry> &entries);
+  /// Returns the entries with a writing containing \p c, nullptr if there are none
+  const KanjiPostings *FindKanji(char32_t c) const;
+  static RoaringBitmap ToBitmap(const KanjiPostings &postings);
+  /// Prefixes of at most this many completion keys are completed by reading all of them, the longer ones have a node
+  static constexpr size_t completion_scan_limit = 128;
+  const IndexedKey *FindKey(std::string_view key) const;
  public:
   /// Find a dictionary entry corresponding exactly to \p query
   /// \return nullptr if nothing found, otherwise first DictionaryEntry matching by writing
-  const DictionaryEntry *Query(const std::string &query) const;
+  const DictionaryEntry *Query(std::string_view query) const;
+  /// Find a dictionary entry corresponding exactly to \p query with a sense of any POS tag in \p pos_mask
+  /// \return nullptr if nothing found, otherwise first such DictionaryEntry matching by writing
+  const DictionaryEntry *Query(std::string_view query, const PosMask &pos_mask) const;
+  /// Returns the set of the dictionary POS tags matching the \p glob
+  PosMask PosMaskMatching(const std::string &glob) const;
+  /// Returns whether any writing in the dictionary starts with \p prefix
+  bool HasKeyWithPrefix(std::string_view prefix) const;
+  /// A key close to a query, see FuzzyQuery
+  struct FuzzyMatch {
+	std::string_view key;
+	/// the first entry of the key with a POS tag of the mask
+	const DictionaryEntry *entry;
+	/// edits of code points between the query and the key
+	unsigned distance;
+  };
+  /// An entry found by GlossSearch
+  struct GlossMatch {
+	const DictionaryEntry *entry;
+	/// Okapi BM25 of the words of the query in the glosses of the entry
+	double score;
+  };
+  /// Finds the entries whose glosses contain every word of \p query and every "quoted phrase" as consecutive words of
+  /// a single gloss, ignoring the case, for the lookups from English. The words are runs of ASCII letters and digits
+  /// and of any non-ASCII characters. Only the postings of the words of the query are decoded.
+  /// \return At most \p limit entries with the highest scores, ties in the dictionary order
+  std::vector<GlossMatch> GlossSearch(std::string_view query, size_t limit) const;
+  /// Returns the entries with a writing containing every code point of \p all, at least one of \p any (unless it is
+  /// empty) and none of \p none, e.g. every entry written with both 書 and 道. The writings of an entry count
+  /// together. Each code point has the set of its entries stored as a Roaring bitmap, so the cost follows the
+  /// compressed sizes of the sets of the code points, not the number of the writings.
+  /// \return The indices of the entries (see Entry), empty if both \p all and \p any are empty
+  RoaringBitmap KanjiSearch(std::string_view all, std::string_view any = {}, std::string_view none = {}) const;
+  /// Returns the entry at \p index in the dictionary order
+  const DictionaryEntry &Entry(uint32_t index) const { return image->entries[index]; }
+  /// Finds the keys within \p max_distance insertions, deletions or substitutions of code points of \p query, having
+  /// an entry with a POS tag in \p pos_mask. The sorted keys are walked as a trie, a subtree only while a key in it
+  /// can still be close enough, so the cost depends on the neighbourhood of the query, not on the number of keys.
+  /// \return At most \p limit matches, closest first, ties in the order of the keys
+  std::vector<FuzzyMatch> FuzzyQuery(std::string_view query, unsigned max_distance, const PosMask &pos_mask,
+									 size_t limit) const;
+  /// The most completions Complete returns
+  static constexpr size_t completion_top_k = 10;
+  /// An entry with a writing or a reading starting with the prefix or matching the pattern, see Complete and
+  /// GlobSearch
+  struct Completion {
+	/// the normalized writing or reading
+	std::string_view key;
+	const DictionaryEntry *entry;
+  };
+  /// Returns at most \p k (and completion_top_k) entries with a writing or a reading starting with \p prefix, for
+  /// the suggestions as the user types. The prefix must be normalized like the queries and consist of whole code
+  /// points. The most common words come first (by the JMdict priority markers), then the shorter keys, each entry
+  /// once. The completions of the prefixes of many keys are precomputed, so the time does not grow with their number.
+  std::vector<Completion> Complete(std::string_view prefix, size_t k = completion_top_k) const;
+  /// Whether GlobSearch could match the pattern
+  enum class GlobStatus {
+	OK,
+	/// the pattern is not a valid glob
+	INVALID,
+	/// the pattern is valid, but a !(...) group in it would need too many DFA states (glob::ComplexityError)
+	TOO_COMPLEX
+  };
+  /// Finds the entries with a writing or a reading matching the glob \p pattern (e.g. *書* or ?く), normalized like
+  /// the queries. The keys are matched by code points. Only the keys containing the literal parts of the pattern
+  /// (their code points and pairs of adjacent code points, see GramPostings) or starting with its literal prefix are
+  /// matched with the glob, not every key.
+  /// \param matches At most \p limit matches in the order of the keys, each entry once
+  GlobStatus GlobSearch(std::string_view pattern, size_t limit, std::vector<Completion> &matches) const;
   /// Decompresses the dictionary into XML
   /// \return true if succeeded
   static bool InflateDictionary();
+  /// The image file of the dictionary with the keys normalized with \p key_flags, JMdict_e.FLAGS.oshi, so that the
+  /// images of different flags (see --hiragana) are kept side by side
+  static std::string ImagePath(unsigned key_flags);
   /// Load dictionary data from parsed XML document
-  void LoadDictionary(pugi::xml_document &doc);
+  /// \param key_flags Normalizer flags of the keys, Normalizer::FOLD_WIDTH with Normalizer::KATAKANA_TO_HIRAGANA
+  /// for a dictionary in which the queries in hiragana find the writings in katakana too
+  void LoadDictionary(pugi::xml_document &doc, unsigned key_flags = Normalizer::FOLD_WIDTH);
+  /// The Normalizer flags the keys were normalized with, 0 without an image
+  unsigned KeyFlags() const { return image == nullptr ? 0 : image->key_flags; }
+  /// The Normalizer flags a raw query is normalized with before a lookup: Normalizer::query_flags and KeyFlags
+  unsigned QueryFlags() const { return Normalizer::query_flags | KeyFlags(); }
+  /// Writes the image to \p path, replacing the file at once so that a process never maps a partial image
+  /// \return true if succeeded
+  bool SaveImage(const std::string &path) const;
+  /// Maps the image at \p path written by SaveImage, read-only and shared with other processes where possible
+  /// \return false if the file cannot be read or is not an image of this version of the program
+  bool LoadImage(const std::string &path);
 };
 
 #endif //OSHI_CPP__DICTIONARY_H_
@@ -0,0 +1,96 @@
+//
+// Created by praza on 18.10.2026.
+//
+
+#ifndef OSHI_CPP__FLATIMAGE_H_
+#define OSHI_CPP__FLATIMAGE_H_
+
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/// An array stored in a flat image (see FlatImageWriter). The position of the elements is an offset relative to the
+/// array itself, so the image works wherever it is mapped in memory, e.g. shared by several processes.
+/// It exists only inside an image, hence it cannot be copied.
+template<class T>
+class FlatArray {
+ public:
+  FlatArray() = default;
+  FlatArray(const FlatArray &other) = delete;
+  FlatArray &operator=(const FlatArray &other) = delete;
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const T *begin() const { return reinterpret_cast<const T *>(reinterpret_cast<const char *>(this) + offset_); }
+  const T *end() const { return begin() + size_; }
+  const T &operator[](size_t i) const { return begin()[i]; }
+  const T &front() const { return *begin(); }
+ private:
+  friend class FlatImageWriter;
+  int32_t offset_;
+  uint32_t size_;
+};
+
+/// A UTF-8 string stored in a flat image
+class FlatString : public FlatArray<char> {
+ public:
+  std::string_view view() const { return {begin(), size()}; }
+  operator std::string_view() const { return view(); }
+  friend bool operator==(const FlatString &a, std::string_view b) { return a.view() == b; }
+  friend std::ostream &operator<<(std::ostream &os, const FlatString &s) { return os << s.view(); }
+};
+
+/// Builds a flat image, a single block of memory without pointers which can be written to a file and mapped back.
+/// Objects are allocated zeroed (empty arrays) and then linked together by the positions in the image, since the
+/// image moves while it grows. Equal strings are stored only once.
+class FlatImageWriter {
+ public:
+  /// Appends space for \p count objects of \p T, zeroed
+  /// \return The position of the first one
+  template<class T>
+  size_t Allocate(size_t count = 1) {
+	static_assert(alignof(T) <= alignment);
+	image_.resize((image_.size() + alignof(T) - 1) / alignof(T) * alignof(T));
+	size_t position = image_.size();
+	image_.resize(position + count * sizeof(T));
+	return position;
+  }
+  /// Returns the object at \p position, valid until the next allocation
+  template<class T>
+  T &At(size_t position) { return *reinterpret_cast<T *>(image_.data() + position); }
+  /// Makes the array at \p array_position contain the \p count objects allocated at \p position
+  template<class T>
+  void Link(size_t array_position, size_t position, size_t count) {
+	int64_t offset = static_cast<int64_t>(position) - static_cast<int64_t>(array_position);
+	if (offset != static_cast<int32_t>(offset) || count > UINT32_MAX)
+	  throw std::length_error("Flat image larger than 2 GiB");
+	auto &array = At<FlatArray<T>>(array_position);
+	array.offset_ = static_cast<int32_t>(offset);
+	array.size_ = static_cast<uint32_t>(count);
+  }
+  /// Stores \p s, unless it is stored already, as the string at \p string_position
+  void LinkString(size_t string_position, std::string_view s) {
+	auto [it, inserted] = strings_.try_emplace(std::string(s), 0);
+	if (inserted) {
+	  it->second = Allocate<char>(s.size());
+	  std::memcpy(image_.data() + it->second, s.data(), s.size());
+	}
+	Link<char>(string_position, it->second, s.size());
+  }
+  /// Returns the finished image, the writer is empty afterwards
+  std::vector<char> Release() {
+	strings_.clear();
+	return std::move(image_);
+  }
+  /// Alignment of the image start that all the objects require, operator new provides at least as much
+  static constexpr size_t alignment = 8;
+ private:
+  std::vector<char> image_;
+  std::unordered_map<std::string, size_t> strings_;
+};
+
+#endif //OSHI_CPP__FLATIMAGE_H_
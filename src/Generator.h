@@ -0,0 +1,92 @@
+//
+// Created by praza on 18.10.2026.
+//
+
+#ifndef OSHI_CPP__GENERATOR_H_
+#define OSHI_CPP__GENERATOR_H_
+
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#include <optional>
+#include <utility>
+
+/// A lazily evaluated sequence of values produced by a coroutine using co_yield.
+/// The coroutine runs only when the next value is requested, so abandoning the Generator early costs nothing.
+template<class T>
+class Generator {
+ public:
+  class promise_type {
+   public:
+	std::optional<T> current;
+	std::exception_ptr exception;
+	Generator get_return_object() { return Generator{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+	std::suspend_always initial_suspend() noexcept { return {}; }
+	std::suspend_always final_suspend() noexcept { return {}; }
+	std::suspend_always yield_value(T value) {
+	  current = std::move(value);
+	  return {};
+	}
+	void return_void() {}
+	void unhandled_exception() { exception = std::current_exception(); }
+  };
+
+  class iterator {
+	std::coroutine_handle<promise_type> handle_;
+   public:
+	using iterator_category = std::input_iterator_tag;
+	using value_type = T;
+	using difference_type = std::ptrdiff_t;
+	iterator() = default;
+	explicit iterator(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+	T &operator*() const { return *handle_.promise().current; }
+	iterator &operator++() {
+	  Generator::Resume(handle_);
+	  return *this;
+	}
+	void operator++(int) { ++*this; }
+	bool operator==(std::default_sentinel_t) const { return !handle_ || handle_.done(); }
+  };
+
+  Generator() = default;
+  Generator(const Generator &other) = delete;
+  Generator(Generator &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+  Generator &operator=(Generator &&other) noexcept {
+	if (this != &other) {
+	  if (handle_) handle_.destroy();
+	  handle_ = std::exchange(other.handle_, nullptr);
+	}
+	return *this;
+  }
+  ~Generator() {
+	if (handle_) handle_.destroy();
+  }
+
+  /// Runs the coroutine until it yields the first value
+  iterator begin() {
+	Resume(handle_);
+	return iterator{handle_};
+  }
+  std::default_sentinel_t end() { return {}; }
+
+  /// Runs the coroutine until it yields the next value
+  /// \return std::nullopt if the sequence is exhausted
+  std::optional<T> Next() {
+	Resume(handle_);
+	if (!handle_ || handle_.done()) return std::nullopt;
+	return std::move(handle_.promise().current);
+  }
+
+ private:
+  std::coroutine_handle<promise_type> handle_;
+  explicit Generator(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+  static void Resume(std::coroutine_handle<promise_type> handle) {
+	if (!handle || handle.done()) return;
+	handle.promise().current.reset();
+	handle.resume();
+	// rethrow exceptions from the coroutine body in the consumer
+	if (handle.promise().exception) std::rethrow_exception(std::exchange(handle.promise().exception, nullptr));
+  }
+};
+
+#endif //OSHI_CPP__GENERATOR_H_
@@ -5,6 +5,9 @@
 #include "Grammar.h"
 #include "glob-cpp/glob.h"
 #include <algorithm>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 
 // the regex uses \S for "non-whitespace" characters, because the rule parts are separated by whitespace
 // and the parts may contain Japanese characters, which are faster and easier to match by \S than some
@@ -12,18 +15,104 @@
 const std::regex GrammarRule::rule_regex_ = std::regex(
 	"^(\\S+)\\s*(\\S*)\\s+〜(\\S*)\\s*(\\S*)\\s+for\\s+(\\S*)\\s+〜(\\S*) +((?:[ \t]*\\S+)+)\\s*$");
 
+namespace {
+/// Returns \p pattern compiled to a DFA, once per process. A compiled glob is only read while matching, so all the
+/// threads share it. The globs of the triples are the few POS globs of the rules.
+const glob::dfa_glob_t &CompiledGlob(const std::string &pattern) {
+  static std::shared_mutex mutex;
+  static std::unordered_map<std::string, std::unique_ptr<const glob::dfa_glob_t>> globs;
+  {
+	std::shared_lock lock(mutex);
+	if (auto it = globs.find(pattern); it != globs.end()) return *it->second;
+  }
+  auto compiled = std::make_unique<const glob::dfa_glob_t>(pattern);
+  std::unique_lock lock(mutex);
+  return *globs.try_emplace(pattern, std::move(compiled)).first->second;
+}
+}
+
 void Grammar::LoadGrammarRules() {
   auto grammar_file = std::ifstream(grammar_file_path_);
   for (std::string line; getline(grammar_file, line);) {
-	// ignore comments and whitespace-only lines
-	if (line.starts_with('#') || Utilities::StringIsWhitespaceOrEmpty(line))
+	// ignore comments (from # to the end of the line) and whitespace-only lines
+	auto comment = line.find('#');
+	if (comment != std::string::npos) line.erase(comment);
+	if (Utilities::StringIsWhitespaceOrEmpty(line))
 	  continue;
 	// parse the rest
 	std::vector<GrammarRule> parsed_rules = GrammarRule::Parse(line);
 	rules_.insert(rules_.end(), parsed_rules.begin(), parsed_rules.end());
   }
+  for (const auto &rule : rules_) {
+	for (size_t i = 0; i < rule.pattern.size();) pattern_characters_.insert(Utilities::DecodeUtf8(rule.pattern, i));
+  }
+  Intern();
   D(std::cerr << "Loaded " << rules_.size() << " grammar rules." << std::endl);
 }
+void Grammar::Intern() {
+  auto intern = [](std::vector<std::string> &table, std::unordered_map<std::string, unsigned> &ids,
+				   const std::string &s) {
+	auto [it, inserted] = ids.try_emplace(s, table.size());
+	if (inserted) table.push_back(s);
+	return it->second;
+  };
+  std::unordered_map<std::string, unsigned> role_ids, pos_ids, glob_ids;
+  intern(roles_, role_ids, "");
+  intern(pos_, pos_ids, "");
+  intern(globs_, glob_ids, "*");
+  for (unsigned i = 0; i < rules_.size(); ++i) {
+	GrammarRule &rule = rules_[i];
+	rule.index = i;
+	rule.rule_id = intern(roles_, role_ids, rule.rule);
+	rule.role_id = intern(roles_, role_ids, rule.role);
+	rule.target_id = intern(roles_, role_ids, rule.target);
+	rule.pos_id = intern(pos_, pos_ids, rule.pos);
+	rule.pos_globs_id = intern(globs_, glob_ids, rule.pos_globs);
+	rule.target_fixed_length = FixedPrefixLength(rule.target_pattern);
+  }
+  // the empty POS is applicable to any glob
+  pos_matches_glob_.assign(pos_.size() * globs_.size(), true);
+  for (unsigned glob_id = 0; glob_id < globs_.size(); ++glob_id) {
+	glob::dfa_glob_t g(globs_[glob_id]);
+	for (unsigned pos_id = 1; pos_id < pos_.size(); ++pos_id)
+	  pos_matches_glob_[pos_id * globs_.size() + glob_id] = glob::glob_match(pos_[pos_id], g);
+  }
+  // compile the rule table
+  for (auto &rule : rules_) {
+	pattern_lanes_.emplace_back(rule.pattern);
+	pattern_lengths_.push_back(rule.pattern.size() <= PATTERN_LANE_WIDTH ? rule.pattern.size() : long_pattern);
+	pos_offsets_.push_back(rule.pos_id * globs_.size());
+  }
+  // the same role conditions as IsApplicable
+  rules_by_role_.resize(roles_.size());
+  for (unsigned role_id = 0; role_id < roles_.size(); ++role_id) {
+	for (auto &rule : rules_) {
+	  if (role_id == any_role_id || role_id == rule.rule_id || (rule.role_id != any_role_id && rule.role_id == role_id))
+		rules_by_role_[role_id].push_back(rule.index);
+	}
+  }
+  // the tails of the lanes, a padding tail of 1 under a zero mask matches no form
+  tail_blocks_by_role_.resize(roles_.size());
+  for (unsigned role_id = 0; role_id < roles_.size(); ++role_id) {
+	const std::vector<unsigned> &rules = rules_by_role_[role_id];
+	std::vector<TailBlock> &blocks = tail_blocks_by_role_[role_id];
+	blocks.resize((rules.size() + PATTERN_TAILS_PER_BLOCK - 1) / PATTERN_TAILS_PER_BLOCK);
+	for (size_t j = 0; j < blocks.size() * PATTERN_TAILS_PER_BLOCK; ++j) {
+	  TailBlock &block = blocks[j / PATTERN_TAILS_PER_BLOCK];
+	  size_t k = j % PATTERN_TAILS_PER_BLOCK;
+	  if (j >= rules.size()) {
+		block.tails[k] = 1;
+		block.masks[k] = 0;
+		continue;
+	  }
+	  const std::string &pattern = rules_[rules[j]].pattern;
+	  PatternLane mask(std::string(std::min(pattern.size(), sizeof(uint32_t)), '\xFF'));
+	  std::memcpy(&block.tails[k], pattern_lanes_[rules[j]].bytes + PATTERN_LANE_WIDTH - sizeof(uint32_t),
+				  sizeof(uint32_t));
+	  std::memcpy(&block.masks[k], mask.bytes + PATTERN_LANE_WIDTH - sizeof(uint32_t), sizeof(uint32_t));
+	}
+  }
+}
 bool GrammarRule::ExpandRule(const GrammarRule &rule, std::vector<GrammarRule> &rules) {
   size_t pattern_katakana_position = std::string::npos;
   size_t target_pattern_katakana_position = std::string::npos;
@@ -119,11 +208,18 @@ bool GrammarRule::IsApplicable(const GrammarTriple &grammar_triple) const {
 	return false;
   // The grammar_triple glob must match GrammarRule->pos if GrammarRule->pos is non-empty.
   if (!this->pos.empty()) {
-	glob::glob g(grammar_triple.glob);
-	if (!glob::glob_match(this->pos, g)) return false;
+	glob::MatchContext<char> context;
+	if (!glob::glob_match(this->pos, CompiledGlob(grammar_triple.glob), context)) return false;
   }
   return true;
 }
+size_t Grammar::FixedPrefixLength(std::string_view form) const {
+  size_t fixed_length = 0;
+  for (size_t i = 0; i < form.size();) {
+	if (!pattern_characters_.contains(Utilities::DecodeUtf8(form, i))) fixed_length = i;
+  }
+  return fixed_length;
+}
 bool GrammarTriple::operator==(const GrammarTriple &other) const {
   return form == other.form && glob == other.glob && role == other.role;
 }
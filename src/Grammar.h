@@ -10,9 +10,20 @@
 #include <iostream>
 #include "Utilities.h"
 #include <unordered_map>
+#include <unordered_set>
 #include <array>
+#include <cstdint>
+#include <cstring>
+#include <bit>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define SOUND_CHANGE_ARRAY_SIZE 9
+/// Width of the pattern lanes of the compiled rule table (see Grammar::ForEachApplicable), one SSE2 register
+#define PATTERN_LANE_WIDTH 16
+/// Patterns whose last 4 bytes ForEachApplicable compares with a form at once, one SSE2 register
+#define PATTERN_TAILS_PER_BLOCK 4
 #define KATAKANA_VOWEL_COUNT 5
 const std::string katakana_vowels[KATAKANA_VOWEL_COUNT]{"ア", "イ", "ウ", "エ", "オ"};
 const std::unordered_map<std::string, std::array<std::string, SOUND_CHANGE_ARRAY_SIZE>> sound_change{
@@ -68,6 +79,10 @@ class GrammarRule {
   std::string target_pattern;
   /// when POS is omitted, the rule is applicable for all of these part-of-speech tag globs
   std::string pos_globs;
+  /// Position in Grammar::rules and interned ids of the strings above (see Grammar), assigned by the Grammar
+  unsigned index = 0, rule_id = 0, role_id = 0, pos_id = 0, target_id = 0, pos_globs_id = 0;
+  /// Grammar::FixedPrefixLength of the target_pattern, assigned by the Grammar
+  size_t target_fixed_length = 0;
 
   GrammarRule(std::string &&rule, std::string &&role, std::string &&pattern,
 			  std::string &&pos, std::string &&target, std::string &&target_pattern,
@@ -91,9 +106,136 @@ class Grammar {
  private:
   const std::string grammar_file_path_ = "grammar.rules";
   std::vector<GrammarRule> rules_;
+  /// Characters appearing in the pattern of any rule, the only ones a rule can remove from a form
+  std::unordered_set<char32_t> pattern_characters_;
+  /// Interned rule, role and target names, the empty role has id 0
+  std::vector<std::string> roles_;
+  /// Interned POS tags of the rules, the empty POS has id 0
+  std::vector<std::string> pos_;
+  /// Interned POS globs of the rules, the "*" glob has id 0
+  std::vector<std::string> globs_;
+  /// Whether the POS tag with the given id matches the glob with the given id, indexed by pos_id * globs_.size() + glob_id
+  std::vector<bool> pos_matches_glob_;
+  /// The last PATTERN_LANE_WIDTH bytes of a form or a pattern, right-aligned and padded with zeros in front
+  struct alignas(PATTERN_LANE_WIDTH) PatternLane {
+	char bytes[PATTERN_LANE_WIDTH] = {};
+	explicit PatternLane(std::string_view s) {
+	  size_t length = std::min(s.size(), size_t{PATTERN_LANE_WIDTH});
+	  std::memcpy(bytes + PATTERN_LANE_WIDTH - length, s.data() + s.size() - length, length);
+	}
+  };
+  /// Rule table compiled for matching, indexed by the rule index: patterns in lanes, their lengths
+  /// (long_pattern if longer than a lane) and the offsets of their POS in pos_matches_glob_
+  std::vector<PatternLane> pattern_lanes_;
+  std::vector<uint8_t> pattern_lengths_;
+  std::vector<unsigned> pos_offsets_;
+  static constexpr uint8_t long_pattern = UINT8_MAX;
+  /// Indices of the rules which may apply to each interned role, in the order of rules
+  std::vector<std::vector<unsigned>> rules_by_role_;
+  /// The last 4 bytes of the lanes of PATTERN_TAILS_PER_BLOCK consecutive rules of a role, and masks of those of
+  /// them which belong to the patterns
+  struct alignas(16) TailBlock {
+	uint32_t tails[PATTERN_TAILS_PER_BLOCK];
+	uint32_t masks[PATTERN_TAILS_PER_BLOCK];
+  };
+  /// The rules of rules_by_role_ in blocks, the last one padded with tails no form has
+  std::vector<std::vector<TailBlock>> tail_blocks_by_role_;
+  /// Whether \p form, whose lane is \p tail, ends with the pattern of the rule with the index \p i
+  bool EndsWithPattern(unsigned i, std::string_view form, const PatternLane &tail) const {
+	unsigned length = pattern_lengths_[i];
+	if (length == long_pattern) return form.ends_with(rules_[i].pattern);
+#ifdef __SSE2__
+	// the bytes of the pattern are the last length bytes of the lane, all of them must be equal
+	__m128i tail_bytes = _mm_load_si128(reinterpret_cast<const __m128i *>(tail.bytes));
+	__m128i pattern = _mm_load_si128(reinterpret_cast<const __m128i *>(pattern_lanes_[i].bytes));
+	unsigned equal = _mm_movemask_epi8(_mm_cmpeq_epi8(tail_bytes, pattern));
+	unsigned required = (0xFFFFu << (PATTERN_LANE_WIDTH - length)) & 0xFFFFu;
+	// a form shorter than the pattern has zeros there, which never occur in UTF-8 patterns
+	return (equal & required) == required;
+#else
+	return length <= form.size() && std::memcmp(tail.bytes + PATTERN_LANE_WIDTH - length,
+												pattern_lanes_[i].bytes + PATTERN_LANE_WIDTH - length, length) == 0;
+#endif
+  }
+  /// Assigns the interned ids of the rules and precomputes the tables used by the search
+  void Intern();
  public:
+  /// Interned id of the empty role of a GrammarTriple, to which any rule applies
+  static constexpr unsigned any_role_id = 0;
+  /// Interned id of the "*" glob of a GrammarTriple, which matches any POS
+  static constexpr unsigned any_glob_id = 0;
+
+  Grammar() = default;
+  // the rules reference must be bound to the new instance, not copied
+  Grammar(const Grammar &other)
+	  : rules_(other.rules_), pattern_characters_(other.pattern_characters_), roles_(other.roles_),
+		pos_(other.pos_), globs_(other.globs_), pos_matches_glob_(other.pos_matches_glob_),
+		pattern_lanes_(other.pattern_lanes_), pattern_lengths_(other.pattern_lengths_),
+		pos_offsets_(other.pos_offsets_), rules_by_role_(other.rules_by_role_),
+		tail_blocks_by_role_(other.tail_blocks_by_role_) {}
+  Grammar(Grammar &&other) noexcept
+	  : rules_(std::move(other.rules_)), pattern_characters_(std::move(other.pattern_characters_)),
+		roles_(std::move(other.roles_)), pos_(std::move(other.pos_)), globs_(std::move(other.globs_)),
+		pos_matches_glob_(std::move(other.pos_matches_glob_)), pattern_lanes_(std::move(other.pattern_lanes_)),
+		pattern_lengths_(std::move(other.pattern_lengths_)), pos_offsets_(std::move(other.pos_offsets_)),
+		rules_by_role_(std::move(other.rules_by_role_)), tail_blocks_by_role_(std::move(other.tail_blocks_by_role_)) {}
   /// Loads grammar rules from the default path
   void LoadGrammarRules();
+  /// Equivalent to rule.IsApplicable(GrammarTriple{form, Glob(glob_id), Role(role_id)}),
+  /// but compares interned ids instead of strings and looks up a precomputed table instead of matching globs
+  bool IsApplicable(const GrammarRule &rule, std::string_view form, unsigned role_id, unsigned glob_id) const {
+	if (role_id != any_role_id && role_id != rule.rule_id && (rule.role_id == any_role_id || rule.role_id != role_id))
+	  return false;
+	if (!form.ends_with(rule.pattern)) return false;
+	return pos_matches_glob_[rule.pos_id * globs_.size() + glob_id];
+  }
+  /// Calls \p f with every rule for which IsApplicable(rule, form, role_id, glob_id) holds, in the order of rules.
+  /// Only the rules of the role are visited. The last 4 bytes of the form are compared with the last 4 bytes of
+  /// PATTERN_TAILS_PER_BLOCK patterns at once, by one masked 32-bit SSE2 compare of a TailBlock (a loop without
+  /// SSE2). Only the patterns longer than 4 bytes whose tail matches are then compared whole (EndsWithPattern).
+  template<class F>
+  void ForEachApplicable(std::string_view form, unsigned role_id, unsigned glob_id, F &&f) const {
+	PatternLane tail(form);
+	uint32_t tail_bytes;
+	std::memcpy(&tail_bytes, tail.bytes + PATTERN_LANE_WIDTH - sizeof(tail_bytes), sizeof(tail_bytes));
+#ifdef __SSE2__
+	__m128i tails = _mm_set1_epi32(static_cast<int>(tail_bytes));
+#endif
+	const std::vector<unsigned> &rules = rules_by_role_[role_id];
+	const std::vector<TailBlock> &blocks = tail_blocks_by_role_[role_id];
+	for (size_t b = 0; b < blocks.size(); ++b) {
+#ifdef __SSE2__
+	  __m128i masks = _mm_load_si128(reinterpret_cast<const __m128i *>(blocks[b].masks));
+	  __m128i patterns = _mm_load_si128(reinterpret_cast<const __m128i *>(blocks[b].tails));
+	  unsigned hits = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(tails, masks), patterns)));
+#else
+	  unsigned hits = 0;
+	  for (unsigned k = 0; k < PATTERN_TAILS_PER_BLOCK; ++k)
+		hits |= unsigned{(tail_bytes & blocks[b].masks[k]) == blocks[b].tails[k]} << k;
+#endif
+	  // in the order of rules
+	  for (; hits != 0; hits &= hits - 1) {
+		unsigned i = rules[b * PATTERN_TAILS_PER_BLOCK + std::countr_zero(hits)];
+		if (rules_[i].pattern.size() > sizeof(tail_bytes) && !EndsWithPattern(i, form, tail)) continue;
+		if (!pos_matches_glob_[pos_offsets_[i] + glob_id]) continue;
+		f(rules_[i]);
+	  }
+	}
+  }
+  /// Returns the role name with the interned \p id
+  const std::string &Role(unsigned id) const { return roles_[id]; }
+  /// Returns the POS glob with the interned \p id
+  const std::string &Glob(unsigned id) const { return globs_[id]; }
+  /// Returns the number of interned POS globs
+  unsigned GlobCount() const { return globs_.size(); }
+  /// Returns the number of rules ForEachApplicable compares with a form of the interned role \p role_id
+  size_t RuleCount(unsigned role_id) const { return rules_by_role_[role_id].size(); }
+  /// Returns the \p i-th rule ForEachApplicable compares with a form of the interned role \p role_id
+  const GrammarRule &RuleOfRole(unsigned role_id, size_t i) const { return rules_[rules_by_role_[role_id][i]]; }
+  /// Returns the length of the prefix of \p form that no sequence of rules can ever remove or change, that is
+  /// the prefix ending with the last character which does not appear in any rule pattern.
+  /// Rules only replace a suffix equal to their pattern, so every form derived from \p form starts with this prefix.
+  size_t FixedPrefixLength(std::string_view form) const;
   const std::vector<GrammarRule> &rules = rules_;
 };
 
@@ -3,40 +3,382 @@
 //
 
 #include "GrammarFormGuesser.h"
+#include "Metrics.h"
+#include "SearchTrace.h"
+#include <algorithm>
+#include <array>
+#include <memory_resource>
+#include <mutex>
 
+GrammarFormGuesser::GrammarFormGuesser(Grammar &&gr, Dictionary &&dic)
+	: data(std::make_shared<const Data>(std::move(gr), std::move(dic))), gr(data->gr), dic(data->dic) {
+  for (unsigned glob_id = 0; glob_id < this->gr.GlobCount(); ++glob_id)
+	glob_pos_masks.push_back(this->dic.PosMaskMatching(this->gr.Glob(glob_id)));
+}
 GuessResult GrammarFormGuesser::Guess(const std::string &s) const {
-  // empty triple, matching all part-of-speech tags and applying to any role
-  GrammarTriple gt{s, "*", ""};
-  GuessResult result = GuessInternal(gt, {});
-  // insert the original query for printing to stdout
-  result.original_query = s;
+  for (auto &result : GuessAll(s)) return result;
+  return MakeResult(s, nullptr, nullptr);
+}
+GuessResult GrammarFormGuesser::GuessQuery(std::string_view s) const {
+  std::string query;
+  if (!Normalizer::Normalize(s, query, dic.QueryFlags())) return GuessResult(std::string(s));
+  return Guess(query);
+}
+GuessResult GrammarFormGuesser::Guess(const std::string &s, ThreadPool &pool) const {
+  Metrics::Add(Metrics::GUESSES);
+  Metrics::Timer timer(Metrics::GUESS_LATENCY);
+  size_t fixed_length = gr.FixedPrefixLength(s);
+  if (fixed_length > 0 && !dic.HasKeyWithPrefix(std::string_view(s).substr(0, fixed_length)))
+	return MakeResult(s, nullptr, nullptr);
+  SearchNode root{s, Grammar::any_role_id, Grammar::any_glob_id, fixed_length, nullptr, nullptr};
+  if (auto found = Probe(root)) return MakeResult(s, &root, found);
+  // every child of the query is the root of a branch searched by a single task
+  std::pmr::monotonic_buffer_resource arena;
+  std::pmr::vector<const SearchNode *> branches(&arena);
+  Expand(&root, branches);
+  // The best derivation found so far as (depth << 32 | branch). The sequential search finds the shallowest
+  // derivation, of those the one in the first branch, so the minimum of this key is the same derivation.
+  std::atomic<uint64_t> best = UINT64_MAX;
+  std::vector<std::optional<GuessResult>> results(branches.size());
+  pool.ParallelFor(branches.size(), [&](size_t branch) {
+	results[branch] = GuessBranch(s, branches[branch], branch, best);
+  });
+  if (best == UINT64_MAX) return MakeResult(s, nullptr, nullptr);
+  return std::move(*results[best & UINT32_MAX]);
+}
+std::optional<GuessResult> GrammarFormGuesser::GuessBranch(const std::string &s, const SearchNode *root,
+														   unsigned branch, std::atomic<uint64_t> &best) const {
+  std::array<std::byte, 32 * 1024> buffer;
+  std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size());
+  std::pmr::vector<const SearchNode *> queue(&arena);
+  queue.reserve(256);
+  queue.push_back(root);
+  // the root is one level below the query
+  uint64_t depth = 1;
+  size_t level_end = queue.size();
+  for (size_t next = 0; next < queue.size(); ++next) {
+	if (next == level_end) {
+	  ++depth;
+	  level_end = queue.size();
+	}
+	uint64_t key = depth << 32 | branch;
+	// another branch has found a derivation the sequential search would find before anything in this level
+	if (key > best.load(std::memory_order_relaxed)) return std::nullopt;
+	const SearchNode *node = queue[next];
+	if (auto found = Probe(*node)) {
+	  uint64_t current = best.load(std::memory_order_relaxed);
+	  while (key < current && !best.compare_exchange_weak(current, key, std::memory_order_relaxed)) {}
+	  return MakeResult(s, node, found);
+	}
+	Expand(node, queue);
+  }
+  return std::nullopt;
+}
+std::vector<GuessResult> GrammarFormGuesser::GuessBatch(std::span<const std::string> inputs, ThreadPool &pool) const {
+  // search each distinct input once
+  std::unordered_map<std::string_view, size_t> distinct_index;
+  std::vector<std::string_view> distinct;
+  std::vector<size_t> input_distinct(inputs.size());
+  for (size_t i = 0; i < inputs.size(); ++i) {
+	auto [it, inserted] = distinct_index.try_emplace(inputs[i], distinct.size());
+	if (inserted) distinct.push_back(inputs[i]);
+	input_distinct[i] = it->second;
+  }
+  GuessMemo memo;
+  std::vector<std::optional<GuessResult>> results(distinct.size());
+  // a task per chunk of inputs keeps the scheduling overhead low for large batches
+  const size_t chunk_size = 64;
+  pool.ParallelFor((distinct.size() + chunk_size - 1) / chunk_size, [&](size_t chunk) {
+	size_t end = std::min(distinct.size(), (chunk + 1) * chunk_size);
+	for (size_t i = chunk * chunk_size; i < end; ++i) results[i] = Guess(std::string(distinct[i]), memo);
+  });
+  std::vector<GuessResult> batch;
+  batch.reserve(inputs.size());
+  for (size_t i : input_distinct) batch.push_back(*results[i]);
+  return batch;
+}
+GuessResult GrammarFormGuesser::Guess(const std::string &s, GuessMemo &memo) const {
+  Metrics::Add(Metrics::GUESSES);
+  Metrics::Timer timer(Metrics::GUESS_LATENCY);
+  size_t fixed_length = gr.FixedPrefixLength(s);
+  if (fixed_length > 0 && !dic.HasKeyWithPrefix(std::string_view(s).substr(0, fixed_length)))
+	return MakeResult(s, nullptr, nullptr);
+  std::array<std::byte, 32 * 1024> buffer;
+  std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size());
+  std::pmr::polymorphic_allocator<> allocator(&arena);
+  std::pmr::vector<const SearchNode *> queue(allocator);
+  queue.reserve(256);
+  queue.push_back(allocator.new_object<SearchNode>(s, Grammar::any_role_id, Grammar::any_glob_id, fixed_length,
+												   nullptr, nullptr));
+  // The breadth-first search of GuessAll, except that a node with a memoized state is not expanded: its subtree
+  // contributes the derivation through the memoized one. Such a derivation may be longer than the depth of its node,
+  // so it only wins once no shorter derivation is found, ties are broken by the order of the rules as in GuessAll.
+  std::vector<const GrammarRule *> best_rules;
+  const DictionaryEntry *best_entry = nullptr;
+  const SearchNode *best_node = nullptr;
+  auto is_better = [&](const std::vector<const GrammarRule *> &rules) {
+	if (best_entry == nullptr) return true;
+	if (rules.size() != best_rules.size()) return rules.size() < best_rules.size();
+	return std::lexicographical_compare(rules.begin(), rules.end(), best_rules.begin(), best_rules.end(),
+										[](auto a, auto b) { return a->index < b->index; });
+  };
+  size_t depth = 0;
+  size_t level_end = queue.size();
+  for (size_t next = 0; next < queue.size(); ++next) {
+	if (next == level_end) {
+	  ++depth;
+	  level_end = queue.size();
+	}
+	// no derivation in this level is shorter than the best one
+	if (best_entry != nullptr && depth > best_rules.size()) break;
+	const SearchNode *node = queue[next];
+	if (auto found = Probe(*node)) {
+	  // the first hit of the level is the first derivation of its length
+	  auto rules = RulesTo(node);
+	  if (is_better(rules)) {
+		best_rules = std::move(rules);
+		best_entry = found;
+		best_node = node;
+	  }
+	  break;
+	}
+	// the derivations from the children are longer than the best one
+	if (best_entry != nullptr && depth == best_rules.size()) continue;
+	if (auto derivation = memo.Find(node->form, node->role_id, node->glob_id)) {
+	  if (derivation->entry == nullptr) continue;
+	  auto rules = RulesTo(node);
+	  rules.insert(rules.end(), derivation->rules.begin(), derivation->rules.end());
+	  if (is_better(rules)) {
+		best_rules = std::move(rules);
+		best_entry = derivation->entry;
+		best_node = node;
+	  }
+	  continue;
+	}
+	Expand(node, queue);
+  }
+  if (best_entry == nullptr) {
+	// the whole search tree was explored, no state in it has a derivation
+	for (auto node : queue) memo.Insert(node->form, node->role_id, node->glob_id, {{}, nullptr});
+	return MakeResult(s, nullptr, nullptr);
+  }
+  size_t depth_of_node = 0;
+  for (const SearchNode *n = best_node; n->rule != nullptr; n = n->parent) ++depth_of_node;
+  GuessResult result = MakeResult(s, best_node, best_entry, std::span(best_rules).subspan(depth_of_node));
+  // every state on the path of the best derivation has the rest of it as the shortest derivation
+  for (const SearchNode *n = best_node; n != nullptr; n = n->parent, --depth_of_node) {
+	std::vector<const GrammarRule *> rest(best_rules.begin() + depth_of_node, best_rules.end());
+	memo.Insert(n->form, n->role_id, n->glob_id, {std::move(rest), best_entry});
+  }
   return result;
 }
-GuessResultInternal GrammarFormGuesser::GuessInternal(const GrammarTriple &gt,
-													  std::vector<const GrammarRule *> applied_rules) const {
-  // lookup in the dictionary
-  const DictionaryEntry *found = dic.Query(gt.form);
-  // if found, return immediately
-  if (found != nullptr) {
-	return GuessResultInternal{true, applied_rules, found};
-  }
-  // otherwise, apply applicable grammar rules and search recursively
-  GuessResultInternal best_result{false, {}, nullptr};
-  for (auto &rule : gr.rules) {
-	if (!rule.IsApplicable(gt)) continue;
-	auto new_triple = rule.Apply(gt);
-
-	applied_rules.push_back(&rule);
-	// applied_rules are copied into the recursive call
-	auto result = GuessInternal(new_triple, applied_rules);
-	applied_rules.pop_back();
+bool GrammarFormGuesser::IsViablePrefix(std::string_view s) const {
+  // appending to s can only extend the fixed prefix
+  size_t fixed_length = gr.FixedPrefixLength(s);
+  return fixed_length == 0 || dic.HasKeyWithPrefix(s.substr(0, fixed_length));
+}
+std::vector<GuessResult> GrammarFormGuesser::Guess(const std::string &s, size_t k) const {
+  std::vector<GuessResult> results;
+  if (k == 0) return results;
+  for (auto &result : GuessAll(s)) {
+	results.push_back(std::move(result));
+	if (results.size() == k) break;
+  }
+  return results;
+}
+Generator<GuessResult> GrammarFormGuesser::GuessAll(std::string s) const {
+  // Breadth-first search: the search tree is expanded level by level, so derivations come out shortest first and
+  // within a level in the order a depth-first search would find them. Nothing is expanded past the level of
+  // the last requested derivation.
+  // the latency is the time to the first derivation, or to the end of the search without any
+  Metrics::Add(Metrics::GUESSES);
+  std::optional<Metrics::Timer> timer(std::in_place, Metrics::GUESS_LATENCY);
+  // if no dictionary key starts with the prefix the rules cannot change, there is nothing to find
+  size_t fixed_length = gr.FixedPrefixLength(s);
+  if (fixed_length > 0 && !dic.HasKeyWithPrefix(std::string_view(s).substr(0, fixed_length))) co_return;
 
-	// take the shortest path to success
-	if (result.success && (!best_result.success || (best_result.rules.size() > result.rules.size()))) {
-	  best_result = result;
+  // All search state lives in a per-query arena released at once with the generator. The inline buffer covers
+  // typical searches, so expanding a node does not touch the heap.
+  std::array<std::byte, 32 * 1024> buffer;
+  std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size());
+  std::pmr::polymorphic_allocator<> allocator(&arena);
+  std::pmr::vector<const SearchNode *> queue(allocator);
+  queue.reserve(256);
+  // empty triple, matching all part-of-speech tags and applying to any role
+  queue.push_back(allocator.new_object<SearchNode>(s, Grammar::any_role_id, Grammar::any_glob_id, fixed_length,
+												   nullptr, nullptr));
+  for (size_t next = 0; next < queue.size(); ++next) {
+	const SearchNode *node = queue[next];
+	// lookup in the dictionary, a found form ends the derivation
+	if (auto found = Probe(*node)) {
+	  timer.reset();
+	  co_yield MakeResult(s, node, found);
+	  continue;
 	}
+	// otherwise, queue the forms of all applicable grammar rules
+	Expand(node, queue);
   }
-  if (best_result.success) return best_result;
-  // no result in any branch, return unsuccessful
-  return GuessResultInternal{false, applied_rules, nullptr};
+}
+GuessResult GrammarFormGuesser::GuessFuzzy(const std::string &s, unsigned max_distance) const {
+  std::array<std::byte, 32 * 1024> buffer;
+  std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size());
+  std::pmr::polymorphic_allocator<> allocator(&arena);
+  std::pmr::vector<const SearchNode *> queue(allocator);
+  queue.reserve(256);
+  queue.push_back(allocator.new_object<SearchNode>(s, Grammar::any_role_id, Grammar::any_glob_id, 0, nullptr, nullptr));
+  PosMask any_pos;
+  any_pos.set();
+  const SearchNode *best_node = nullptr;
+  Dictionary::FuzzyMatch best{};
+  size_t level_end = queue.size();
+  for (size_t next = 0; next < queue.size(); ++next) {
+	// the closest key of the shallowest level with any
+	if (next == level_end) {
+	  if (best_node != nullptr) break;
+	  level_end = queue.size();
+	}
+	const SearchNode *node = queue[next];
+	size_t code_points = 0;
+	for (size_t pos = 0; pos < node->form.size(); ++code_points) Utilities::DecodeUtf8(node->form, pos);
+	if (code_points > max_distance) {
+	  auto &pos_mask = node->glob_id == Grammar::any_glob_id ? any_pos : glob_pos_masks[node->glob_id];
+	  auto matches = dic.FuzzyQuery(node->form, max_distance, pos_mask, 1);
+	  if (!matches.empty() && (best_node == nullptr || matches[0].distance < best.distance)) {
+		best_node = node;
+		best = matches[0];
+	  }
+	}
+	// the rest of the level is still compared, but not expanded
+	if (best_node == nullptr) Expand(node, queue, false);
+  }
+  if (best_node == nullptr) return MakeResult(s, nullptr, nullptr);
+  GuessResult result = MakeResult(s, best_node, best.entry);
+  result.distance = best.distance;
+  return result;
+}
+const DictionaryEntry *GrammarFormGuesser::Probe(const SearchNode &node) const {
+  TRACE(SearchTrace *trace = SearchTrace::Current());
+  TRACE(uint64_t start = trace != nullptr ? trace->Now() : 0);
+  // only an entry with a POS the triple may represent ends the derivation
+  const DictionaryEntry *found = node.glob_id == Grammar::any_glob_id ? dic.Query(node.form)
+																	  : dic.Query(node.form, glob_pos_masks[node.glob_id]);
+  TRACE(if (trace != nullptr) trace->Probe(&node, node.parent, node.form, gr.Role(node.role_id), gr.Glob(node.glob_id),
+										   node.rule, found, start));
+  return found;
+}
+void GrammarFormGuesser::Expand(const SearchNode *node, std::pmr::vector<const SearchNode *> &queue,
+								bool prune) const {
+  std::pmr::polymorphic_allocator<> allocator(queue.get_allocator().resource());
+  size_t matched = 0;
+  TRACE(std::vector<const GrammarRule *> applied, pruned);
+  gr.ForEachApplicable(node->form, node->role_id, node->glob_id, [&](const GrammarRule &rule) {
+	++matched;
+	// the new form keeps the stem and replaces the pattern by the target pattern
+	size_t stem_length = node->form.size() - rule.pattern.size();
+	size_t form_length = stem_length + rule.target_pattern.size();
+	char *form = allocator.allocate_object<char>(form_length);
+	std::copy_n(node->form.data(), stem_length, form);
+	std::copy(rule.target_pattern.begin(), rule.target_pattern.end(), form + stem_length);
+	// the fixed prefix only grows if the target pattern adds a character no rule can remove
+	size_t fixed_length = node->fixed_length;
+	if (rule.target_fixed_length > 0) {
+	  fixed_length = stem_length + rule.target_fixed_length;
+	  // prune the dead subtree
+	  if (prune && !dic.HasKeyWithPrefix(std::string_view(form, fixed_length))) {
+		TRACE(pruned.push_back(&rule));
+		return;
+	  }
+	}
+	TRACE(applied.push_back(&rule));
+	queue.push_back(allocator.new_object<SearchNode>(std::string_view(form, form_length), rule.target_id,
+													 rule.pos_globs_id, fixed_length, &rule, node));
+  });
+  TRACE(if (auto trace = SearchTrace::Current()) {
+	std::vector<SearchTrace::RuleTest> tests;
+	for (size_t i = 0; i < gr.RuleCount(node->role_id); ++i) {
+	  const GrammarRule *rule = &gr.RuleOfRole(node->role_id, i);
+	  auto outcome = std::find(applied.begin(), applied.end(), rule) != applied.end() ? SearchTrace::APPLIED
+		  : std::find(pruned.begin(), pruned.end(), rule) != pruned.end() ? SearchTrace::PRUNED
+		  : SearchTrace::NOT_APPLICABLE;
+	  tests.push_back({rule, outcome});
+	}
+	trace->Expand(node, std::move(tests));
+  });
+  Metrics::Add(Metrics::NODES_EXPANDED);
+  Metrics::Add(Metrics::RULES_TESTED, gr.RuleCount(node->role_id));
+  Metrics::Add(Metrics::RULES_MATCHED, matched);
+}
+std::vector<const GrammarRule *> GrammarFormGuesser::RulesTo(const SearchNode *node) {
+  std::vector<const GrammarRule *> rules;
+  for (const SearchNode *n = node; n->rule != nullptr; n = n->parent) rules.push_back(n->rule);
+  std::reverse(rules.begin(), rules.end());
+  return rules;
+}
+GuessResult GrammarFormGuesser::MakeResult(const std::string &s, const SearchNode *node, const DictionaryEntry *found,
+										   std::span<const GrammarRule *const> more_rules) const {
+  // the original query is kept for printing to stdout
+  GuessResult result(s);
+  if (found == nullptr) return result;
+  result.success = true;
+  result.entry = found;
+  result.owner_ = data;
+  // the nodes hold the forms, filled in from the last one
+  size_t depth = 0, length = 0;
+  for (const SearchNode *n = node; n->rule != nullptr; n = n->parent) {
+	++depth;
+	length += n->form.size();
+  }
+  result.rules.resize(depth);
+  result.form_ends_.resize(depth);
+  result.forms_.resize(length);
+  for (const SearchNode *n = node; n->rule != nullptr; n = n->parent) {
+	--depth;
+	result.rules[depth] = n->rule;
+	result.form_ends_[depth] = length;
+	length -= n->form.size();
+	std::copy(n->form.begin(), n->form.end(), result.forms_.begin() + length);
+  }
+  // the forms of memoized rules are not in the search tree, each replaces the pattern by the target pattern
+  std::string form(node->form);
+  for (auto rule : more_rules) {
+	form.resize(form.size() - rule->pattern.size());
+	form += rule->target_pattern;
+	result.AddStep(rule, form);
+  }
+  return result;
+}
+const GuessMemo::Derivation *GuessMemo::Find(std::string_view form, unsigned role_id, unsigned glob_id) const {
+  thread_local std::string key;
+  const Shard &shard = shards_[ShardOf(form, role_id, glob_id, key)];
+  std::shared_lock lock(shard.mutex);
+  auto found = shard.derivations.find(key);
+  Metrics::Add(found == shard.derivations.end() ? Metrics::MEMO_MISSES : Metrics::MEMO_HITS);
+  // the node of an unordered_map never moves, so the derivation outlives the lock
+  return found == shard.derivations.end() ? nullptr : &found->second;
+}
+void GuessMemo::Insert(std::string_view form, unsigned role_id, unsigned glob_id, Derivation derivation) {
+  std::string key;
+  Shard &shard = shards_[ShardOf(form, role_id, glob_id, key)];
+  std::unique_lock lock(shard.mutex);
+  shard.derivations.try_emplace(std::move(key), std::move(derivation));
+}
+void GuessMemo::Clear() {
+  for (auto &shard : shards_) {
+	std::unique_lock lock(shard.mutex);
+	shard.derivations.clear();
+  }
+}
+size_t GuessMemo::Size() const {
+  size_t size = 0;
+  for (auto &shard : shards_) {
+	std::shared_lock lock(shard.mutex);
+	size += shard.derivations.size();
+  }
+  return size;
+}
+size_t GuessMemo::ShardOf(std::string_view form, unsigned role_id, unsigned glob_id, std::string &key) {
+  key.assign(form);
+  key.append(reinterpret_cast<const char *>(&role_id), sizeof role_id);
+  key.append(reinterpret_cast<const char *>(&glob_id), sizeof glob_id);
+  return StringHash{}(key) % shard_count;
 }
@@ -6,56 +6,162 @@
 #define OSHI_CPP__GRAMMARFORMGUESSER_H_
 #include "Grammar.h"
 #include "Dictionary.h"
+#include "Generator.h"
+#include "ThreadPool.h"
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <shared_mutex>
+#include <span>
 
-/// An instance of this class is invalid if the lifetime of the GrammarFormGuesser that generated it is shorter.
-class GuessResultInternal {
+/// A derivation found by GrammarFormGuesser. The rules and the dictionary entry are referenced, not copied, and
+/// the result shares the ownership of them with the guesser, so it stays valid even after the guesser is destroyed.
+class GuessResult {
  public:
   bool success = false;
+  /// The applied rules in order
   std::vector<const GrammarRule *> rules;
-  const DictionaryEntry *entry;
-  GuessResultInternal(const GuessResultInternal &other) = default;
-  GuessResultInternal(bool success, std::vector<const GrammarRule *> rules, const DictionaryEntry *entry) : success(
-	  success), rules(rules), entry(entry) {}
-};
-
-/// This class owns its data in contrast with GuessResultInternal
-class GuessResult {
- public:
-  bool success;
-  std::vector<GrammarRule> rules;
-  DictionaryEntry entry;
+  /// The dictionary entry found, nullptr without success
+  const DictionaryEntry *entry = nullptr;
+  /// Edits between the last form and the key of the entry, only GrammarFormGuesser::GuessFuzzy finds a non-zero one
+  unsigned distance = 0;
   std::string original_query;
-  GuessResult(const GuessResultInternal &guess) : success(guess.success) {
-	for (auto rule : guess.rules) rules.push_back(*rule);
-	if (guess.entry != nullptr) entry = *guess.entry;
+  /// A result without derivation
+  explicit GuessResult(std::string original_query) : original_query(std::move(original_query)) {}
+  /// Returns the form after applying rules[0] to rules[i], as recorded during the search
+  std::string_view Form(size_t i) const {
+	size_t begin = i == 0 ? 0 : form_ends_[i - 1];
+	return std::string_view(forms_).substr(begin, form_ends_[i] - begin);
   }
   friend std::ostream &operator<<(std::ostream &os, const GuessResult &gr) {
-	std::string form = gr.original_query;
-	size_t tabs = 0;
-	for (auto it = gr.rules.begin(); it != gr.rules.end(); ++it) {
-	  const GrammarRule &current = *it;
-	  for (size_t i = 0; i < tabs; ++i) os << "  ";
-	  os << form << " is " << current.rule << " for ";
-	  form = current.ApplyToForm(form);
-	  os << form << std::endl;
-	  ++tabs;
+	for (size_t i = 0; i < gr.rules.size(); ++i) {
+	  for (size_t tabs = 0; tabs < i; ++tabs) os << "  ";
+	  os << (i == 0 ? std::string_view(gr.original_query) : gr.Form(i - 1)) << " is " << gr.rules[i]->rule << " for "
+		 << gr.Form(i) << std::endl;
 	}
-	os << gr.entry;
+	if (gr.entry != nullptr) os << *gr.entry;
 	return os;
   }
+ private:
+  friend class GrammarFormGuesser;
+  /// The forms after each rule one after another, the i-th ends at form_ends_[i]
+  std::string forms_;
+  std::vector<uint32_t> form_ends_;
+  /// Keeps the grammar and the dictionary alive
+  std::shared_ptr<const void> owner_;
+  /// Appends \p rule which produced \p form to the derivation
+  void AddStep(const GrammarRule *rule, std::string_view form) {
+	rules.push_back(rule);
+	forms_ += form;
+	form_ends_.push_back(forms_.size());
+  }
+};
+
+/// Shortest derivations from search states (a form with its interned role and glob), shared by the queries of a batch.
+/// The shortest derivation from a state does not depend on how the search got there, so it is computed only once.
+/// Safe to use from several threads.
+class GuessMemo {
+ public:
+  struct Derivation {
+	/// rules applied from the state on
+	std::vector<const GrammarRule *> rules;
+	/// nullptr if there is no derivation from the state
+	const DictionaryEntry *entry;
+  };
+  /// \return nullptr if the state is not known
+  const Derivation *Find(std::string_view form, unsigned role_id, unsigned glob_id) const;
+  /// Remembers the \p derivation from a state, the first one is kept
+  void Insert(std::string_view form, unsigned role_id, unsigned glob_id, Derivation derivation);
+  /// Forgets all the states, not to be called while another thread uses the memo
+  void Clear();
+  /// The number of the states known
+  size_t Size() const;
+ private:
+  /// independently locked parts of the table, to let threads insert in parallel
+  struct Shard {
+	mutable std::shared_mutex mutex;
+	std::unordered_map<std::string, Derivation, StringHash, std::equal_to<>> derivations;
+  };
+  static constexpr size_t shard_count = 64;
+  std::array<Shard, shard_count> shards_;
+  /// Writes the key of a state to \p key and returns the index of its shard
+  static size_t ShardOf(std::string_view form, unsigned role_id, unsigned glob_id, std::string &key);
 };
 
 /// Uses Grammar and Dictionary to produce a GuessResult
 class GrammarFormGuesser {
-  const Grammar gr;
-  const Dictionary dic;
-  /// Internal recursive search for grammar form called by the public-facing Guess method
-  GuessResultInternal GuessInternal(const GrammarTriple &gt, std::vector<const GrammarRule *> applied_rules) const;
+  /// The data the results reference, shared with them
+  struct Data {
+	const Grammar gr;
+	const Dictionary dic;
+	Data(Grammar &&gr, Dictionary &&dic) : gr(std::move(gr)), dic(std::move(dic)) {}
+  };
+  std::shared_ptr<const Data> data;
+  const Grammar &gr;
+  const Dictionary &dic;
+  /// The dictionary POS tags matching each interned grammar glob, indexed by the glob id
+  std::vector<PosMask> glob_pos_masks;
+  /// A form in the search tree, its parent chain is the derivation
+  struct SearchNode {
+	/// the form of this node, allocated in the arena of the search
+	std::string_view form;
+	/// interned role and glob of the corresponding GrammarTriple (see Grammar)
+	unsigned role_id, glob_id;
+	/// length of the prefix of the form shared by the whole subtree, see Grammar::FixedPrefixLength
+	size_t fixed_length;
+	/// the rule that produced this node from its parent, nullptr for the query itself
+	const GrammarRule *rule;
+	const SearchNode *parent;
+  };
+  /// Looks up the form of \p node in the dictionary
+  /// \return nullptr unless an entry has a POS the triple of the node may represent
+  const DictionaryEntry *Probe(const SearchNode &node) const;
+  /// Appends the forms of all grammar rules applicable to \p node to \p queue, allocated by its allocator
+  /// \param prune Whether to skip the forms whose fixed prefix starts no dictionary key
+  void Expand(const SearchNode *node, std::pmr::vector<const SearchNode *> &queue, bool prune = true) const;
+  /// Returns the rules applied from the query to \p node
+  static std::vector<const GrammarRule *> RulesTo(const SearchNode *node);
+  /// Returns the derivation of \p s ending at \p node, followed by \p more_rules if any
+  GuessResult MakeResult(const std::string &s, const SearchNode *node, const DictionaryEntry *found,
+						 std::span<const GrammarRule *const> more_rules = {}) const;
+  /// Searches the subtree of \p root breadth-first until a level ordered after \p best, see Guess(s, pool)
+  std::optional<GuessResult> GuessBranch(const std::string &s, const SearchNode *root, unsigned branch,
+										 std::atomic<uint64_t> &best) const;
  public:
   /// \param gr Grammar rules to consider
   /// \param dic Dictionary to look in
-  GrammarFormGuesser(Grammar &&gr, Dictionary &&dic) : gr(gr), dic(dic) {}
+  GrammarFormGuesser(Grammar &&gr, Dictionary &&dic);
+  /// Returns the shortest derivation of \p s
   GuessResult Guess(const std::string &s) const;
+  /// Returns the shortest derivation of the raw query \p s normalized with Dictionary::QueryFlags first, for the
+  /// front-ends answering input as it comes. The result is unsuccessful if \p s is not valid UTF-8.
+  GuessResult GuessQuery(std::string_view s) const;
+  /// Returns the shortest derivation of \p s, the same as Guess(s).
+  /// The subtrees of the rules applicable to \p s are searched in parallel on the \p pool.
+  GuessResult Guess(const std::string &s, ThreadPool &pool) const;
+  /// Returns the shortest derivation of \p s, the same as Guess(s). States with a derivation known from \p memo are
+  /// not searched again, and the states of this search are added to it.
+  GuessResult Guess(const std::string &s, GuessMemo &memo) const;
+  /// Returns the shortest derivation of every string in \p inputs, in the same order, the same as Guess(s).
+  /// Each distinct string is searched only once and the searches share a GuessMemo, the work is spread over the \p pool.
+  std::vector<GuessResult> GuessBatch(std::span<const std::string> inputs, ThreadPool &pool) const;
+  /// Returns false if neither \p s nor any string starting with \p s can have a derivation, because no dictionary
+  /// key starts with the prefix of \p s the rules cannot change (see Grammar::FixedPrefixLength)
+  bool IsViablePrefix(std::string_view s) const;
+  /// Returns at most \p k derivations of \p s, shortest first
+  std::vector<GuessResult> Guess(const std::string &s, size_t k) const;
+  /// Returns the derivation of \p s ending at a dictionary key within \p max_distance edits of its last form, for
+  /// queries with a typo, when Guess finds nothing. The search tree is not pruned by the dictionary prefixes, as
+  /// the typo may be in the fixed prefix. The shallowest derivation wins, then the closest key, then the rule order.
+  /// Forms of no more than \p max_distance code points are not looked up, any short key would be close to them.
+  GuessResult GuessFuzzy(const std::string &s, unsigned max_distance) const;
+  /// Lazily enumerates all derivations of \p s, shortest first, ties in the order of the grammar rules.
+  /// The search tree is expanded only as deep as the last derivation taken.
+  Generator<GuessResult> GuessAll(std::string s) const;
+  /// The dictionary the derivations end in, e.g. for the completions
+  const Dictionary &GetDictionary() const { return dic; }
 };
 
 #endif //OSHI_CPP__GRAMMARFORMGUESSER_H_
@@ -0,0 +1,221 @@
+//
+// Created by praza on 18.10.2026.
+//
+
+#include "Metrics.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#ifndef _WIN32
+#include <csignal>
+#include <pthread.h>
+#endif
+
+namespace {
+/// Metrics of a single thread. Only the owning thread writes, so the atomics only keep the readers from tearing.
+struct alignas(64) Shard {
+  std::atomic<uint64_t> counters[Metrics::COUNTER_COUNT]{};
+  struct {
+	std::atomic<uint64_t> buckets[Metrics::bucket_count]{};
+	std::atomic<uint64_t> count{}, sum{}, max{};
+  } histograms[Metrics::HISTOGRAM_COUNT];
+  /// owned by a running thread
+  std::atomic<bool> in_use{};
+};
+
+struct Registry {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<Shard>> shards;
+};
+/// Never destroyed, threads may still finish while the process exits
+Registry &GetRegistry() {
+  static auto *registry = new Registry;
+  return *registry;
+}
+
+/// The shard of the current thread, released for reuse when the thread finishes
+struct ShardHandle {
+  Shard *shard = nullptr;
+  ~ShardHandle() {
+	if (shard != nullptr) shard->in_use.store(false, std::memory_order_release);
+  }
+};
+thread_local ShardHandle local_shard;
+
+Shard &LocalShard() {
+  if (local_shard.shard != nullptr) return *local_shard.shard;
+  auto &registry = GetRegistry();
+  std::lock_guard lock(registry.mutex);
+  for (auto &shard : registry.shards) {
+	if (!shard->in_use.load(std::memory_order_acquire)) {
+	  shard->in_use.store(true, std::memory_order_relaxed);
+	  return *(local_shard.shard = shard.get());
+	}
+  }
+  registry.shards.push_back(std::make_unique<Shard>());
+  registry.shards.back()->in_use.store(true, std::memory_order_relaxed);
+  return *(local_shard.shard = registry.shards.back().get());
+}
+
+/// Adds to a value written by this thread only, without a locked instruction
+void Increase(std::atomic<uint64_t> &value, uint64_t n) {
+  value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+struct Description {
+  const char *name, *help;
+};
+const Description counter_descriptions[Metrics::COUNTER_COUNT]{
+	{"oshi_guesses_total", "Queries answered by GrammarFormGuesser"},
+	{"oshi_nodes_expanded_total", "Search nodes whose applicable rules were looked for"},
+	{"oshi_rules_tested_total", "Grammar rules compared with the form of an expanded node"},
+	{"oshi_rules_matched_total", "Grammar rules applicable to an expanded node"},
+	{"oshi_dictionary_queries_total", "Dictionary lookups of exact forms"},
+	{"oshi_memo_hits_total", "Search states found in a GuessMemo"},
+	{"oshi_memo_misses_total", "Search states not found in a GuessMemo"},
+};
+const Description histogram_descriptions[Metrics::HISTOGRAM_COUNT]{
+	{"oshi_guess_latency_seconds", "Time to answer a query"},
+	{"oshi_dictionary_query_latency_seconds", "Time of a sample of the dictionary lookups"},
+};
+}
+
+size_t Metrics::BucketOf(uint64_t value) {
+  if (value < sub_buckets) return value;
+  unsigned exponent = std::bit_width(value) - 1;
+  if (exponent >= METRICS_MAX_EXPONENT) return bucket_count - 1;
+  // the power of two selects a row of sub-buckets, the next bits after the leading one the sub-bucket
+  unsigned shift = exponent - METRICS_SUB_BUCKET_BITS;
+  return (shift + 1) * sub_buckets + (value >> shift) - sub_buckets;
+}
+uint64_t Metrics::BucketStart(size_t bucket) {
+  if (bucket < sub_buckets) return bucket;
+  size_t shift = bucket / sub_buckets - 1;
+  return (sub_buckets + bucket % sub_buckets) << shift;
+}
+uint64_t Metrics::HistogramSnapshot::Quantile(double q) const {
+  if (count == 0) return 0;
+  auto rank = static_cast<uint64_t>(std::ceil(q * static_cast<double>(count)));
+  rank = std::clamp<uint64_t>(rank, 1, count);
+  uint64_t seen = 0;
+  for (size_t bucket = 0; bucket < bucket_count; ++bucket) {
+	seen += buckets[bucket];
+	// the last value of the bucket, no more than the largest recorded value
+	if (seen >= rank) return bucket + 1 < bucket_count ? std::min(BucketStart(bucket + 1) - 1, max) : max;
+  }
+  return max;
+}
+uint64_t Metrics::HistogramSnapshot::CountBelow(uint64_t value) const {
+  uint64_t below = 0;
+  for (size_t bucket = 0; bucket < bucket_count && BucketStart(bucket) < value; ++bucket) below += buckets[bucket];
+  return below;
+}
+void Metrics::Add(Counter counter, uint64_t n) {
+  Increase(LocalShard().counters[counter], n);
+}
+void Metrics::Record(Histogram histogram, uint64_t nanoseconds) {
+  auto &h = LocalShard().histograms[histogram];
+  Increase(h.buckets[BucketOf(nanoseconds)], 1);
+  Increase(h.count, 1);
+  Increase(h.sum, nanoseconds);
+  if (nanoseconds > h.max.load(std::memory_order_relaxed)) h.max.store(nanoseconds, std::memory_order_relaxed);
+}
+uint64_t Metrics::Total(Counter counter) {
+  auto &registry = GetRegistry();
+  std::lock_guard lock(registry.mutex);
+  uint64_t total = 0;
+  for (auto &shard : registry.shards) total += shard->counters[counter].load(std::memory_order_relaxed);
+  return total;
+}
+Metrics::HistogramSnapshot Metrics::Snapshot(Histogram histogram) {
+  HistogramSnapshot snapshot;
+  auto &registry = GetRegistry();
+  std::lock_guard lock(registry.mutex);
+  for (auto &shard : registry.shards) {
+	auto &h = shard->histograms[histogram];
+	for (size_t bucket = 0; bucket < bucket_count; ++bucket)
+	  snapshot.buckets[bucket] += h.buckets[bucket].load(std::memory_order_relaxed);
+	snapshot.count += h.count.load(std::memory_order_relaxed);
+	snapshot.sum += h.sum.load(std::memory_order_relaxed);
+	snapshot.max = std::max(snapshot.max, h.max.load(std::memory_order_relaxed));
+  }
+  return snapshot;
+}
+void Metrics::WriteText(std::ostream &os) {
+  for (size_t counter = 0; counter < COUNTER_COUNT; ++counter)
+	os << counter_descriptions[counter].name << ' ' << Total(static_cast<Counter>(counter)) << std::endl;
+  for (size_t histogram = 0; histogram < HISTOGRAM_COUNT; ++histogram) {
+	auto snapshot = Snapshot(static_cast<Histogram>(histogram));
+	os << histogram_descriptions[histogram].name << " count " << snapshot.count;
+	std::pair<const char *, double> quantiles[]{{"p50", 0.5}, {"p90", 0.9}, {"p99", 0.99}, {"p99.9", 0.999}};
+	os << std::fixed << std::setprecision(1);
+	for (auto [label, q] : quantiles) os << ' ' << label << ' ' << snapshot.Quantile(q) / 1000.0 << "us";
+	os << " max " << snapshot.max / 1000.0 << "us" << std::defaultfloat << std::setprecision(6) << std::endl;
+  }
+}
+void Metrics::WritePrometheus(std::ostream &out) {
+  // the formatting of the numbers does not change the caller's stream
+  std::ostringstream os;
+  os << std::setprecision(12);
+  for (size_t counter = 0; counter < COUNTER_COUNT; ++counter) {
+	auto &description = counter_descriptions[counter];
+	os << "# HELP " << description.name << ' ' << description.help << '\n';
+	os << "# TYPE " << description.name << " counter\n";
+	os << description.name << ' ' << Total(static_cast<Counter>(counter)) << '\n';
+  }
+  for (size_t histogram = 0; histogram < HISTOGRAM_COUNT; ++histogram) {
+	auto &description = histogram_descriptions[histogram];
+	auto snapshot = Snapshot(static_cast<Histogram>(histogram));
+	os << "# HELP " << description.name << ' ' << description.help << '\n';
+	os << "# TYPE " << description.name << " histogram\n";
+	// powers of four from 256 ns to 17 s are boundaries of the buckets. The values are whole nanoseconds, so those
+	// below a boundary are those not greater than 1 ns less, which is the le of the bucket, and the counts are exact
+	for (unsigned exponent = 8; exponent <= 34; exponent += 2) {
+	  uint64_t bound = uint64_t{1} << exponent;
+	  os << description.name << "_bucket{le=\"" << (bound - 1) / 1e9 << "\"} " << snapshot.CountBelow(bound) << '\n';
+	}
+	os << description.name << "_bucket{le=\"+Inf\"} " << snapshot.count << '\n';
+	os << description.name << "_sum " << snapshot.sum / 1e9 << '\n';
+	os << description.name << "_count " << snapshot.count << '\n';
+  }
+  out << os.view();
+  out.flush();
+}
+void Metrics::Dump(const std::string &path) {
+  if (path.empty()) {
+	WritePrometheus(std::cerr);
+	return;
+  }
+  // a collector never reads a partial file
+  std::string temporary = path + ".tmp";
+  {
+	std::ofstream file(temporary);
+	WritePrometheus(file);
+	if (!file) return;
+  }
+  std::error_code error;
+  std::filesystem::rename(temporary, path, error);
+}
+void Metrics::DumpOnSignal(const std::string &path) {
+#ifndef _WIN32
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGUSR1);
+  // the threads started later inherit the mask, only the dumping thread takes the signal
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  std::thread([signals, path] {
+	while (true) {
+	  int signal;
+	  if (sigwait(&signals, &signal) == 0) Dump(path);
+	}
+  }).detach();
+#endif
+}
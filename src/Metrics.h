@@ -0,0 +1,99 @@
+//
+// Created by praza on 18.10.2026.
+//
+
+#ifndef OSHI_CPP__METRICS_H_
+#define OSHI_CPP__METRICS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/// Sub-buckets of every power of two in a latency histogram, the relative error of a quantile is below 1/16
+#define METRICS_SUB_BUCKET_BITS 4
+/// Latencies up to 2^METRICS_MAX_EXPONENT ns (about 18 minutes) are told apart, longer ones share the last bucket
+#define METRICS_MAX_EXPONENT 40
+
+/// Process-wide counters and latency histograms.
+/// Every thread updates its own shard with plain loads and stores, so the instrumentation takes no locks and never
+/// shares a cache line with another thread; the readers sum the shards. A shard of a finished thread is kept with its
+/// values and reused by the next new thread.
+class Metrics {
+ public:
+  enum Counter {
+	/// queries searched by GrammarFormGuesser, with any of the Guess methods
+	GUESSES,
+	/// search nodes whose applicable rules were looked for
+	NODES_EXPANDED,
+	/// rules of the role of an expanded node, compared with its form
+	RULES_TESTED,
+	/// rules applicable to an expanded node
+	RULES_MATCHED,
+	DICTIONARY_QUERIES,
+	/// states found in a GuessMemo
+	MEMO_HITS,
+	MEMO_MISSES,
+	COUNTER_COUNT
+  };
+  enum Histogram {
+	/// time of a query to its first derivation (see GrammarFormGuesser::GuessAll)
+	GUESS_LATENCY,
+	/// only every dictionary_query_sample-th query is timed, as a query takes about as long as reading the clock
+	DICTIONARY_QUERY_LATENCY,
+	HISTOGRAM_COUNT
+  };
+  /// Log-linear buckets (HDR histogram style): 2^METRICS_SUB_BUCKET_BITS linear buckets per power of two
+  static constexpr size_t sub_buckets = size_t{1} << METRICS_SUB_BUCKET_BITS;
+  static constexpr size_t bucket_count = (METRICS_MAX_EXPONENT - METRICS_SUB_BUCKET_BITS + 1) * sub_buckets;
+  static constexpr unsigned dictionary_query_sample = 16;
+
+  /// Values of a histogram summed over the threads, in nanoseconds
+  struct HistogramSnapshot {
+	std::vector<uint64_t> buckets = std::vector<uint64_t>(bucket_count);
+	uint64_t count = 0, sum = 0, max = 0;
+	/// Returns the smallest value with at least \p q of the values not greater, up to the bucket precision
+	uint64_t Quantile(double q) const;
+	/// Returns how many values are less than \p value, which must be a power of two (a bucket boundary)
+	uint64_t CountBelow(uint64_t value) const;
+  };
+
+  static void Add(Counter counter, uint64_t n = 1);
+  static void Record(Histogram histogram, uint64_t nanoseconds);
+  /// Returns the sum of \p counter over the threads
+  static uint64_t Total(Counter counter);
+  static HistogramSnapshot Snapshot(Histogram histogram);
+  /// Writes the counters and the quantiles of the histograms for people (the :stats command)
+  static void WriteText(std::ostream &os);
+  /// Writes everything in the Prometheus text exposition format
+  static void WritePrometheus(std::ostream &out);
+  /// Writes the Prometheus format to \p path (replacing the file at once) or to stderr if \p path is empty
+  static void Dump(const std::string &path);
+  /// Dumps the metrics to \p path on every SIGUSR1, from a thread waiting for the signal.
+  /// Must be called before any other thread is started, so that none of them takes the signal.
+  static void DumpOnSignal(const std::string &path);
+
+  /// Records the time from its construction to its destruction into a histogram
+  class Timer {
+   public:
+	explicit Timer(Histogram histogram) : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+	Timer(const Timer &other) = delete;
+	Timer &operator=(const Timer &other) = delete;
+	~Timer() {
+	  auto elapsed = std::chrono::steady_clock::now() - start_;
+	  Record(histogram_, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+	}
+   private:
+	Histogram histogram_;
+	std::chrono::steady_clock::time_point start_;
+  };
+
+  /// Returns the bucket of \p value
+  static size_t BucketOf(uint64_t value);
+  /// Returns the smallest value in \p bucket
+  static uint64_t BucketStart(size_t bucket);
+};
+
+#endif //OSHI_CPP__METRICS_H_
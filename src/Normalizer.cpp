@@ -0,0 +1,156 @@
+//
+// Created by praza on 18.10.2026.
+//
+
+#include "Normalizer.h"
+#include "Utilities.h"
+#include <iterator>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+/// Full-width forms of the half-width katakana and punctuation U+FF61 to U+FF9F
+constexpr char16_t half_width_katakana[]{
+	u'。', u'「', u'」', u'、', u'・', u'ヲ', u'ァ', u'ィ', u'ゥ', u'ェ', u'ォ', u'ャ', u'ュ', u'ョ', u'ッ', u'ー',
+	u'ア', u'イ', u'ウ', u'エ', u'オ', u'カ', u'キ', u'ク', u'ケ', u'コ', u'サ', u'シ', u'ス', u'セ', u'ソ', u'タ',
+	u'チ', u'ツ', u'テ', u'ト', u'ナ', u'ニ', u'ヌ', u'ネ', u'ノ', u'ハ', u'ヒ', u'フ', u'ヘ', u'ホ', u'マ', u'ミ',
+	u'ム', u'メ', u'モ', u'ヤ', u'ユ', u'ヨ', u'ラ', u'リ', u'ル', u'レ', u'ロ', u'ワ', u'ン', u'゛', u'゜',
+};
+static_assert(std::size(half_width_katakana) == 0xFF9F - 0xFF61 + 1);
+constexpr char32_t half_width_voiced_mark = 0xFF9E, half_width_semi_voiced_mark = 0xFF9F;
+
+/// Returns the katakana \p c with the (semi-)voiced sound mark, 0 if there is no such character
+char32_t Voiced(char32_t c, bool semi_voiced) {
+  // ハ, ヒ, フ, ヘ and ホ are followed by their voiced and semi-voiced forms
+  bool ha_row = c >= u'ハ' && c <= u'ホ' && (c - u'ハ') % 3 == 0;
+  if (semi_voiced) return ha_row ? c + 2 : 0;
+  // カ to チ are followed by their voiced forms, ツ, テ and ト too, after the small ッ
+  if ((c >= u'カ' && c <= u'チ' && (c - u'カ') % 2 == 0) || c == u'ツ' || c == u'テ' || c == u'ト' || ha_row)
+	return c + 1;
+  switch (c) {
+	case u'ウ': return u'ヴ';
+	case u'ワ': return u'ヷ';
+	case u'ヲ': return u'ヺ';
+	default: return 0;
+  }
+}
+
+void AppendUtf8(char32_t c, std::string &out) {
+  if (c < 0x80) {
+	out += static_cast<char>(c);
+  } else if (c < 0x800) {
+	out += static_cast<char>(0xC0 | c >> 6);
+	out += static_cast<char>(0x80 | (c & 0x3F));
+  } else if (c < 0x10000) {
+	out += static_cast<char>(0xE0 | c >> 12);
+	out += static_cast<char>(0x80 | (c >> 6 & 0x3F));
+	out += static_cast<char>(0x80 | (c & 0x3F));
+  } else {
+	out += static_cast<char>(0xF0 | c >> 18);
+	out += static_cast<char>(0x80 | (c >> 12 & 0x3F));
+	out += static_cast<char>(0x80 | (c >> 6 & 0x3F));
+	out += static_cast<char>(0x80 | (c & 0x3F));
+  }
+}
+
+/// Returns the length of the whitespace (ASCII or the ideographic space U+3000) at the start of \p s
+size_t LeadingWhitespace(std::string_view s) {
+  size_t length = 0;
+  while (true) {
+	if (length < s.size() && std::string_view(" \t\n\v\f\r").find(s[length]) != std::string_view::npos) ++length;
+	else if (s.substr(length).starts_with("　")) length += 3;
+	else return length;
+  }
+}
+size_t TrailingWhitespace(std::string_view s) {
+  size_t length = 0;
+  while (true) {
+	if (length < s.size() && std::string_view(" \t\n\v\f\r").find(s[s.size() - length - 1]) != std::string_view::npos)
+	  ++length;
+	else if (s.substr(0, s.size() - length).ends_with("　")) length += 3;
+	else return length;
+  }
+}
+
+#ifdef __SSE2__
+/// Returns the length of the run of valid UTF-8 starting at \p p which \p flags leave unchanged, either 16 ASCII
+/// characters or 5 characters of 3 bytes (kana and kanji), or 0 if the characters must be decoded one by one.
+/// At least 16 bytes must be readable at \p p.
+size_t UnchangedRun(const char *p, unsigned flags) {
+  __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+  if (_mm_movemask_epi8(bytes) == 0) return 16;
+  auto byte = [](unsigned b) { return _mm_set1_epi8(static_cast<char>(b)); };
+  auto positions = [&](unsigned b) {
+	return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, byte(b))));
+  };
+  // the signed comparisons take E1 to EF for a lead byte and 80 to BF for a continuation byte. E0 and ED are left
+  // to the decoder, as their second byte is restricted (overlong forms and surrogates).
+  __m128i lead = _mm_and_si128(_mm_cmpgt_epi8(bytes, byte(0xE0)), _mm_cmplt_epi8(bytes, byte(0xF0)));
+  auto leads = static_cast<unsigned>(_mm_movemask_epi8(lead)) & ~positions(0xED);
+  auto continuations = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmplt_epi8(bytes, byte(0xC0))));
+  // lead bytes at 0, 3, 6, 9 and 12 of the first 15 bytes, continuation bytes elsewhere
+  constexpr unsigned expected_leads = 0x1249, run = 0x7FFF;
+  if ((leads & run) != expected_leads || (continuations & run) != (run ^ expected_leads)) return 0;
+  unsigned e3 = positions(0xE3) & expected_leads, changed = 0;
+  // U+FF00 to U+FFEF (EF lead) have the width variants, U+3000 to U+303F (E3 80) the ideographic space
+  if (flags & Normalizer::FOLD_WIDTH) changed |= (positions(0xEF) & expected_leads) | (e3 << 1 & positions(0x80));
+  // U+3080 to U+30FF (E3 82 and E3 83) have the katakana
+  if (flags & Normalizer::KATAKANA_TO_HIRAGANA) changed |= e3 << 1 & (positions(0x82) | positions(0x83));
+  return changed == 0 ? 15 : 0;
+}
+#endif
+}
+
+bool Normalizer::Normalize(std::string_view s, std::string &out, unsigned flags) {
+  if (flags & TRIM) {
+	s.remove_prefix(LeadingWhitespace(s));
+	s.remove_suffix(TrailingWhitespace(s));
+  }
+  out.clear();
+  out.reserve(s.size());
+  // the characters left unchanged are appended in spans, up to the first changed one
+  size_t unchanged = 0;
+  for (size_t pos = 0; pos < s.size();) {
+#ifdef __SSE2__
+	if (s.size() - pos >= 16) {
+	  if (size_t length = UnchangedRun(s.data() + pos, flags)) {
+		pos += length;
+		continue;
+	  }
+	}
+#endif
+	size_t start = pos;
+	char32_t c;
+	if (!Utilities::DecodeValidUtf8(s, pos, c)) return false;
+	char32_t normalized = c;
+	if (flags & FOLD_WIDTH) {
+	  if (c >= 0xFF01 && c <= 0xFF5E) {
+		normalized = c - (0xFF01 - '!');
+	  } else if (c == 0x3000) {
+		normalized = ' ';
+	  } else if (c >= 0xFF61 && c <= 0xFF9F) {
+		normalized = half_width_katakana[c - 0xFF61];
+		size_t next = pos;
+		char32_t mark;
+		if (next < s.size() && Utilities::DecodeValidUtf8(s, next, mark)
+			&& (mark == half_width_voiced_mark || mark == half_width_semi_voiced_mark)) {
+		  if (char32_t voiced = Voiced(normalized, mark == half_width_semi_voiced_mark)) {
+			normalized = voiced;
+			pos = next;
+		  }
+		}
+	  }
+	}
+	// ァ to ヶ, ヽ and ヾ
+	if ((flags & KATAKANA_TO_HIRAGANA)
+		&& ((normalized >= u'ァ' && normalized <= u'ヶ') || normalized == u'ヽ' || normalized == u'ヾ'))
+	  normalized -= u'ァ' - u'ぁ';
+	if (normalized == c) continue;
+	out.append(s.substr(unchanged, start - unchanged));
+	AppendUtf8(normalized, out);
+	unchanged = pos;
+  }
+  out.append(s.substr(unchanged));
+  return true;
+}
@@ -0,0 +1,34 @@
+//
+// Created by praza on 18.10.2026.
+//
+
+#ifndef OSHI_CPP__NORMALIZER_H_
+#define OSHI_CPP__NORMALIZER_H_
+
+#include <string>
+#include <string_view>
+
+/// Normalization of the queries and the dictionary keys, so that the variants users type match the byte-exact
+/// dictionary lookups. Runs of Japanese text and ASCII needing no change are validated and copied 15 or 16 bytes
+/// at a time in an SSE2 register, the rest is decoded one character at a time.
+class Normalizer {
+ public:
+  enum Flags : unsigned {
+	/// full-width ASCII to ASCII, the ideographic space to a space, half-width katakana to full-width katakana
+	/// with the voiced sound marks joined to the preceding kana (ｶﾞ to ガ)
+	FOLD_WIDTH = 1,
+	/// katakana to hiragana, where hiragana has the character
+	KATAKANA_TO_HIRAGANA = 2,
+	/// removes whitespace (ASCII and the ideographic space) from both ends
+	TRIM = 4,
+  };
+  /// The normalization of the queries by default
+  static constexpr unsigned query_flags = FOLD_WIDTH | TRIM;
+
+  /// Writes \p s normalized according to \p flags to \p out
+  /// \return false if \p s is not valid UTF-8 (an overlong form, a surrogate or a truncated sequence), \p out is
+  /// unspecified then
+  static bool Normalize(std::string_view s, std::string &out, unsigned flags = query_flags);
+};
+
+#endif //OSHI_CPP__NORMALIZER_H_
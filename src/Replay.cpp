@@ -0,0 +1,119 @@
+//
+// Created by praza on 18.10.2026.
+//
+
+#include "Replay.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <numeric>
+#include <sstream>
+#include <thread>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+uint64_t Nanoseconds(Clock::duration duration) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+}
+
+/// Runs \p f(i) for every i below \p count on \p threads threads, in the order of i
+template<class F>
+void RunOnThreads(unsigned threads, size_t count, F &&f) {
+  std::atomic<size_t> next = 0;
+  auto work = [&] {
+	for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;) f(i);
+  };
+  std::vector<std::thread> workers;
+  for (unsigned t = 1; t < threads; ++t) workers.emplace_back(work);
+  work();
+  for (auto &worker : workers) worker.join();
+}
+}
+
+bool Replay::ReadLog(const std::string &path, std::vector<std::string> &queries) {
+  std::ifstream file(path);
+  if (!file) return false;
+  for (std::string line; std::getline(file, line);) {
+	if (line.ends_with('\r')) line.pop_back();
+	if (!line.empty()) queries.push_back(std::move(line));
+  }
+  return true;
+}
+
+Replay::Report Replay::Run(const GrammarFormGuesser &guesser, std::span<const std::string> queries,
+						   const Options &options) {
+  Report report;
+  report.threads = std::max(options.threads, 1u);
+  report.rate = options.rate;
+  report.queries = queries.size();
+  if (queries.empty()) return report;
+
+  RunOnThreads(report.threads, options.warmup, [&](size_t i) { guesser.GuessQuery(queries[i % queries.size()]); });
+
+  // each thread writes only the entries of its queries
+  std::vector<uint64_t> latencies(queries.size());
+  std::vector<char> answered(queries.size());
+  auto start = Clock::now();
+  std::chrono::duration<double, std::nano> interval(options.rate > 0 ? 1e9 / options.rate : 0);
+  std::atomic<uint64_t> end_ns = 0;
+  RunOnThreads(report.threads, queries.size(), [&](size_t i) {
+	auto query_start = Clock::now();
+	if (options.rate > 0) {
+	  auto scheduled = start + std::chrono::duration_cast<Clock::duration>(interval * static_cast<double>(i));
+	  // the time a query waited for a free thread counts, the oversleeping of the thread does not
+	  if (query_start < scheduled) {
+		std::this_thread::sleep_until(scheduled);
+		query_start = Clock::now();
+	  } else query_start = scheduled;
+	}
+	answered[i] = guesser.GuessQuery(queries[i]).success;
+	auto end = Clock::now();
+	latencies[i] = Nanoseconds(end - query_start);
+	uint64_t elapsed = Nanoseconds(end - start), last = end_ns.load(std::memory_order_relaxed);
+	while (elapsed > last && !end_ns.compare_exchange_weak(last, elapsed, std::memory_order_relaxed));
+  });
+  report.wall_ns = end_ns.load();
+  report.unanswered = std::count(answered.begin(), answered.end(), 0);
+
+  std::vector<size_t> order(queries.size());
+  std::iota(order.begin(), order.end(), 0);
+  size_t outliers = std::min(options.outliers, queries.size());
+  std::partial_sort(order.begin(), order.begin() + outliers, order.end(),
+					[&](size_t a, size_t b) { return latencies[a] > latencies[b]; });
+  for (size_t i = 0; i < outliers; ++i) report.outliers.emplace_back(latencies[order[i]], queries[order[i]]);
+  std::sort(latencies.begin(), latencies.end());
+  report.latencies = std::move(latencies);
+  return report;
+}
+
+uint64_t Replay::Report::Quantile(double q) const {
+  if (latencies.empty()) return 0;
+  auto rank = static_cast<size_t>(std::ceil(q * static_cast<double>(latencies.size())));
+  return latencies[std::clamp<size_t>(rank, 1, latencies.size()) - 1];
+}
+
+double Replay::Report::Throughput() const {
+  return wall_ns == 0 ? 0 : static_cast<double>(queries) * 1e9 / static_cast<double>(wall_ns);
+}
+
+void Replay::Report::Write(std::ostream &out) const {
+  // the formatting of the numbers does not change the caller's stream
+  std::ostringstream os;
+  os << std::fixed << std::setprecision(1);
+  os << "Replayed " << queries << " queries on " << threads << (threads == 1 ? " thread" : " threads");
+  if (rate > 0) os << " at " << rate << " queries/s";
+  os << " in " << wall_ns / 1e6 << " ms: " << Throughput()
+	 << " queries/s, " << unanswered << " without derivation\n";
+  os << "Latency";
+  std::pair<const char *, double> quantiles[]{{"p50", 0.5}, {"p90", 0.9}, {"p99", 0.99}, {"p99.9", 0.999}};
+  for (auto [label, q] : quantiles) os << ' ' << label << ' ' << Quantile(q) / 1000.0 << "us";
+  os << " max " << (latencies.empty() ? 0 : latencies.back()) / 1000.0 << "us\n";
+  if (!outliers.empty()) os << "Slowest queries:\n";
+  for (auto &[latency, query] : outliers) os << std::setw(12) << latency / 1000.0 << "us " << query << '\n';
+  out << os.view();
+  out.flush();
+}
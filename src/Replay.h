@@ -0,0 +1,55 @@
+//
+// Created by praza on 18.10.2026.
+//
+
+#ifndef OSHI_CPP__REPLAY_H_
+#define OSHI_CPP__REPLAY_H_
+
+#include "GrammarFormGuesser.h"
+#include <ostream>
+#include <span>
+#include <string>
+#include <vector>
+
+/// Replays a log of queries, one per line, through GrammarFormGuesser::Guess and measures the latency of each,
+/// to compare releases and configurations on a real mix of queries
+class Replay {
+ public:
+  struct Options {
+	unsigned threads = 1;
+	/// queries answered before the measurement, from the start of the log (again if it is shorter), not measured
+	size_t warmup = 0;
+	/// queries per second started, 0 replays each query as soon as a thread is free
+	double rate = 0;
+	/// how many of the slowest queries are reported
+	size_t outliers = 10;
+  };
+  struct Report {
+	unsigned threads = 0;
+	double rate = 0;
+	/// measured queries and those of them without a derivation
+	size_t queries = 0, unanswered = 0;
+	/// time from the start of the first measured query to the end of the last one
+	uint64_t wall_ns = 0;
+	/// latencies of the measured queries in nanoseconds, sorted
+	std::vector<uint64_t> latencies;
+	/// the slowest queries with their latencies, slowest first
+	std::vector<std::pair<uint64_t, std::string>> outliers;
+	/// Returns the smallest latency with at least \p q of the latencies not greater (nearest rank), 0 without queries
+	uint64_t Quantile(double q) const;
+	/// Returns the measured queries per second
+	double Throughput() const;
+	/// Writes the throughput, the percentiles and the outliers for people
+	void Write(std::ostream &os) const;
+  };
+
+  /// Appends the non-empty lines of the file at \p path to \p queries
+  /// \return false if the file cannot be read
+  static bool ReadLog(const std::string &path, std::vector<std::string> &queries);
+  /// Answers the warmup and then every query of \p queries once, the threads take the queries in the log order.
+  /// With a rate, the i-th query is started no sooner than i / rate seconds after the first one. A query started late
+  /// because all the threads were busy is measured from its scheduled start, so the queueing delay is reported too.
+  static Report Run(const GrammarFormGuesser &guesser, std::span<const std::string> queries, const Options &options);
+};
+
+#endif //OSHI_CPP__REPLAY_H_
@@ -0,0 +1,145 @@
+//
+// Created by praza on 18.10.2026.
+//
+
+#include "ResultSerializer.h"
+#include "Utilities.h"
+#include <cstdint>
+#include <sstream>
+
+bool ResultSerializer::ParseFormat(std::string_view name, OutputFormat &format) {
+  if (name == "text") format = OutputFormat::TEXT;
+  else if (name == "jsonl") format = OutputFormat::JSONL;
+  else if (name == "binary") format = OutputFormat::BINARY;
+  else return false;
+  return true;
+}
+void ResultSerializer::Append(const GuessResult &result, OutputFormat format, std::string &out) {
+  switch (format) {
+	case OutputFormat::TEXT: AppendText(result, out);
+	  break;
+	case OutputFormat::JSONL: AppendJson(result, out);
+	  break;
+	case OutputFormat::BINARY: AppendBinary(result, out);
+	  break;
+  }
+}
+void ResultSerializer::AppendText(const GuessResult &result, std::string &out) {
+  if (!result.success) {
+	out += "No result :(\n";
+	return;
+  }
+  std::ostringstream os;
+  os << result << '\n';
+  out += os.view();
+}
+void ResultSerializer::AppendJson(const GuessResult &result, std::string &out) {
+  out += "{\"query\":";
+  AppendJsonString(result.original_query, out);
+  out += result.success ? ",\"success\":true" : ",\"success\":false";
+  if (result.success) {
+	out += ",\"derivation\":[";
+	for (size_t i = 0; i < result.rules.size(); ++i) {
+	  out += i == 0 ? "{\"rule\":" : ",{\"rule\":";
+	  AppendJsonString(result.rules[i]->rule, out);
+	  out += ",\"form\":";
+	  AppendJsonString(result.Form(i), out);
+	  out += '}';
+	}
+	out += "],\"entry\":{\"id\":";
+	out += std::to_string(result.entry->id);
+	out += ",\"writings\":";
+	AppendJsonStrings(result.entry->writings, out);
+	out += ",\"readings\":";
+	AppendJsonStrings(result.entry->readings, out);
+	out += ",\"senses\":[";
+	for (size_t i = 0; i < result.entry->senses.size(); ++i) {
+	  out += i == 0 ? "{\"pos\":" : ",{\"pos\":";
+	  AppendJsonStrings(result.entry->senses[i].part_of_speech, out);
+	  out += ",\"glosses\":";
+	  AppendJsonStrings(result.entry->senses[i].glosses, out);
+	  out += '}';
+	}
+	out += "]}";
+  }
+  out += "}\n";
+}
+void ResultSerializer::AppendBinary(const GuessResult &result, std::string &out) {
+  // the length is filled in when the record is complete
+  size_t start = out.size();
+  out.append(4, '\0');
+  AppendBinaryString(result.original_query, out);
+  out += static_cast<char>(result.success);
+  if (result.success) {
+	AppendVarint(result.rules.size(), out);
+	for (size_t i = 0; i < result.rules.size(); ++i) {
+	  AppendBinaryString(result.rules[i]->rule, out);
+	  AppendBinaryString(result.Form(i), out);
+	}
+	AppendVarint(result.entry->id, out);
+	AppendBinaryStrings(result.entry->writings, out);
+	AppendBinaryStrings(result.entry->readings, out);
+	AppendVarint(result.entry->senses.size(), out);
+	for (auto &sense : result.entry->senses) {
+	  AppendBinaryStrings(sense.part_of_speech, out);
+	  AppendBinaryStrings(sense.glosses, out);
+	}
+  }
+  uint32_t length = out.size() - start - 4;
+  for (int i = 0; i < 4; ++i) out[start + i] = static_cast<char>(length >> (8 * i) & 0xFF);
+}
+void ResultSerializer::AppendJsonString(std::string_view s, std::string &out) {
+  static const char hex[] = "0123456789abcdef";
+  out += '"';
+  for (size_t pos = 0; pos < s.size();) {
+	char c = s[pos];
+	// valid UTF-8 passes through, only quotes, backslashes and control characters are escaped
+	if (static_cast<unsigned char>(c) >= 0x80) {
+	  size_t start = pos;
+	  char32_t code_point;
+	  // the raw queries of the batch and the server may be any bytes, each invalid one becomes U+FFFD
+	  if (Utilities::DecodeValidUtf8(s, pos, code_point)) {
+		out += s.substr(start, pos - start);
+	  } else {
+		out += "\xEF\xBF\xBD";
+		++pos;
+	  }
+	  continue;
+	}
+	if (c == '"' || c == '\\') {
+	  out += '\\';
+	  out += c;
+	} else if (static_cast<unsigned char>(c) < 0x20) {
+	  out += "\\u00";
+	  out += hex[c >> 4];
+	  out += hex[c & 0xF];
+	} else {
+	  out += c;
+	}
+	++pos;
+  }
+  out += '"';
+}
+void ResultSerializer::AppendJsonStrings(const FlatArray<FlatString> &strings, std::string &out) {
+  out += '[';
+  for (size_t i = 0; i < strings.size(); ++i) {
+	if (i > 0) out += ',';
+	AppendJsonString(strings[i], out);
+  }
+  out += ']';
+}
+void ResultSerializer::AppendVarint(unsigned long long value, std::string &out) {
+  while (value >= 0x80) {
+	out += static_cast<char>((value & 0x7F) | 0x80);
+	value >>= 7;
+  }
+  out += static_cast<char>(value);
+}
+void ResultSerializer::AppendBinaryString(std::string_view s, std::string &out) {
+  AppendVarint(s.size(), out);
+  out += s;
+}
+void ResultSerializer::AppendBinaryStrings(const FlatArray<FlatString> &strings, std::string &out) {
+  AppendVarint(strings.size(), out);
+  for (auto &s : strings) AppendBinaryString(s, out);
+}
@@ -0,0 +1,49 @@
+//
+// Created by praza on 18.10.2026.
+//
+
+#ifndef OSHI_CPP__RESULTSERIALIZER_H_
+#define OSHI_CPP__RESULTSERIALIZER_H_
+
+#include "GrammarFormGuesser.h"
+
+/// Output formats of the derivations (see --output)
+enum class OutputFormat {
+  /// the human-readable text printed by operator<<
+  TEXT,
+  /// one JSON object per line
+  JSONL,
+  /// length-prefixed binary records, see ResultSerializer::AppendBinary
+  BINARY
+};
+
+/// Writes derivations in the machine-readable formats by appending bytes to a buffer, there is no std::ostream
+/// involved except for the TEXT format.
+class ResultSerializer {
+ public:
+  /// Parses the value of --output
+  /// \return false if \p name is not a known format
+  static bool ParseFormat(std::string_view name, OutputFormat &format);
+  /// Appends a single record of \p result in \p format to \p out
+  static void Append(const GuessResult &result, OutputFormat format, std::string &out);
+  /// Appends the text as printed in the prompt followed by a newline, "No result :(" if there is no derivation
+  static void AppendText(const GuessResult &result, std::string &out);
+  /// Appends a line with a JSON object:
+  /// {"query":"…","success":true,"derivation":[{"rule":"…","form":"…"},…],"entry":{"id":…,"writings":[…],
+  /// "readings":[…],"senses":[{"pos":[…],"glosses":[…]},…]}}
+  /// The forms are the results of the rules applied in turn, "derivation" and "entry" are missing without success.
+  static void AppendJson(const GuessResult &result, std::string &out);
+  /// Appends a record of a 32-bit little-endian byte length followed by the fields of AppendJson in the same order.
+  /// Numbers and counts of lists are LEB128 varints, strings are a varint byte length and UTF-8 bytes,
+  /// success is a single byte. The entry fields are missing without success.
+  static void AppendBinary(const GuessResult &result, std::string &out);
+  /// Appends \p s as a JSON string, quoted and escaped
+  static void AppendJsonString(std::string_view s, std::string &out);
+ private:
+  static void AppendJsonStrings(const FlatArray<FlatString> &strings, std::string &out);
+  static void AppendVarint(unsigned long long value, std::string &out);
+  static void AppendBinaryString(std::string_view s, std::string &out);
+  static void AppendBinaryStrings(const FlatArray<FlatString> &strings, std::string &out);
+};
+
+#endif //OSHI_CPP__RESULTSERIALIZER_H_
@@ -0,0 +1,188 @@
+//
+// Created by praza on 18.10.2026.
+//
+
+#include "RoaringBitmap.h"
+#include <algorithm>
+#include <iterator>
+
+namespace {
+using Container = RoaringBitmap::Container;
+
+bool Contains(const Container &container, uint16_t low) {
+  if (container.IsBitmap()) return container.bitmap[low / 64] >> (low % 64) & 1;
+  return std::binary_search(container.array.begin(), container.array.end(), low);
+}
+
+std::vector<uint64_t> ToBitmap(const std::vector<uint16_t> &array) {
+  std::vector<uint64_t> bitmap(RoaringBitmap::bitmap_words);
+  for (auto low : array) bitmap[low / 64] |= uint64_t{1} << (low % 64);
+  return bitmap;
+}
+
+/// Counts the values of a bitmap container and makes it an array container if there are few enough of them
+void FinishBitmap(Container &container) {
+  container.cardinality = 0;
+  for (auto word : container.bitmap) container.cardinality += std::popcount(word);
+  if (container.cardinality > RoaringBitmap::array_limit) return;
+  container.array.reserve(container.cardinality);
+  for (uint32_t w = 0; w < RoaringBitmap::bitmap_words; ++w) {
+	for (uint64_t word = container.bitmap[w]; word != 0; word &= word - 1)
+	  container.array.push_back(static_cast<uint16_t>(w * 64 + std::countr_zero(word)));
+  }
+  container.bitmap = {};
+}
+/// Makes an array container a bitmap container if it has too many values
+void FinishArray(Container &container) {
+  container.cardinality = static_cast<uint32_t>(container.array.size());
+  if (container.cardinality <= RoaringBitmap::array_limit) return;
+  container.bitmap = ToBitmap(container.array);
+  container.array = {};
+}
+
+Container And(const Container &a, const Container &b) {
+  Container result{a.key, 0, {}, {}};
+  if (a.IsBitmap() && b.IsBitmap()) {
+	result.bitmap.resize(RoaringBitmap::bitmap_words);
+	for (size_t w = 0; w < RoaringBitmap::bitmap_words; ++w) result.bitmap[w] = a.bitmap[w] & b.bitmap[w];
+	FinishBitmap(result);
+	return result;
+  }
+  if (a.IsBitmap() || b.IsBitmap()) {
+	auto &array = a.IsBitmap() ? b : a, &bitmap = a.IsBitmap() ? a : b;
+	std::copy_if(array.array.begin(), array.array.end(), std::back_inserter(result.array),
+				 [&](uint16_t low) { return Contains(bitmap, low); });
+	FinishArray(result);
+	return result;
+  }
+  auto &small = a.array.size() <= b.array.size() ? a.array : b.array;
+  auto &large = a.array.size() <= b.array.size() ? b.array : a.array;
+  // a few values are searched for in the long array, otherwise the arrays are merged
+  if (small.size() * 32 < large.size()) {
+	auto from = large.begin();
+	for (auto low : small) {
+	  from = std::lower_bound(from, large.end(), low);
+	  if (from == large.end()) break;
+	  if (*from == low) result.array.push_back(low);
+	}
+  } else {
+	std::set_intersection(small.begin(), small.end(), large.begin(), large.end(), std::back_inserter(result.array));
+  }
+  FinishArray(result);
+  return result;
+}
+
+Container Or(const Container &a, const Container &b) {
+  Container result{a.key, 0, {}, {}};
+  if (!a.IsBitmap() && !b.IsBitmap()) {
+	std::set_union(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), std::back_inserter(result.array));
+	FinishArray(result);
+	return result;
+  }
+  result.bitmap = a.IsBitmap() ? a.bitmap : ToBitmap(a.array);
+  if (b.IsBitmap()) {
+	for (size_t w = 0; w < RoaringBitmap::bitmap_words; ++w) result.bitmap[w] |= b.bitmap[w];
+  } else {
+	for (auto low : b.array) result.bitmap[low / 64] |= uint64_t{1} << (low % 64);
+  }
+  // the union of a bitmap container with anything has more values than an array container may hold
+  FinishBitmap(result);
+  return result;
+}
+
+Container AndNot(const Container &a, const Container &b) {
+  Container result{a.key, 0, {}, {}};
+  if (!a.IsBitmap()) {
+	std::copy_if(a.array.begin(), a.array.end(), std::back_inserter(result.array),
+				 [&](uint16_t low) { return !Contains(b, low); });
+	FinishArray(result);
+	return result;
+  }
+  result.bitmap = a.bitmap;
+  if (b.IsBitmap()) {
+	for (size_t w = 0; w < RoaringBitmap::bitmap_words; ++w) result.bitmap[w] &= ~b.bitmap[w];
+  } else {
+	for (auto low : b.array) result.bitmap[low / 64] &= ~(uint64_t{1} << (low % 64));
+  }
+  FinishBitmap(result);
+  return result;
+}
+}
+
+RoaringBitmap RoaringBitmap::FromSorted(std::span<const uint32_t> values) {
+  RoaringBitmap result;
+  for (size_t begin = 0, end; begin < values.size(); begin = end) {
+	auto key = static_cast<uint16_t>(values[begin] >> 16);
+	Container container{key, 0, {}, {}};
+	for (end = begin; end < values.size() && values[end] >> 16 == key; ++end) {
+	  auto low = static_cast<uint16_t>(values[end]);
+	  if (container.array.empty() || container.array.back() != low) container.array.push_back(low);
+	}
+	FinishArray(container);
+	result.containers_.push_back(std::move(container));
+  }
+  return result;
+}
+
+void RoaringBitmap::AppendContainer(uint16_t key, std::span<const uint16_t> array, std::span<const uint64_t> bitmap) {
+  Container container{key, 0, {array.begin(), array.end()}, {bitmap.begin(), bitmap.end()}};
+  if (container.IsBitmap()) FinishBitmap(container);
+  else FinishArray(container);
+  if (container.cardinality != 0) containers_.push_back(std::move(container));
+}
+
+size_t RoaringBitmap::Cardinality() const {
+  size_t cardinality = 0;
+  for (auto &container : containers_) cardinality += container.cardinality;
+  return cardinality;
+}
+
+bool RoaringBitmap::Contains(uint32_t value) const {
+  auto it = std::lower_bound(containers_.begin(), containers_.end(), value >> 16,
+							 [](const Container &container, uint32_t key) { return container.key < key; });
+  return it != containers_.end() && it->key == value >> 16 && ::Contains(*it, static_cast<uint16_t>(value));
+}
+
+RoaringBitmap &RoaringBitmap::operator&=(const RoaringBitmap &other) {
+  std::vector<Container> result;
+  auto a = containers_.cbegin(), b = other.containers_.cbegin();
+  while (a != containers_.cend() && b != other.containers_.cend()) {
+	if (a->key < b->key) ++a;
+	else if (b->key < a->key) ++b;
+	else {
+	  auto container = And(*a++, *b++);
+	  if (container.cardinality != 0) result.push_back(std::move(container));
+	}
+  }
+  containers_ = std::move(result);
+  return *this;
+}
+
+RoaringBitmap &RoaringBitmap::operator|=(const RoaringBitmap &other) {
+  std::vector<Container> result;
+  auto a = containers_.begin();
+  auto b = other.containers_.begin();
+  while (a != containers_.end() || b != other.containers_.end()) {
+	if (b == other.containers_.end() || (a != containers_.end() && a->key < b->key)) result.push_back(std::move(*a++));
+	else if (a == containers_.end() || b->key < a->key) result.push_back(*b++);
+	else result.push_back(Or(*a++, *b++));
+  }
+  containers_ = std::move(result);
+  return *this;
+}
+
+RoaringBitmap &RoaringBitmap::operator-=(const RoaringBitmap &other) {
+  std::vector<Container> result;
+  auto b = other.containers_.begin();
+  for (auto &a : containers_) {
+	while (b != other.containers_.end() && b->key < a.key) ++b;
+	if (b == other.containers_.end() || b->key != a.key) {
+	  result.push_back(std::move(a));
+	  continue;
+	}
+	auto container = AndNot(a, *b);
+	if (container.cardinality != 0) result.push_back(std::move(container));
+  }
+  containers_ = std::move(result);
+  return *this;
+}
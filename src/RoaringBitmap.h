@@ -0,0 +1,77 @@
+//
+// Created by praza on 18.10.2026.
+//
+
+#ifndef OSHI_CPP__ROARINGBITMAP_H_
+#define OSHI_CPP__ROARINGBITMAP_H_
+
+#include <bit>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+/// A compressed set of 32-bit integers laid out like a Roaring bitmap: the values are split into containers by their
+/// high 16 bits, and a container holds the low 16 bits either as a sorted array, while there are at most array_limit
+/// of them, or as a bitmap of all 65536. The set operations combine the containers of equal keys pairwise with the
+/// algorithm for their kinds, so the cost follows the compressed sizes rather than the values.
+class RoaringBitmap {
+ public:
+  /// The most values of an array container, a bitmap container takes as much memory
+  static constexpr size_t array_limit = 4096;
+  /// The 64-bit words of a bitmap container
+  static constexpr size_t bitmap_words = 1024;
+  struct Container {
+	/// the high 16 bits of the values
+	uint16_t key;
+	uint32_t cardinality;
+	/// the sorted low 16 bits, empty for a bitmap container
+	std::vector<uint16_t> array;
+	/// bitmap_words words, bit i of word w is the low 16 bits 64 w + i, empty for an array container
+	std::vector<uint64_t> bitmap;
+	bool IsBitmap() const { return !bitmap.empty(); }
+	friend bool operator==(const Container &a, const Container &b) = default;
+  };
+
+  /// Returns the set of \p values, ascending
+  static RoaringBitmap FromSorted(std::span<const uint32_t> values);
+  /// Appends the container of the values with the high 16 bits \p key, greater than the keys of the others, with the
+  /// low 16 bits \p array ascending or \p bitmap of bitmap_words words, whichever is not empty
+  void AppendContainer(uint16_t key, std::span<const uint16_t> array, std::span<const uint64_t> bitmap);
+  /// The containers in the order of their keys, none empty
+  const std::vector<Container> &Containers() const { return containers_; }
+  bool empty() const { return containers_.empty(); }
+  size_t Cardinality() const;
+  bool Contains(uint32_t value) const;
+  /// Calls \p f with each value, ascending, until it returns false
+  template<class F>
+  void ForEach(F &&f) const {
+	for (auto &container : containers_) {
+	  uint32_t high = uint32_t{container.key} << 16;
+	  if (!container.IsBitmap()) {
+		for (auto low : container.array) {
+		  if (!f(high | low)) return;
+		}
+		continue;
+	  }
+	  for (uint32_t w = 0; w < bitmap_words; ++w) {
+		for (uint64_t word = container.bitmap[w]; word != 0; word &= word - 1) {
+		  if (!f(high | w * 64 | static_cast<uint32_t>(std::countr_zero(word)))) return;
+		}
+	  }
+	}
+  }
+  /// Keeps the values that are in \p other too
+  RoaringBitmap &operator&=(const RoaringBitmap &other);
+  RoaringBitmap &operator|=(const RoaringBitmap &other);
+  /// Removes the values of \p other
+  RoaringBitmap &operator-=(const RoaringBitmap &other);
+  friend RoaringBitmap operator&(RoaringBitmap a, const RoaringBitmap &b) { return a &= b; }
+  friend RoaringBitmap operator|(RoaringBitmap a, const RoaringBitmap &b) { return a |= b; }
+  friend RoaringBitmap operator-(RoaringBitmap a, const RoaringBitmap &b) { return a -= b; }
+  /// The containers are always of the kind their cardinality calls for, so equal sets are stored equally
+  friend bool operator==(const RoaringBitmap &a, const RoaringBitmap &b) = default;
+ private:
+  std::vector<Container> containers_;
+};
+
+#endif //OSHI_CPP__ROARINGBITMAP_H_
@@ -0,0 +1,97 @@
+//
+// Created by praza on 18.10.2026.
+//
+
+#include "SearchTrace.h"
+#include "ResultSerializer.h"
+#include <cstdint>
+
+thread_local SearchTrace *SearchTrace::current_ = nullptr;
+
+uint64_t SearchTrace::Now() const {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - created_).count();
+}
+void SearchTrace::Probe(const void *key, const void *parent_key, std::string_view form, std::string role,
+						std::string glob, const GrammarRule *rule, const DictionaryEntry *entry, uint64_t start) {
+  Node node{SIZE_MAX, 0, std::string(form), std::move(role), std::move(glob), rule, entry, {}, start, 0};
+  // the parent is missing if it was searched on another thread
+  if (auto parent = indices_.find(parent_key); parent_key != nullptr && parent != indices_.end()) {
+	node.parent = parent->second;
+	node.depth = nodes[parent->second].depth + 1;
+  }
+  node.duration = Now() - start;
+  // the arena of a later query may reuse the address, its nodes are the ones referred to from then on
+  indices_[key] = nodes.size();
+  nodes.push_back(std::move(node));
+}
+void SearchTrace::Expand(const void *key, std::vector<RuleTest> rules) {
+  auto found = indices_.find(key);
+  if (found == indices_.end()) return;
+  Node &node = nodes[found->second];
+  node.rules = std::move(rules);
+  node.duration = Now() - node.start;
+}
+std::vector<uint64_t> SearchTrace::SubtreeDurations() const {
+  std::vector<uint64_t> subtree(nodes.size());
+  // a child is always recorded after its parent
+  for (size_t i = nodes.size(); i-- > 0;) {
+	subtree[i] += nodes[i].duration;
+	if (nodes[i].parent != SIZE_MAX) subtree[nodes[i].parent] += subtree[i];
+  }
+  return subtree;
+}
+void SearchTrace::AppendFields(size_t index, uint64_t subtree, std::string &out) const {
+  static const char *outcomes[]{"not applicable", "applied", "pruned"};
+  const Node &node = nodes[index];
+  out += "\"id\":" + std::to_string(index);
+  out += ",\"parent\":" + (node.parent == SIZE_MAX ? std::string("null") : std::to_string(node.parent));
+  out += ",\"depth\":" + std::to_string(node.depth);
+  out += ",\"form\":";
+  ResultSerializer::AppendJsonString(node.form, out);
+  out += ",\"role\":";
+  ResultSerializer::AppendJsonString(node.role, out);
+  out += ",\"glob\":";
+  ResultSerializer::AppendJsonString(node.glob, out);
+  out += ",\"rule\":";
+  if (node.rule == nullptr) out += "null";
+  else ResultSerializer::AppendJsonString(node.rule->rule, out);
+  out += ",\"entry\":" + (node.entry == nullptr ? std::string("null") : std::to_string(node.entry->id));
+  out += ",\"rules\":[";
+  for (size_t i = 0; i < node.rules.size(); ++i) {
+	out += i == 0 ? "{\"rule\":" : ",{\"rule\":";
+	ResultSerializer::AppendJsonString(node.rules[i].rule->rule, out);
+	out += ",\"outcome\":\"";
+	out += outcomes[node.rules[i].outcome];
+	out += "\"}";
+  }
+  out += "],\"subtree_ns\":" + std::to_string(subtree);
+}
+void SearchTrace::WriteJson(std::ostream &os) const {
+  auto subtree = SubtreeDurations();
+  std::string out = "{\"nodes\":[";
+  for (size_t i = 0; i < nodes.size(); ++i) {
+	out += i == 0 ? "\n{" : ",\n{";
+	AppendFields(i, subtree[i], out);
+	out += ",\"start_ns\":" + std::to_string(nodes[i].start);
+	out += ",\"duration_ns\":" + std::to_string(nodes[i].duration) + "}";
+  }
+  out += "\n]}\n";
+  os << out;
+}
+void SearchTrace::WriteChromeTrace(std::ostream &os) const {
+  auto subtree = SubtreeDurations();
+  std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  for (size_t i = 0; i < nodes.size(); ++i) {
+	out += i == 0 ? "\n{\"name\":" : ",\n{\"name\":";
+	ResultSerializer::AppendJsonString(nodes[i].form, out);
+	// the timestamps are microseconds
+	out += ",\"cat\":\"search\",\"ph\":\"X\",\"pid\":1,\"tid\":" + std::to_string(nodes[i].depth);
+	out += ",\"ts\":" + std::to_string(nodes[i].start / 1000.0);
+	out += ",\"dur\":" + std::to_string(nodes[i].duration / 1000.0);
+	out += ",\"args\":{";
+	AppendFields(i, subtree[i], out);
+	out += "}}";
+  }
+  out += "\n]}\n";
+  os << out;
+}
@@ -0,0 +1,95 @@
+//
+// Created by praza on 18.10.2026.
+//
+
+#ifndef OSHI_CPP__SEARCHTRACE_H_
+#define OSHI_CPP__SEARCHTRACE_H_
+
+#include "Grammar.h"
+#include "Dictionary.h"
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// The hooks of the search recording a SearchTrace, compiled only with OSHI_TRACE defined (cmake -DOSHI_TRACE=ON)
+#ifdef OSHI_TRACE
+#define TRACE(...) __VA_ARGS__
+#else
+#define TRACE(...)
+#endif
+
+/// The search tree of the queries of GrammarFormGuesser searched on the current thread while a SearchTrace::Scope
+/// is alive: every node (its GrammarTriple), its dictionary probe, every rule of its role tested on it and the time
+/// spent on it. Parallel searches are traced only in the part running on the calling thread.
+/// Nothing is recorded unless the program is compiled with OSHI_TRACE.
+class SearchTrace {
+ public:
+  enum Outcome {
+	/// the pattern, the role or the POS glob of the rule does not match the node
+	NOT_APPLICABLE,
+	APPLIED,
+	/// applicable, but no dictionary writing starts like the resulting form
+	PRUNED
+  };
+  struct RuleTest {
+	const GrammarRule *rule;
+	Outcome outcome;
+  };
+  struct Node {
+	/// index of the parent node, SIZE_MAX for a query
+	size_t parent;
+	unsigned depth;
+	std::string form, role, glob;
+	/// the rule producing the node from its parent, nullptr for a query
+	const GrammarRule *rule;
+	/// the entry found by the dictionary probe of the form, nullptr if none has a POS of the glob
+	const DictionaryEntry *entry = nullptr;
+	/// the rules of the role in the order they were tested, empty if the node was not expanded
+	std::vector<RuleTest> rules;
+	/// nanoseconds since the creation of the trace
+	uint64_t start = 0, duration = 0;
+  };
+  std::vector<Node> nodes;
+
+  /// Records the searches on this thread into \p trace during its lifetime
+  class Scope {
+   public:
+	explicit Scope(SearchTrace &trace) : previous_(current_) { current_ = &trace; }
+	Scope(const Scope &other) = delete;
+	Scope &operator=(const Scope &other) = delete;
+	~Scope() { current_ = previous_; }
+   private:
+	SearchTrace *previous_;
+  };
+  /// Returns the trace recording on this thread, nullptr if none
+  static SearchTrace *Current() { return current_; }
+  /// Returns the nanoseconds since the creation of the trace
+  uint64_t Now() const;
+
+  /// Records the dictionary probe of a node which began at \p start, the node \p key is a child of \p parent_key
+  void Probe(const void *key, const void *parent_key, std::string_view form, std::string role, std::string glob,
+			 const GrammarRule *rule, const DictionaryEntry *entry, uint64_t start);
+  /// Records the rules tested on the node \p key, the end of its expansion
+  void Expand(const void *key, std::vector<RuleTest> rules);
+
+  /// Returns the nanoseconds spent on each node and its descendants, indexed like nodes
+  std::vector<uint64_t> SubtreeDurations() const;
+  /// Writes {"nodes":[{"id":…,"parent":…,"depth":…,"form":…,"role":…,"glob":…,"rule":…,"entry":…,
+  /// "rules":[{"rule":…,"outcome":"applied|pruned|not applicable"},…],"start_ns":…,"duration_ns":…,"subtree_ns":…},…]}
+  void WriteJson(std::ostream &os) const;
+  /// Writes the Chrome trace event format (chrome://tracing, Perfetto), a complete event per node on a thread
+  /// per depth of the search tree, with the rest of WriteJson in the arguments
+  void WriteChromeTrace(std::ostream &os) const;
+
+ private:
+  static thread_local SearchTrace *current_;
+  std::chrono::steady_clock::time_point created_ = std::chrono::steady_clock::now();
+  /// the node of each search node, the latest one for a reused address
+  std::unordered_map<const void *, size_t> indices_;
+  /// Appends the fields of the node \p index shared by both formats, without braces
+  void AppendFields(size_t index, uint64_t subtree, std::string &out) const;
+};
+
+#endif //OSHI_CPP__SEARCHTRACE_H_
@@ -0,0 +1,72 @@
+//
+// Created by praza on 18.10.2026.
+//
+
+#include "Segmenter.h"
+#include <algorithm>
+#include <limits>
+
+namespace {
+/// Lattice costs, a word always costs less than splitting it
+constexpr size_t word_cost = 10;
+constexpr size_t rule_cost = 1;
+constexpr size_t unknown_character_cost = 100;
+}
+
+std::ostream &operator<<(std::ostream &os, const TextSegment &segment) {
+  if (segment.result.success) os << segment.result;
+  else os << segment.text << " (unknown)";
+  return os;
+}
+std::vector<TextSegment> Segmenter::Segment(std::string_view text) {
+  memo.Clear();
+  // byte offsets of the character boundaries
+  std::vector<size_t> boundaries{0};
+  for (size_t pos = 0; pos < text.size();) {
+	Utilities::DecodeUtf8(text, pos);
+	boundaries.push_back(pos);
+  }
+  size_t characters = boundaries.size() - 1;
+  // the cheapest segmentation of the first i characters ends with the word from the character from[i]
+  std::vector<size_t> cost(characters + 1, std::numeric_limits<size_t>::max());
+  std::vector<size_t> from(characters + 1);
+  std::vector<std::optional<GuessResult>> word(characters + 1);
+  cost[0] = 0;
+  for (size_t start = 0; start < characters; ++start) {
+	// an unknown character keeps the lattice connected
+	if (cost[start] + unknown_character_cost < cost[start + 1]) {
+	  cost[start + 1] = cost[start] + unknown_character_cost;
+	  from[start + 1] = start;
+	  word[start + 1].reset();
+	}
+	for (size_t end = start + 1; end <= characters && end - start <= SEGMENTER_MAX_WORD_LENGTH; ++end) {
+	  std::string span(text.substr(boundaries[start], boundaries[end] - boundaries[start]));
+	  // no longer span can be a word either
+	  if (!guesser.IsViablePrefix(span)) break;
+	  GuessResult result = guesser.Guess(span, memo);
+	  if (!result.success) continue;
+	  size_t span_cost = cost[start] + word_cost + rule_cost * result.rules.size();
+	  if (span_cost < cost[end]) {
+		cost[end] = span_cost;
+		from[end] = start;
+		word[end] = std::move(result);
+	  }
+	}
+  }
+  // follow the cheapest path back, merging runs of unknown characters
+  std::vector<TextSegment> segments;
+  for (size_t end = characters; end > 0; end = from[end]) {
+	std::string span(text.substr(boundaries[from[end]], boundaries[end] - boundaries[from[end]]));
+	if (word[end]) {
+	  segments.push_back(TextSegment{std::move(span), std::move(*word[end])});
+	} else if (!segments.empty() && !segments.back().result.success) {
+	  segments.back().text.insert(0, span);
+	  segments.back().result.original_query = segments.back().text;
+	} else {
+	  GuessResult unknown(span);
+	  segments.push_back(TextSegment{std::move(span), std::move(unknown)});
+	}
+  }
+  std::reverse(segments.begin(), segments.end());
+  return segments;
+}
@@ -0,0 +1,38 @@
+//
+// Created by praza on 18.10.2026.
+//
+
+#ifndef OSHI_CPP__SEGMENTER_H_
+#define OSHI_CPP__SEGMENTER_H_
+
+#include "GrammarFormGuesser.h"
+
+#define SEGMENTER_MAX_WORD_LENGTH 12
+
+/// A word of a segmented text
+class TextSegment {
+ public:
+  std::string text;
+  /// The derivation of the word, unsuccessful for text not found in the dictionary
+  GuessResult result;
+  friend std::ostream &operator<<(std::ostream &os, const TextSegment &segment);
+};
+
+/// Splits running text without spaces into dictionary words in their inflected forms.
+/// Every span of the text starting with a viable prefix (see GrammarFormGuesser::IsViablePrefix) and at most
+/// SEGMENTER_MAX_WORD_LENGTH characters long is deinflected, the spans form a lattice and the segmentation with
+/// the lowest cost is picked by dynamic programming. The cost prefers fewer, longer words with shorter derivations.
+class Segmenter {
+  const GrammarFormGuesser &guesser;
+  /// Shared by the overlapping spans of a text, so each span is searched once; cleared for each text, so a long
+  /// session does not keep every span ever deinflected
+  GuessMemo memo;
+ public:
+  explicit Segmenter(const GrammarFormGuesser &guesser) : guesser(guesser) {}
+  /// Returns the words of \p text in order, consecutive characters not found in the dictionary form one segment
+  std::vector<TextSegment> Segment(std::string_view text);
+  /// The states searched for the last text
+  const GuessMemo &GetMemo() const { return memo; }
+};
+
+#endif //OSHI_CPP__SEGMENTER_H_
@@ -0,0 +1,269 @@
+//
+// Created by praza on 18.10.2026.
+//
+
+#include "Server.h"
+#ifdef SERVER_EPOLL
+#include <cerrno>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace {
+/// epoll data of the listening socket and of the eventfd, connections are numbered from 1
+constexpr uint64_t listener_id = 0;
+constexpr uint64_t wake_id = UINT64_MAX;
+}
+
+Server::Server(const GrammarFormGuesser &guesser, unsigned threads, OutputFormat format)
+	: guesser_(guesser), format_(format), pool_(std::make_unique<ThreadPool>(threads)) {}
+
+#ifdef SERVER_EPOLL
+Server::~Server() {
+  pool_.reset();
+  for (auto &[id, connection] : connections_) close(connection.fd);
+  if (listen_fd_ >= 0) {
+	close(listen_fd_);
+	unlink(path_.c_str());
+  }
+  if (epoll_fd_ >= 0) close(epoll_fd_);
+  if (wake_fd_ >= 0) close(wake_fd_);
+}
+bool Server::Listen(const std::string &path, std::string &error) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+	error = "The socket path is too long";
+	return false;
+  }
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+	error = std::strerror(errno);
+	return false;
+  }
+  bool bound = bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0;
+  if (!bound && errno == EADDRINUSE) {
+	// a socket file nobody accepts on is left over from a previous run
+	int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	bool stale = connect(probe, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 && errno == ECONNREFUSED;
+	close(probe);
+	if (stale && unlink(path.c_str()) == 0)
+	  bound = bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0;
+	else errno = EADDRINUSE;
+  }
+  if (!bound || listen(fd, SOMAXCONN) != 0) {
+	error = std::strerror(errno);
+	close(fd);
+	return false;
+  }
+  listen_fd_ = fd;
+  path_ = path;
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (epoll_fd_ < 0 || wake_fd_ < 0) {
+	error = std::strerror(errno);
+	return false;
+  }
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.u64 = listener_id;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &event);
+  event.data.u64 = wake_id;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+  return true;
+}
+void Server::Run() {
+  epoll_event events[64];
+  while (!stop_.load()) {
+	int count = epoll_wait(epoll_fd_, events, 64, -1);
+	if (count < 0) {
+	  if (errno == EINTR) continue;
+	  break;
+	}
+	for (int i = 0; i < count; ++i) {
+	  uint64_t id = events[i].data.u64;
+	  if (id == listener_id) {
+		Accept();
+		continue;
+	  }
+	  if (id == wake_id) {
+		Complete();
+		continue;
+	  }
+	  // the connection may have been closed by an earlier event of this round
+	  auto it = connections_.find(id);
+	  if (it == connections_.end()) continue;
+	  Connection &connection = it->second;
+	  // a half-closed connection reads as the end of input, these mean no response can be sent anymore
+	  if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+		Close(id);
+		continue;
+	  }
+	  if ((events[i].events & EPOLLOUT) && !Send(connection)) {
+		Close(id);
+		continue;
+	  }
+	  if (events[i].events & EPOLLIN) Receive(id, connection);
+	  else Update(id, connection);
+	}
+  }
+}
+void Server::Stop() {
+  stop_.store(true);
+  // write is async-signal-safe, unlike the rest
+  uint64_t one = 1;
+  if (wake_fd_ >= 0) (void) !write(wake_fd_, &one, sizeof(one));
+}
+void Server::Accept() {
+  while (true) {
+	int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0) return;
+	uint64_t id = next_connection_id_++;
+	Connection &connection = connections_[id];
+	connection.fd = fd;
+	connection.events = EPOLLIN;
+	epoll_event event{};
+	event.events = connection.events;
+	event.data.u64 = id;
+	epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
+  }
+}
+void Server::Receive(uint64_t id, Connection &connection) {
+  char buffer[16 * 1024];
+  // the buffer always fits a whole request, more is read once the requests in it are started
+  while (connection.input.size() < SERVER_MAX_REQUEST + 4) {
+	ssize_t read_bytes = read(connection.fd, buffer, sizeof(buffer));
+	if (read_bytes > 0) {
+	  connection.input.append(buffer, read_bytes);
+	  continue;
+	}
+	if (read_bytes == 0) {
+	  connection.closing = true;
+	} else if (errno == EINTR) {
+	  continue;
+	} else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+	  Close(id);
+	  return;
+	}
+	break;
+  }
+  if (!StartRequests(id, connection)) {
+	Close(id);
+	return;
+  }
+  Update(id, connection);
+}
+bool Server::StartRequests(uint64_t id, Connection &connection) {
+  size_t offset = 0;
+  while (connection.next_request - connection.next_response < SERVER_MAX_PIPELINE
+	  && connection.input.size() - offset >= 4) {
+	uint32_t length = 0;
+	for (int i = 0; i < 4; ++i) length |= uint32_t{static_cast<unsigned char>(connection.input[offset + i])} << (8 * i);
+	if (length > SERVER_MAX_REQUEST) return false;
+	if (connection.input.size() - offset - 4 < length) break;
+	std::string query = connection.input.substr(offset + 4, length);
+	offset += 4 + length;
+	uint64_t sequence = connection.next_request++;
+	pool_->Submit([this, id, sequence, query = std::move(query)] {
+	  // the length is filled in when the record is complete
+	  std::string response(4, '\0');
+	  ResultSerializer::Append(guesser_.GuessQuery(query), format_, response);
+	  uint32_t response_length = response.size() - 4;
+	  for (int i = 0; i < 4; ++i) response[i] = static_cast<char>(response_length >> (8 * i) & 0xFF);
+	  {
+		std::lock_guard lock(completions_mutex_);
+		completions_.push_back(Completion{id, sequence, std::move(response)});
+	  }
+	  uint64_t one = 1;
+	  (void) !write(wake_fd_, &one, sizeof(one));
+	});
+  }
+  connection.input.erase(0, offset);
+  return true;
+}
+void Server::Complete() {
+  uint64_t signals;
+  (void) !read(wake_fd_, &signals, sizeof(signals));
+  std::vector<Completion> completions;
+  {
+	std::lock_guard lock(completions_mutex_);
+	completions.swap(completions_);
+  }
+  std::vector<uint64_t> ids;
+  for (auto &completion : completions) {
+	// the client may have disconnected in the meantime
+	auto it = connections_.find(completion.connection_id);
+	if (it == connections_.end()) continue;
+	it->second.finished.emplace(completion.sequence, std::move(completion.response));
+	ids.push_back(completion.connection_id);
+  }
+  for (uint64_t id : ids) {
+	auto it = connections_.find(id);
+	if (it == connections_.end()) continue;
+	Connection &connection = it->second;
+	// responses go out in the order of the requests
+	auto next = connection.finished.begin();
+	while (next != connection.finished.end() && next->first == connection.next_response) {
+	  connection.output += next->second;
+	  next = connection.finished.erase(next);
+	  ++connection.next_response;
+	}
+	// answered requests make room for the ones waiting in the buffer
+	if (!StartRequests(id, connection) || !Send(connection)) {
+	  Close(id);
+	  continue;
+	}
+	Update(id, connection);
+  }
+}
+bool Server::Send(Connection &connection) {
+  size_t sent = 0;
+  while (sent < connection.output.size()) {
+	ssize_t written = send(connection.fd, connection.output.data() + sent, connection.output.size() - sent,
+						   MSG_NOSIGNAL);
+	if (written > 0) sent += written;
+	else if (written < 0 && errno == EINTR) continue;
+	else if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+	else return false;
+  }
+  connection.output.erase(0, sent);
+  return true;
+}
+void Server::Update(uint64_t id, Connection &connection) {
+  bool answering = connection.next_request != connection.next_response;
+  if (connection.closing && !answering && connection.output.empty()) {
+	Close(id);
+	return;
+  }
+  // a client with too many unanswered requests is not read until some are answered
+  uint32_t events = 0;
+  if (!connection.closing && connection.next_request - connection.next_response < SERVER_MAX_PIPELINE)
+	events |= EPOLLIN;
+  if (!connection.output.empty()) events |= EPOLLOUT;
+  if (events == connection.events) return;
+  connection.events = events;
+  epoll_event event{};
+  event.events = events;
+  event.data.u64 = id;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, connection.fd, &event);
+}
+void Server::Close(uint64_t id) {
+  auto it = connections_.find(id);
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, it->second.fd, nullptr);
+  close(it->second.fd);
+  connections_.erase(it);
+}
+#else
+Server::~Server() = default;
+bool Server::Listen(const std::string &path, std::string &error) {
+  error = "Unix domain sockets with epoll are not available on this platform";
+  return false;
+}
+void Server::Run() {}
+void Server::Stop() {}
+#endif
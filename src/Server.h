@@ -0,0 +1,96 @@
+//
+// Created by praza on 18.10.2026.
+//
+
+#ifndef OSHI_CPP__SERVER_H_
+#define OSHI_CPP__SERVER_H_
+
+#include "GrammarFormGuesser.h"
+#include "ResultSerializer.h"
+#include "ThreadPool.h"
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#if __has_include(<sys/epoll.h>)
+#define SERVER_EPOLL
+#endif
+
+/// Largest accepted request, a client sending a longer one is disconnected
+#define SERVER_MAX_REQUEST (64 * 1024)
+/// Requests of a single client answered at the same time, more pipelined requests wait in its buffer
+#define SERVER_MAX_PIPELINE 64
+
+/// A daemon answering queries of local clients over a Unix domain socket.
+/// A request is a 32-bit little-endian byte length followed by the UTF-8 query, a response is a 32-bit little-endian
+/// byte length followed by the record of the derivation in the output format (see ResultSerializer::Append).
+/// Clients may send further requests before reading the responses, these come back in the order of the requests.
+/// One thread waits for the sockets with epoll and the queries are searched on a worker pool.
+class Server {
+ public:
+  /// \param threads Number of worker threads searching the queries
+  /// \param format Format of the records in the responses
+  Server(const GrammarFormGuesser &guesser, unsigned threads, OutputFormat format = OutputFormat::TEXT);
+  Server(const Server &other) = delete;
+  Server &operator=(const Server &other) = delete;
+  /// Closes the connections and removes the socket file
+  ~Server();
+  /// Creates the socket at \p path, replacing a stale socket file
+  /// \return false with a message in \p error if the socket cannot be created
+  bool Listen(const std::string &path, std::string &error);
+  /// Serves the clients until Stop
+  void Run();
+  /// Makes Run return, may be called from any thread or from a signal handler
+  void Stop();
+
+ private:
+  struct Connection {
+	int fd;
+	/// bytes received and not parsed into requests yet
+	std::string input;
+	/// bytes of responses not sent yet
+	std::string output;
+	/// sequence numbers of the next request and of the next response to send
+	uint64_t next_request = 0, next_response = 0;
+	/// responses finished out of order, by sequence number
+	std::map<uint64_t, std::string> finished;
+	/// the client shut down its side, the connection closes after the last response
+	bool closing = false;
+	/// the events waited for
+	uint32_t events = 0;
+  };
+  /// A response finished by a worker
+  struct Completion {
+	uint64_t connection_id, sequence;
+	std::string response;
+  };
+  const GrammarFormGuesser &guesser_;
+  OutputFormat format_;
+  std::string path_;
+  int listen_fd_ = -1, epoll_fd_ = -1;
+  /// eventfd signalled when there are completions or when stopping
+  int wake_fd_ = -1;
+  std::atomic<bool> stop_ = false;
+  std::unordered_map<uint64_t, Connection> connections_;
+  uint64_t next_connection_id_ = 1;
+  std::mutex completions_mutex_;
+  std::vector<Completion> completions_;
+  /// reset first by the destructor, so that no worker signals a closed wake_fd_
+  std::unique_ptr<ThreadPool> pool_;
+
+  void Accept();
+  /// Reads what the client sent and starts the complete requests
+  void Receive(uint64_t id, Connection &connection);
+  /// Submits the requests in the input buffer, up to SERVER_MAX_PIPELINE unanswered ones
+  /// \return false if a request is too long
+  bool StartRequests(uint64_t id, Connection &connection);
+  /// Moves the responses of the workers to their connections
+  void Complete();
+  /// Sends as much output as the socket takes
+  /// \return false if the connection failed
+  bool Send(Connection &connection);
+  /// Waits for the events the connection needs now, closes it if it is finished
+  void Update(uint64_t id, Connection &connection);
+  void Close(uint64_t id);
+};
+
+#endif //OSHI_CPP__SERVER_H_
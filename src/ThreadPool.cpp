@@ -0,0 +1,73 @@
+//
+// Created by praza on 18.10.2026.
+//
+
+#include "ThreadPool.h"
+#include <algorithm>
+
+namespace {
+/// The pool the current thread works for and its index in it, nullptr for other threads
+thread_local const ThreadPool *current_pool = nullptr;
+thread_local unsigned current_worker = 0;
+}
+
+ThreadPool::ThreadPool(unsigned threads) {
+  threads = std::max(threads, 1u);
+  for (unsigned i = 0; i < threads; ++i) workers_.push_back(std::make_unique<Worker>());
+  for (unsigned i = 0; i < threads; ++i) threads_.emplace_back(&ThreadPool::Work, this, i);
+}
+ThreadPool::~ThreadPool() {
+  {
+	std::lock_guard lock(sleep_mutex_);
+	stop_ = true;
+  }
+  wake_.notify_all();
+  for (auto &thread : threads_) thread.join();
+}
+void ThreadPool::Submit(std::function<void()> task) {
+  unsigned index = current_pool == this ? current_worker : next_worker_++ % workers_.size();
+  {
+	std::lock_guard lock(workers_[index]->mutex);
+	workers_[index]->tasks.push_back(std::move(task));
+	// counted while the task is locked away, so a thief taking it decrements only after it
+	++queued_;
+  }
+  {
+	// a worker checks queued_ and falls asleep holding the lock, so it is either awake or gets the notification
+	std::lock_guard lock(sleep_mutex_);
+  }
+  wake_.notify_one();
+}
+bool ThreadPool::RunOne(unsigned self) {
+  std::function<void()> task;
+  for (unsigned i = 0; i < workers_.size() && !task; ++i) {
+	Worker &worker = *workers_[(self + i) % workers_.size()];
+	std::lock_guard lock(worker.mutex);
+	if (worker.tasks.empty()) continue;
+	// own tasks are taken newest first as their data is likely still in cache, stolen ones oldest first
+	if (i == 0) {
+	  task = std::move(worker.tasks.back());
+	  worker.tasks.pop_back();
+	} else {
+	  task = std::move(worker.tasks.front());
+	  worker.tasks.pop_front();
+	}
+  }
+  if (!task) return false;
+  --queued_;
+  task();
+  return true;
+}
+bool ThreadPool::RunOne() {
+  return RunOne(current_pool == this ? current_worker : next_worker_++ % workers_.size());
+}
+void ThreadPool::Work(unsigned self) {
+  current_pool = this;
+  current_worker = self;
+  while (true) {
+	if (RunOne(self)) continue;
+	std::unique_lock lock(sleep_mutex_);
+	wake_.wait(lock, [this] { return stop_ || queued_ > 0; });
+	if (stop_ && queued_ == 0) return;
+  }
+}
@@ -0,0 +1,82 @@
+//
+// Created by praza on 18.10.2026.
+//
+
+#ifndef OSHI_CPP__THREADPOOL_H_
+#define OSHI_CPP__THREADPOOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <latch>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// A fixed set of worker threads executing submitted tasks.
+/// Every worker has its own task queue and runs the newest task of it first. A worker with an empty queue steals
+/// the oldest task of another worker, so uneven tasks still keep all the threads busy.
+class ThreadPool {
+ public:
+  /// \param threads Number of worker threads, at least one
+  explicit ThreadPool(unsigned threads = std::thread::hardware_concurrency());
+  ThreadPool(const ThreadPool &other) = delete;
+  ThreadPool &operator=(const ThreadPool &other) = delete;
+  /// Runs the remaining tasks and joins the workers
+  ~ThreadPool();
+
+  /// Number of worker threads
+  unsigned Size() const { return threads_.size(); }
+  /// Queues \p task for execution. A task submitted by a worker goes to the queue of that worker.
+  void Submit(std::function<void()> task);
+  /// Calls \p f(i) for every i < \p n on the pool and waits until all the calls finish.
+  /// The calling thread runs queued tasks while waiting, so ParallelFor may be nested in a task.
+  /// The first exception thrown by \p f is rethrown here.
+  template<class F>
+  void ParallelFor(size_t n, F &&f) {
+	std::latch done(static_cast<std::ptrdiff_t>(n));
+	std::exception_ptr exception;
+	std::mutex exception_mutex;
+	for (size_t i = 0; i < n; ++i) {
+	  Submit([&, i] {
+		try {
+		  f(i);
+		} catch (...) {
+		  std::lock_guard lock(exception_mutex);
+		  if (!exception) exception = std::current_exception();
+		}
+		done.count_down();
+	  });
+	}
+	// every task not taken yet can be run right here, the rest is running elsewhere
+	while (!done.try_wait() && RunOne()) {}
+	done.wait();
+	if (exception) std::rethrow_exception(exception);
+  }
+
+ private:
+  struct Worker {
+	std::mutex mutex;
+	std::deque<std::function<void()>> tasks;
+  };
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+  /// Queue for tasks submitted from outside the pool, round robin
+  std::atomic<unsigned> next_worker_ = 0;
+  /// Number of queued tasks, increased under sleep_mutex_ so that sleeping workers do not miss a task
+  std::atomic<size_t> queued_ = 0;
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+  bool stop_ = false;
+  /// Takes a task from the queue of the worker \p self (newest first) or steals one from another worker (oldest first)
+  /// \return false if all the queues are empty
+  bool RunOne(unsigned self);
+  /// Same as RunOne(self) for the current thread, which need not be a worker
+  bool RunOne();
+  void Work(unsigned self);
+};
+
+#endif //OSHI_CPP__THREADPOOL_H_
@@ -84,6 +84,49 @@ void Utilities::XmlEntityToEntityNameInPlace(std::string &xml_entity) {
   if (xml_entity.size() >= 2 && xml_entity.front() == '&' & xml_entity.back() == ';')
 	xml_entity.erase(0, 1).erase(xml_entity.size() - 1, 1);
 }
+char32_t Utilities::DecodeUtf8(std::string_view s, size_t &pos) {
+  auto lead = static_cast<unsigned char>(s[pos]);
+  size_t length = lead < 0x80 ? 1 : (lead >> 5) == 0x6 ? 2 : (lead >> 4) == 0xE ? 3 : (lead >> 3) == 0x1E ? 4 : 0;
+  if (length == 0 || pos + length > s.size()) {
+	++pos;
+	return lead;
+  }
+  char32_t c = length == 1 ? lead : lead & (0x7F >> length);
+  for (size_t i = 1; i < length; ++i) {
+	auto continuation = static_cast<unsigned char>(s[pos + i]);
+	if ((continuation & 0xC0) != 0x80) {
+	  ++pos;
+	  return lead;
+	}
+	c = (c << 6) | (continuation & 0x3F);
+  }
+  pos += length;
+  return c;
+}
+bool Utilities::DecodeValidUtf8(std::string_view s, size_t &pos, char32_t &c) {
+  auto lead = static_cast<unsigned char>(s[pos]);
+  if (lead < 0x80) {
+	c = lead;
+	++pos;
+	return true;
+  }
+  size_t length;
+  char32_t min;
+  if (lead >= 0xC2 && lead <= 0xDF) length = 2, min = 0x80, c = lead & 0x1F;
+  else if (lead >= 0xE0 && lead <= 0xEF) length = 3, min = 0x800, c = lead & 0x0F;
+  else if (lead >= 0xF0 && lead <= 0xF4) length = 4, min = 0x10000, c = lead & 0x07;
+  else return false;
+  if (s.size() - pos < length) return false;
+  for (size_t i = 1; i < length; ++i) {
+	auto byte = static_cast<unsigned char>(s[pos + i]);
+	if ((byte & 0xC0) != 0x80) return false;
+	c = c << 6 | (byte & 0x3F);
+  }
+  // overlong forms, surrogates and code points above U+10FFFF
+  if (c < min || (c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF) return false;
+  pos += length;
+  return true;
+}
 bool Utilities::AreStringsEqualCaseInsensitive(const std::string &a, const std::string &b) {
   if (a.size() != b.size()) return false;
   for (int i = 0; i < a.size(); ++i) {
@@ -6,6 +6,7 @@
 #define OSHI_CPP_GRAMMAR_CPP_UTILITIES_H_
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include "zlib.h"
 #define CHUNK 16384
@@ -26,10 +27,10 @@ class Utilities {
 
   static void XmlEntityToEntityNameInPlace(std::string &xml_entity);
 
-  template<class T>
-  static std::ostream &Join(std::vector<T> vector, std::string delimiter, std::ostream &os) {
+  template<class Range>
+  static std::ostream &Join(const Range &range, std::string_view delimiter, std::ostream &os) {
 	bool first = true;
-	for (auto &item : vector) {
+	for (auto &item : range) {
 	  if (first) first = false;
 	  else os << delimiter;
 	  os << item;
@@ -37,6 +38,14 @@ class Utilities {
 	return os;
   }
 
+  /// Decodes the UTF-8 character starting at \p pos and moves \p pos past it.
+  /// Invalid bytes decode as themselves, one byte at a time.
+  static char32_t DecodeUtf8(std::string_view s, size_t &pos);
+  /// Decodes the UTF-8 character starting at \p pos into \p c and moves \p pos past it
+  /// \return false if the bytes at \p pos are not a valid UTF-8 character (an overlong form, a surrogate, a code point
+  /// above U+10FFFF or a truncated sequence), \p pos is not moved then
+  static bool DecodeValidUtf8(std::string_view s, size_t &pos, char32_t &c);
+
   static bool AreStringsEqualCaseInsensitive(const std::string &a, const std::string &b);
   /// Converts space/tab separated globs a b c into a single glob @(a|b|c) in-place.
   /// Beware that for now, the spaces/tabs are simply replaced by |.
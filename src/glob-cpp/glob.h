@@ -17,7 +17,12 @@
 #ifndef GLOB_CPP_H
 #define GLOB_CPP_H
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <map>
 #include <string>
+#include <type_traits>
 #include <tuple>
 #include <vector>
 #include <memory>
@@ -31,6 +36,51 @@ using String = std::basic_string<charT>;
 template<class charT>
 class Automata;
 
+template<class charT>
+class State;
+
+// The mutable state of matching one string, kept apart from the automata so
+// that a compiled glob is only read while matching and can be shared by
+// several threads, each with its own context. A context is meant to live on
+// the caller's stack: it allocates only when it captures the matched strings,
+// and it can be reused for the next match.
+template<class charT>
+class MatchContext {
+ public:
+  MatchContext() = default;
+
+  explicit MatchContext(bool capture): capture_{capture} {}
+
+  bool Capture() const {
+    return capture_;
+  }
+
+  // true if the current state was reached from itself, e.g. a +(...) group
+  // that already matched once
+  bool Repeated() const {
+    return repeated_;
+  }
+
+ private:
+  friend class Automata<charT>;
+  friend class State<charT>;
+
+  void Reset(size_t num_states) {
+    repeated_ = false;
+    if (capture_) {
+      matched_strs_.resize(num_states);
+      for (auto& str : matched_strs_) {
+        str.clear();
+      }
+    }
+  }
+
+  bool capture_ = false;
+  bool repeated_ = false;
+  // the string matched by each state of the automata, only if capture_
+  std::vector<String<charT>> matched_strs_;
+};
+
 class Error: public std::exception {
  public:
   Error(const std::string& msg): msg_{msg} {}
@@ -42,6 +92,12 @@ class Error: public std::exception {
   std::string msg_;
 };
 
+// a valid glob whose automaton would have too many states
+class ComplexityError: public Error {
+ public:
+  ComplexityError(const std::string& msg): Error{msg} {}
+};
+
 enum class StateType {
   MATCH,
   FAIL,
@@ -62,10 +118,10 @@ class State {
 
   virtual ~State() = default;
 
-  virtual bool Check(const String<charT>& str, size_t pos) = 0;
+  virtual bool Check(const String<charT>& str, size_t pos) const = 0;
 
   virtual std::tuple<size_t, size_t>
-  Next(const String<charT>& str, size_t pos) = 0;
+  Next(const String<charT>& str, size_t pos, MatchContext<charT>& ctx) const = 0;
 
   StateType Type() const {
     return type_;
@@ -75,6 +131,10 @@ class State {
     return states_;
   }
 
+  const Automata<charT>& GetAutomata() const {
+    return states_;
+  }
+
   void AddNextState(size_t state_pos) {
     next_states_.push_back(state_pos);
   }
@@ -83,26 +143,43 @@ class State {
     return next_states_;
   }
 
-  const String<charT>& MatchedStr() {
-    return matched_str_;
+  const String<charT>& MatchedStr(const MatchContext<charT>& ctx) const {
+    return ctx.matched_strs_[index_];
   }
 
-  virtual void ResetState() {}
+  // true if the state may be passed without consuming any char, the state
+  // vector of such state has the next state at position 1
+  virtual bool MatchesEmpty() const {
+    return false;
+  }
 
  protected:
-  void SetMatchedStr(const String<charT>& str) {
-    matched_str_ = str;
+  void SetMatchedStr(MatchContext<charT>& ctx, const String<charT>& str) const {
+    if (ctx.capture_) {
+      ctx.matched_strs_[index_] = str;
+    }
+  }
+
+  void SetMatchedStr(MatchContext<charT>& ctx, charT c) const {
+    if (ctx.capture_) {
+      ctx.matched_strs_[index_] = c;
+    }
   }
 
-  void SetMatchedStr(charT c) {
-    matched_str_ = c;
+  void AppendMatchedStr(MatchContext<charT>& ctx, const String<charT>& str) const {
+    if (ctx.capture_) {
+      ctx.matched_strs_[index_] += str;
+    }
   }
 
  private:
+  friend class Automata<charT>;
+
   StateType type_;
   Automata<charT>& states_;
   std::vector<size_t> next_states_;
-  String<charT> matched_str_;
+  // the position in the state vector of the automata
+  size_t index_ = 0;
 };
 
 template<class charT>
@@ -111,11 +188,12 @@ class StateFail : public State<charT> {
   StateFail(Automata<charT>& states)
     : State<charT>(StateType::FAIL, states){}
 
-  bool Check(const String<charT>&, size_t) override {
+  bool Check(const String<charT>&, size_t) const override {
     return false;
   }
 
-  std::tuple<size_t, size_t> Next(const String<charT>&, size_t pos) override {
+  std::tuple<size_t, size_t> Next(const String<charT>&, size_t pos,
+      MatchContext<charT>&) const override {
     return std::tuple<size_t, size_t>(0, ++pos);
   }
 };
@@ -126,11 +204,12 @@ class StateMatch : public State<charT> {
   StateMatch(Automata<charT>& states)
     : State<charT>(StateType::MATCH, states){}
 
-  bool Check(const String<charT>&, size_t) override {
+  bool Check(const String<charT>&, size_t) const override {
     return true;
   }
 
-  std::tuple<size_t, size_t> Next(const String<charT>&, size_t pos) override {
+  std::tuple<size_t, size_t> Next(const String<charT>&, size_t pos,
+      MatchContext<charT>&) const override {
     return std::tuple<size_t, size_t>(0, ++pos);
   }
 };
@@ -185,14 +264,23 @@ class Automata {
     return states_.size();
   }
 
+  // the automata is only read, all the state of the match is in ctx
   std::tuple<bool, size_t> Exec(const String<charT>& str,
-      bool comp_end = true) {
-    auto r = ExecAux(str, comp_end);
-    ResetStates();
-    return r;
+      MatchContext<charT>& ctx, bool comp_end = true) const {
+    ctx.Reset(states_.size());
+    return ExecAux(str, ctx, comp_end);
+  }
+
+  std::tuple<bool, size_t> Exec(const String<charT>& str,
+      bool comp_end = true) const {
+    MatchContext<charT> ctx;
+    return Exec(str, ctx, comp_end);
   }
 
-  std::vector<String<charT>> GetMatchedStrings() const {
+  // the strings matched by the states in the last Exec with ctx, which must
+  // capture them
+  std::vector<String<charT>> GetMatchedStrings(
+      const MatchContext<charT>& ctx) const {
     std::vector<String<charT>> vec;
 
     for (auto& state : states_) {
@@ -200,7 +288,7 @@ class Automata {
           state->Type() == StateType::QUESTION ||
           state->Type() == StateType::GROUP ||
           state->Type() == StateType::SET) {
-        vec.push_back(state->MatchedStr());
+        vec.push_back(state->MatchedStr(ctx));
       }
     }
 
@@ -212,6 +300,7 @@ class Automata {
     size_t state_pos = states_.size();
     auto state = std::unique_ptr<State<charT>>(new T(*this,
         std::forward<Args>(args)...));
+    state->index_ = state_pos;
 
     states_.push_back(std::move(state));
     return state_pos;
@@ -220,7 +309,7 @@ class Automata {
   size_t fail_state_;
  private:
   std::tuple<bool, size_t> ExecAux(const String<charT>& str,
-      bool comp_end = true) const {
+      MatchContext<charT>& ctx, bool comp_end) const {
     size_t state_pos = 0;
     size_t str_pos = 0;
 
@@ -228,7 +317,19 @@ class Automata {
     // until the string is all consumed
     while (state_pos != fail_state_ && state_pos != match_state_
            && str_pos < str.length()) {
-      std::tie(state_pos, str_pos) = states_[state_pos]->Next(str, str_pos);
+      size_t next_state;
+      std::tie(next_state, str_pos) = states_[state_pos]->Next(str, str_pos,
+          ctx);
+      ctx.repeated_ = next_state == state_pos;
+      state_pos = next_state;
+    }
+
+    // when the string is all consumed, the states that match the empty
+    // string, as a star in the end of the glob, still lead to the next state
+    while (str_pos == str.length() && state_pos != fail_state_
+           && state_pos != match_state_
+           && states_[state_pos]->MatchesEmpty()) {
+      state_pos = states_[state_pos]->GetNextStates()[1];
     }
 
     // if comp_end is true it matches only if the automata reached the end of
@@ -246,12 +347,6 @@ class Automata {
     }
   }
 
-  void ResetStates() {
-    for (auto& state : states_) {
-      state->ResetState();
-    }
-  }
-
   std::vector<std::unique_ptr<State<charT>>> states_;
   size_t match_state_;
 
@@ -268,14 +363,14 @@ class StateChar : public State<charT> {
     : State<charT>(StateType::CHAR, states)
     , c_{c}{}
 
-  bool Check(const String<charT>& str, size_t pos) override {
+  bool Check(const String<charT>& str, size_t pos) const override {
     return(c_ == str[pos]);
   }
 
   std::tuple<size_t, size_t> Next(const String<charT>& str,
-      size_t pos) override {
+      size_t pos, MatchContext<charT>& ctx) const override {
     if (c_ == str[pos]) {
-      this->SetMatchedStr(c_);
+      this->SetMatchedStr(ctx, c_);
       return std::tuple<size_t, size_t>(GetNextStates()[0], pos + 1);
     }
 
@@ -294,14 +389,14 @@ class StateAny : public State<charT> {
   StateAny(Automata<charT>& states)
     : State<charT>(StateType::QUESTION, states){}
 
-  bool Check(const String<charT>&, size_t) override {
+  bool Check(const String<charT>&, size_t) const override {
     // as it match any char, it is always trye
     return true;
   }
 
   std::tuple<size_t, size_t> Next(const String<charT>& str,
-      size_t pos) override {
-    this->SetMatchedStr(str[pos]);
+      size_t pos, MatchContext<charT>& ctx) const override {
+    this->SetMatchedStr(ctx, str[pos]);
     // state any always match with any char
     return std::tuple<size_t, size_t>(GetNextStates()[0], pos + 1);
   }
@@ -316,20 +411,24 @@ class StateStar : public State<charT> {
   StateStar(Automata<charT>& states)
     : State<charT>(StateType::MULT, states){}
 
-  bool Check(const String<charT>&, size_t) override {
+  bool MatchesEmpty() const override {
+    return true;
+  }
+
+  bool Check(const String<charT>&, size_t) const override {
     // as it match any char, it is always trye
     return true;
   }
 
   std::tuple<size_t, size_t> Next(const String<charT>& str,
-      size_t pos) override {
+      size_t pos, MatchContext<charT>& ctx) const override {
     // next state vector from StateStar has two elements, the element 0 points
     // to the same state, and the element points to next state if the
     // conditions is satisfied
     if (GetAutomata().GetState(GetNextStates()[1]).Type() == StateType::MATCH) {
       // this case occurs when star is in the end of the glob, so the pos is
       // the end of the string, because all string is consumed
-      this->SetMatchedStr(str.substr(pos));
+      this->SetMatchedStr(ctx, str.substr(pos));
       return std::tuple<size_t, size_t>(GetNextStates()[1], str.length());
     }
 
@@ -340,7 +439,7 @@ class StateStar : public State<charT> {
     }
 
     // while the next state check is false, the string is consumed by star state
-    this->SetMatchedStr(this->MatchedStr() + str[pos]);
+    this->AppendMatchedStr(ctx, String<charT>(1, str[pos]));
     return std::tuple<size_t, size_t>(GetNextStates()[0], pos + 1);
   }
 };
@@ -404,7 +503,7 @@ class StateSet : public State<charT> {
     return false;
   }
 
-  bool Check(const String<charT>& str, size_t pos) override {
+  bool Check(const String<charT>& str, size_t pos) const override {
     if (neg_) {
       return !SetCheck(str, pos);
     }
@@ -413,9 +512,9 @@ class StateSet : public State<charT> {
   }
 
   std::tuple<size_t, size_t> Next(const String<charT>& str,
-      size_t pos) override {
+      size_t pos, MatchContext<charT>& ctx) const override {
     if (Check(str, pos)) {
-      this->SetMatchedStr(str[pos]);
+      this->SetMatchedStr(ctx, str[pos]);
       return std::tuple<size_t, size_t>(GetNextStates()[0], pos + 1);
     }
 
@@ -445,23 +544,25 @@ class StateGroup: public State<charT> {
       std::vector<std::unique_ptr<Automata<charT>>>&& automatas)
     : State<charT>(StateType::GROUP, states)
     , type_{type}
-    , automatas_{std::move(automatas)}
-    , match_one_{false} {}
+    , automatas_{std::move(automatas)} {}
 
-  void ResetState() override {
-    match_one_ = false;
+  bool MatchesEmpty() const override {
+    // ?(...) and *(...) match zero occurrences of the pattern
+    return type_ == Type::ANY || type_ == Type::STAR;
   }
 
   std::tuple<bool, size_t> BasicCheck(const String<charT>& str,
-      size_t pos) {
+      size_t pos) const {
     String<charT> str_part = str.substr(pos);
     bool r;
     size_t str_pos;
+    // the automatas of the group capture nothing
+    MatchContext<charT> ctx;
 
     // each automata is a part of a union of the group, in basic check,
     // we want find only if any automata is true
     for (auto& automata : automatas_) {
-      std::tie(r, str_pos) = automata->Exec(str_part, false);
+      std::tie(r, str_pos) = automata->Exec(str_part, ctx, false);
       if (r) {
         return std::tuple<bool, size_t>(r, pos + str_pos);
       }
@@ -470,7 +571,7 @@ class StateGroup: public State<charT> {
     return std::tuple<bool, size_t>(false, pos + str_pos);
   }
 
-  bool Check(const String<charT>& str, size_t pos) override {
+  bool Check(const String<charT>& str, size_t pos) const override {
     switch (type_) {
       case Type::BASIC:
       case Type::AT:
@@ -497,81 +598,85 @@ class StateGroup: public State<charT> {
   }
 
   std::tuple<size_t, size_t> Next(const String<charT>& str,
-      size_t pos) override {
+      size_t pos, MatchContext<charT>& ctx) const override {
     // STATE 1 -> is the next state
     // STATE 0 -> is the same state
     switch (type_) {
       // case Type::BASIC:
       // case Type::AT:
       default: {
-        return NextBasic(str, pos);
+        return NextBasic(str, pos, ctx);
         break;
       }
 
       case Type::ANY: {
-        return NextAny(str, pos);
+        return NextAny(str, pos, ctx);
         break;
       }
 
       case Type::STAR: {
-        return NextStar(str, pos);
+        return NextStar(str, pos, ctx);
         break;
       }
 
       case Type::PLUS: {
-        return NextPlus(str, pos);
+        return NextPlus(str, pos, ctx);
         break;
       }
 
       case Type::NEG: {
-        return NextNeg(str, pos);
+        return NextNeg(str, pos, ctx);
         break;
       }
     }
   }
 
-  std::tuple<size_t, size_t> NextNeg(const String<charT>& str, size_t pos) {
+  std::tuple<size_t, size_t> NextNeg(const String<charT>& str, size_t pos,
+      MatchContext<charT>& ctx) const {
     bool r;
     size_t new_pos;
     std::tie(r, new_pos) = BasicCheck(str, pos);
     if (r) {
-      this->SetMatchedStr(this->MatchedStr() + str.substr(pos, new_pos - pos));
+      this->AppendMatchedStr(ctx, str.substr(pos, new_pos - pos));
       return std::tuple<size_t, size_t>(GetAutomata().FailState(), new_pos);
     }
 
     return std::tuple<size_t, size_t>(GetNextStates()[1], pos);
   }
 
-  std::tuple<size_t, size_t> NextBasic(const String<charT>& str, size_t pos) {
+  std::tuple<size_t, size_t> NextBasic(const String<charT>& str, size_t pos,
+      MatchContext<charT>& ctx) const {
     bool r;
     size_t new_pos;
     std::tie(r, new_pos) = BasicCheck(str, pos);
     if (r) {
-      this->SetMatchedStr(this->MatchedStr() + str.substr(pos, new_pos - pos));
+      this->AppendMatchedStr(ctx, str.substr(pos, new_pos - pos));
       return std::tuple<size_t, size_t>(GetNextStates()[1], new_pos);
     }
 
     return std::tuple<size_t, size_t>(GetAutomata().FailState(), new_pos);
   }
 
-  std::tuple<size_t, size_t> NextAny(const String<charT>& str, size_t pos) {
+  std::tuple<size_t, size_t> NextAny(const String<charT>& str, size_t pos,
+      MatchContext<charT>& ctx) const {
     bool r;
     size_t new_pos;
     std::tie(r, new_pos) = BasicCheck(str, pos);
     if (r) {
-      this->SetMatchedStr(this->MatchedStr() + str.substr(pos, new_pos - pos));
+      this->AppendMatchedStr(ctx, str.substr(pos, new_pos - pos));
       return std::tuple<size_t, size_t>(GetNextStates()[1], new_pos);
     }
 
     return std::tuple<size_t, size_t>(GetNextStates()[1], pos);
   }
 
-  std::tuple<size_t, size_t> NextStar(const String<charT>& str, size_t pos) {
+  std::tuple<size_t, size_t> NextStar(const String<charT>& str, size_t pos,
+      MatchContext<charT>& ctx) const {
     bool r;
     size_t new_pos;
     std::tie(r, new_pos) = BasicCheck(str, pos);
     if (r) {
-      this->SetMatchedStr(this->MatchedStr() + str.substr(pos, new_pos - pos));
+      this->AppendMatchedStr(ctx, str.substr(pos, new_pos - pos));
       if (GetAutomata().GetState(GetNextStates()[1]).Type() == StateType::MATCH
           && new_pos == str.length()) {
         return std::tuple<size_t, size_t>(GetNextStates()[1], new_pos);
@@ -583,13 +688,13 @@ class StateGroup: public State<charT> {
     return std::tuple<size_t, size_t>(GetNextStates()[1], pos);
   }
 
-  std::tuple<size_t, size_t> NextPlus(const String<charT>& str, size_t pos) {
+  std::tuple<size_t, size_t> NextPlus(const String<charT>& str, size_t pos,
+      MatchContext<charT>& ctx) const {
     bool r;
     size_t new_pos;
     std::tie(r, new_pos) = BasicCheck(str, pos);
     if (r) {
-      match_one_ = true;
-      this->SetMatchedStr(this->MatchedStr() + str.substr(pos, new_pos - pos));
+      this->AppendMatchedStr(ctx, str.substr(pos, new_pos - pos));
 
       // if it matches and the string reached at the end, and the next
       // state is the match state, goes to next state to avoid state mistake
@@ -602,13 +707,13 @@ class StateGroup: public State<charT> {
     }
 
     // case where the next state matches and the group already matched
-    // one time -> goes to next state
+    // one time (it was reached from itself) -> goes to next state
     bool res = GetAutomata().GetState(GetNextStates()[1]).Check(str, pos);
-    if (res && match_one_) {
+    if (res && ctx.Repeated()) {
       return std::tuple<size_t, size_t>(GetNextStates()[1], pos);
     }
 
-    if (match_one_) {
+    if (ctx.Repeated()) {
       return std::tuple<size_t, size_t>(GetNextStates()[1], pos);
     } else {
       return std::tuple<size_t, size_t>(GetAutomata().FailState(), new_pos);
@@ -618,7 +723,6 @@ class StateGroup: public State<charT> {
  private:
   Type type_;
   std::vector<std::unique_ptr<Automata<charT>>> automatas_;
-  bool match_one_;
 };
 
 enum class TokenKind {
@@ -683,7 +787,7 @@ inline std::ostream& operator<<(std::ostream& stream,
 template<class charT>
 class Lexer {
  public:
-  static const char kEndOfInput = -1;
+  static constexpr charT kEndOfInput = static_cast<charT>(-1);
 
   Lexer(const String<charT>& str): str_(str), pos_{0}, c_{str[0]} {}
 
@@ -772,7 +876,7 @@ class Lexer {
 
         case '[': {
           Advance();
-          if (c_ == '!') {
+          if (c_ == '!' || c_ == '^') {
             tokens.push_back(Select(TokenKind::NEGLBRACKET));
             Advance();
           } else {
@@ -928,7 +1032,7 @@ class CharNode: public AstNode<charT> {
     visitor->VisitCharNode(this);
   }
 
-  char GetValue() const {
+  charT GetValue() const {
     return c_;
   }
 
@@ -1435,7 +1539,7 @@ class AstConsumer {
 
   void ExecChar(AstNode<charT>* node, Automata<charT>& automata) {
     CharNode<charT>* char_node = static_cast<CharNode<charT>*>(node);
-    char c = char_node->GetValue();
+    charT c = char_node->GetValue();
     NewState<StateChar<charT>>(automata, c);
   }
 
@@ -1479,7 +1583,7 @@ class AstConsumer {
   std::unique_ptr<SetItem<charT>> ProcessSetItem(AstNode<charT>* node) {
     if (node->GetType() == AstNode<charT>::Type::CHAR) {
       CharNode<charT>* char_node = static_cast<CharNode<charT>*>(node);
-      char c = char_node->GetValue();
+      charT c = char_node->GetValue();
       return std::unique_ptr<SetItem<charT>>(new SetItemChar<charT>(c));
     } else if (node->GetType() == AstNode<charT>::Type::RANGE) {
       RangeNode<charT>* range_node = static_cast<RangeNode<charT>*>(node);
@@ -1489,8 +1593,8 @@ class AstConsumer {
       CharNode<charT>* end_node = static_cast<CharNode<charT>*>(
           range_node->GetEnd());
 
-      char start_char = start_node->GetValue();
-      char end_char = end_node->GetValue();
+      charT start_char = start_node->GetValue();
+      charT end_char = end_node->GetValue();
       return std::unique_ptr<SetItem<charT>>(new SetItemRange<charT>(start_char,
           end_char));
     } else {
@@ -1597,9 +1701,9 @@ class ExtendedGlob {
     return *this;
   }
 
-  bool Exec(const String<charT>& str) {
+  bool Exec(const String<charT>& str, MatchContext<charT>& ctx) const {
     bool r;
-    std::tie(r, std::ignore) = automata_.Exec(str);
+    std::tie(r, std::ignore) = automata_.Exec(str, ctx);
     return r;
   }
 
@@ -1634,7 +1738,7 @@ class SimpleGlob {
 
     while(pos < pattern.length()) {
       size_t current_state = 0;
-      char c = pattern[pos];
+      charT c = pattern[pos];
       switch (c) {
         case '?': {
           current_state = automata_.template NewState<StateAny<charT>>();
@@ -1670,9 +1774,9 @@ class SimpleGlob {
     automata_.SetFailState(fail_state);
   }
 
-  bool Exec(const String<charT>& str) const {
+  bool Exec(const String<charT>& str, MatchContext<charT>& ctx) const {
     bool r;
-    std::tie(r, std::ignore) = automata_.Exec(str);
+    std::tie(r, std::ignore) = automata_.Exec(str, ctx);
     return r;
   }
 
@@ -1684,12 +1788,527 @@ class SimpleGlob {
   Automata<charT> automata_;
 };
 
+// compiles the AST of a glob into a DFA. The characters are split into
+// classes at the bounds of the characters and ranges of the glob, so all the
+// characters of a class take the same moves, then the classes label the moves
+// of an NFA that the subset construction turns into the table of a DFA
+template<class charT>
+class DfaCompiler {
+ public:
+  // the characters ordered as their charT values
+  using Code = long long;
+
+  using Classes = std::vector<bool>;
+
+  struct NfaState {
+    std::vector<size_t> epsilons;
+    std::vector<std::pair<Classes, size_t>> moves;
+  };
+
+  using Nfa = std::vector<NfaState>;
+
+  struct Table {
+    // the next state of each state and class, at state * classes + class
+    std::vector<uint32_t> next;
+    std::vector<bool> accepting;
+  };
+
+  // the state 0 of a table is the dead state, the state 1 the start state
+  static constexpr uint32_t dead_state = 0;
+  static constexpr uint32_t start_state = 1;
+
+  // the most states of a DFA. A glob with more is matched by its NFA, but
+  // !(...) needs the DFA of its group, so more there throw a ComplexityError
+  static constexpr size_t max_states = 1 << 12;
+
+  DfaCompiler(AstNode<charT>* root_node) {
+    CollectBounds(root_node);
+    std::sort(bounds_.begin(), bounds_.end());
+    bounds_.erase(std::unique(bounds_.begin(), bounds_.end()), bounds_.end());
+  }
+
+  size_t NumClasses() const {
+    return bounds_.size() + 1;
+  }
+
+  const std::vector<Code>& GetBounds() const {
+    return bounds_;
+  }
+
+  uint32_t ClassOf(Code c) const {
+    return std::upper_bound(bounds_.begin(), bounds_.end(), c) -
+        bounds_.begin();
+  }
+
+  // returns false if the DFA would have more than max_states states, the
+  // NFA of the glob is left in nfa then, with its start and end states
+  bool Compile(AstNode<charT>* root_node, Table& table, Nfa& nfa,
+      size_t& start, size_t& end) {
+    nfa.clear();
+    start = NewState(nfa);
+    end = ExecConcat(static_cast<GlobNode<charT>*>(root_node)->GetConcat(),
+        nfa, start);
+    if (Determinize(nfa, start, end, table)) {
+      nfa.clear();
+      return true;
+    }
+    return false;
+  }
+
+  // removes the repeated states and adds the states reached by epsilon
+  // moves, sorted. seen is false for all the states before and after
+  static void Closure(const Nfa& nfa, std::vector<size_t>& states,
+      std::vector<bool>& seen) {
+    size_t size = 0;
+    for (size_t state : states) {
+      if (!seen[state]) {
+        seen[state] = true;
+        states[size++] = state;
+      }
+    }
+    states.resize(size);
+    for (size_t i = 0; i < states.size(); ++i) {
+      for (size_t next : nfa[states[i]].epsilons) {
+        if (!seen[next]) {
+          seen[next] = true;
+          states.push_back(next);
+        }
+      }
+    }
+    for (size_t state : states) {
+      seen[state] = false;
+    }
+    std::sort(states.begin(), states.end());
+  }
+
+ private:
+  static Code CodeOf(charT c) {
+    return static_cast<Code>(c);
+  }
+
+  void CollectBounds(AstNode<charT>* node) {
+    switch (node->GetType()) {
+      case AstNode<charT>::Type::CHAR: {
+        Code c = CodeOf(static_cast<CharNode<charT>*>(node)->GetValue());
+        bounds_.push_back(c);
+        bounds_.push_back(c + 1);
+        break;
+      }
+
+      case AstNode<charT>::Type::RANGE: {
+        auto [low, high] = RangeOf(node);
+        bounds_.push_back(low);
+        bounds_.push_back(high + 1);
+        break;
+      }
+
+      case AstNode<charT>::Type::SET_ITEMS:
+        for (auto& item : static_cast<SetItemsNode<charT>*>(node)->GetItems()) {
+          CollectBounds(item.get());
+        }
+        break;
+
+      case AstNode<charT>::Type::POS_SET:
+        CollectBounds(static_cast<PositiveSetNode<charT>*>(node)->GetSet());
+        break;
+
+      case AstNode<charT>::Type::NEG_SET:
+        CollectBounds(static_cast<NegativeSetNode<charT>*>(node)->GetSet());
+        break;
+
+      case AstNode<charT>::Type::GROUP:
+        CollectBounds(static_cast<GroupNode<charT>*>(node)->GetGlob());
+        break;
+
+      case AstNode<charT>::Type::CONCAT_GLOB:
+        for (auto& item :
+            static_cast<ConcatNode<charT>*>(node)->GetBasicGlobs()) {
+          CollectBounds(item.get());
+        }
+        break;
+
+      case AstNode<charT>::Type::UNION:
+        for (auto& item : static_cast<UnionNode<charT>*>(node)->GetItems()) {
+          CollectBounds(item.get());
+        }
+        break;
+
+      case AstNode<charT>::Type::GLOB:
+        CollectBounds(static_cast<GlobNode<charT>*>(node)->GetConcat());
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  // the bounds of a range in the order of SetItemRange, which takes either
+  static std::pair<Code, Code> RangeOf(AstNode<charT>* node) {
+    RangeNode<charT>* range_node = static_cast<RangeNode<charT>*>(node);
+    Code start = CodeOf(static_cast<CharNode<charT>*>(range_node->GetStart())
+        ->GetValue());
+    Code end = CodeOf(static_cast<CharNode<charT>*>(range_node->GetEnd())
+        ->GetValue());
+    return std::minmax(start, end);
+  }
+
+  static size_t NewState(Nfa& nfa) {
+    nfa.emplace_back();
+    return nfa.size() - 1;
+  }
+
+  // adds a move from the state from on any class of classes to a new state,
+  // returns the new state
+  static size_t NewMove(Nfa& nfa, size_t from, Classes&& classes) {
+    size_t to = NewState(nfa);
+    nfa[from].moves.emplace_back(std::move(classes), to);
+    return to;
+  }
+
+  // each Exec function adds the states matching its node after the state
+  // from, and returns the state the node ends in
+
+  size_t ExecConcat(AstNode<charT>* node, Nfa& nfa, size_t from) {
+    ConcatNode<charT>* concat_node = static_cast<ConcatNode<charT>*>(node);
+    for (auto& basic_glob : concat_node->GetBasicGlobs()) {
+      from = ExecBasicGlob(basic_glob.get(), nfa, from);
+    }
+    return from;
+  }
+
+  size_t ExecBasicGlob(AstNode<charT>* node, Nfa& nfa, size_t from) {
+    switch (node->GetType()) {
+      case AstNode<charT>::Type::CHAR: {
+        Classes classes(NumClasses());
+        classes[ClassOf(CodeOf(static_cast<CharNode<charT>*>(node)
+            ->GetValue()))] = true;
+        return NewMove(nfa, from, std::move(classes));
+      }
+
+      case AstNode<charT>::Type::ANY:
+        return NewMove(nfa, from, Classes(NumClasses(), true));
+
+      case AstNode<charT>::Type::STAR: {
+        size_t loop = NewState(nfa);
+        nfa[from].epsilons.push_back(loop);
+        nfa[loop].moves.emplace_back(Classes(NumClasses(), true), loop);
+        return loop;
+      }
+
+      case AstNode<charT>::Type::POS_SET:
+        return NewMove(nfa, from, SetClasses(
+            static_cast<PositiveSetNode<charT>*>(node)->GetSet(), false));
+
+      case AstNode<charT>::Type::NEG_SET:
+        return NewMove(nfa, from, SetClasses(
+            static_cast<NegativeSetNode<charT>*>(node)->GetSet(), true));
+
+      case AstNode<charT>::Type::GROUP:
+        return ExecGroup(node, nfa, from);
+
+      default:
+        throw Error("Not valid glob item");
+    }
+  }
+
+  Classes SetClasses(AstNode<charT>* node, bool neg) {
+    Classes classes(NumClasses(), neg);
+    for (auto& item : static_cast<SetItemsNode<charT>*>(node)->GetItems()) {
+      Code low, high;
+      if (item->GetType() == AstNode<charT>::Type::CHAR) {
+        low = high = CodeOf(static_cast<CharNode<charT>*>(item.get())
+            ->GetValue());
+      } else if (item->GetType() == AstNode<charT>::Type::RANGE) {
+        std::tie(low, high) = RangeOf(item.get());
+      } else {
+        throw Error("Not valid set item");
+      }
+
+      for (uint32_t c = ClassOf(low); c <= ClassOf(high); ++c) {
+        classes[c] = !neg;
+      }
+    }
+    return classes;
+  }
+
+  size_t ExecGroup(AstNode<charT>* node, Nfa& nfa, size_t from) {
+    GroupNode<charT>* group_node = static_cast<GroupNode<charT>*>(node);
+    // the group starts in a state of its own, so it repeats none of the
+    // moves of the state from, as the loop of a star
+    size_t begin = NewState(nfa);
+    nfa[from].epsilons.push_back(begin);
+
+    switch (group_node->GetGroupType()) {
+      case GroupNode<charT>::GroupType::ANY: {
+        size_t end = ExecUnion(group_node->GetGlob(), nfa, begin);
+        nfa[begin].epsilons.push_back(end);
+        return end;
+      }
+
+      case GroupNode<charT>::GroupType::STAR: {
+        size_t end = ExecUnion(group_node->GetGlob(), nfa, begin);
+        nfa[end].epsilons.push_back(begin);
+        return begin;
+      }
+
+      case GroupNode<charT>::GroupType::PLUS: {
+        size_t end = ExecUnion(group_node->GetGlob(), nfa, begin);
+        nfa[end].epsilons.push_back(begin);
+        return end;
+      }
+
+      case GroupNode<charT>::GroupType::NEG:
+        return ExecNeg(group_node->GetGlob(), nfa, begin);
+
+      // case GroupNode<charT>::GroupType::BASIC:
+      // case GroupNode<charT>::GroupType::AT:
+      default:
+        return ExecUnion(group_node->GetGlob(), nfa, begin);
+    }
+  }
+
+  size_t ExecUnion(AstNode<charT>* node, Nfa& nfa, size_t from) {
+    UnionNode<charT>* union_node = static_cast<UnionNode<charT>*>(node);
+    size_t end = NewState(nfa);
+    for (auto& item : union_node->GetItems()) {
+      size_t begin = NewState(nfa);
+      nfa[from].epsilons.push_back(begin);
+      size_t item_end = ExecConcat(item.get(), nfa, begin);
+      nfa[item_end].epsilons.push_back(end);
+    }
+    return end;
+  }
+
+  // !(...) matches the strings the union does not match: the union is made a
+  // DFA of its own, whose states then accept the opposite and are copied in
+  size_t ExecNeg(AstNode<charT>* node, Nfa& nfa, size_t from) {
+    Nfa union_nfa;
+    size_t union_start = NewState(union_nfa);
+    size_t union_end = ExecUnion(node, union_nfa, union_start);
+    Table table;
+    if (!Determinize(union_nfa, union_start, union_end, table)) {
+      throw ComplexityError("Too many DFA states");
+    }
+
+    size_t first = nfa.size();
+    size_t end = NewState(nfa);
+    size_t num_states = table.accepting.size();
+    for (size_t state = 0; state < num_states; ++state) {
+      NewState(nfa);
+    }
+    nfa[from].epsilons.push_back(first + 1 + start_state);
+    for (size_t state = 0; state < num_states; ++state) {
+      NfaState& nfa_state = nfa[first + 1 + state];
+      if (!table.accepting[state]) {
+        nfa_state.epsilons.push_back(end);
+      }
+      for (uint32_t c = 0; c < NumClasses(); ++c) {
+        size_t to = first + 1 + table.next[state * NumClasses() + c];
+        auto it = std::find_if(nfa_state.moves.begin(), nfa_state.moves.end(),
+            [to](auto& move) { return move.second == to; });
+        if (it == nfa_state.moves.end()) {
+          it = nfa_state.moves.emplace(nfa_state.moves.end(),
+              Classes(NumClasses()), to);
+        }
+        it->first[c] = true;
+      }
+    }
+    return end;
+  }
+
+  // the subset construction, each state of the DFA is the set of the states
+  // the NFA may be in. Returns false if there are more than max_states
+  bool Determinize(const Nfa& nfa, size_t start, size_t end,
+      Table& table) const {
+    table = Table();
+    // set when there are too many states
+    bool overflow = false;
+    std::map<std::vector<size_t>, uint32_t> ids;
+    // the keys of ids by their states
+    std::vector<const std::vector<size_t>*> sets;
+    std::vector<bool> seen(nfa.size());
+    std::vector<size_t> next;
+    // the state of the set of states next, added if it is new
+    auto state_of = [&]() {
+      Closure(nfa, next, seen);
+      auto it = ids.find(next);
+      if (it != ids.end()) {
+        return it->second;
+      }
+      if (sets.size() == max_states) {
+        overflow = true;
+        return dead_state;
+      }
+      uint32_t id = sets.size();
+      sets.push_back(&ids.emplace(next, id).first->first);
+      return id;
+    };
+    state_of();
+    next.push_back(start);
+    state_of();
+
+    for (size_t i = 0; i < sets.size(); ++i) {
+      const std::vector<size_t>& states = *sets[i];
+      table.accepting.push_back(
+          std::binary_search(states.begin(), states.end(), end));
+      for (uint32_t c = 0; c < NumClasses(); ++c) {
+        next.clear();
+        for (size_t state : states) {
+          for (auto& [classes, to] : nfa[state].moves) {
+            if (classes[c]) {
+              next.push_back(to);
+            }
+          }
+        }
+        table.next.push_back(state_of());
+        if (overflow) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  std::vector<Code> bounds_;
+};
+
+// a glob compiled into the transition table of a DFA. A match takes a lookup
+// of the class of each character and of the next state, with no virtual calls,
+// no backtracking and no allocation. Unlike the automata of the extended glob,
+// a star gives back the characters the rest of the glob needs, so *a matches
+// "aba", and !(...) matches any string the group does not match. It captures
+// no strings, so it has no MatchResults. A glob whose DFA would have more than
+// DfaCompiler::max_states states, as *a followed by many ?, keeps its NFA and
+// a match steps through the sets of its states instead, which allocates
+template<class charT>
+class DfaGlob {
+  using Compiler = DfaCompiler<charT>;
+  using UChar = std::make_unsigned_t<charT>;
+
+ public:
+  DfaGlob(const String<charT>& pattern) {
+    Lexer<charT> l(pattern);
+    std::vector<Token<charT>> tokens = l.Scanner();
+    Parser<charT> p(std::move(tokens));
+    AstNodePtr<charT> ast_ptr = p.GenAst();
+
+    Compiler compiler(ast_ptr.get());
+    typename Compiler::Table table;
+    if (!compiler.Compile(ast_ptr.get(), table, nfa_, nfa_start_, nfa_end_)) {
+      table = typename Compiler::Table();
+    }
+    num_classes_ = compiler.NumClasses();
+    bounds_ = compiler.GetBounds();
+    // the characters below 256 go up in runs, 0 to 127 and -128 to -1 for a
+    // signed char, so the class only has to be searched for when a run starts
+    typename Compiler::Code previous = 0;
+    uint32_t cls = compiler.ClassOf(0);
+    for (size_t c = 0; c < byte_classes_.size(); ++c) {
+      auto code = static_cast<typename Compiler::Code>(static_cast<charT>(c));
+      if (code < previous) {
+        cls = compiler.ClassOf(code);
+      }
+      while (cls < bounds_.size() && bounds_[cls] <= code) {
+        ++cls;
+      }
+      byte_classes_[c] = cls;
+      previous = code;
+    }
+    // the table holds the rows of the next states rather than their numbers
+    rows_.reserve(table.next.size());
+    for (uint32_t state : table.next) {
+      rows_.push_back(state * num_classes_);
+    }
+    accepting_ = std::move(table.accepting);
+  }
+
+  DfaGlob(const DfaGlob&) = delete;
+  DfaGlob& operator=(DfaGlob&) = delete;
+
+  DfaGlob(DfaGlob&& glob) = default;
+  DfaGlob& operator=(DfaGlob&& glob) = default;
+
+  bool Exec(const String<charT>& str, MatchContext<charT>&) const {
+    return Match(str.data(), str.data() + str.length());
+  }
+
+  bool Match(const charT* begin, const charT* end) const {
+    if (!nfa_.empty()) {
+      return MatchNfa(begin, end);
+    }
+    uint32_t row = Compiler::start_state * num_classes_;
+    for (const charT* it = begin; it != end; ++it) {
+      row = rows_[row + ClassOf(*it)];
+      if (row == Compiler::dead_state) {
+        return false;
+      }
+    }
+    return accepting_[row / num_classes_];
+  }
+
+  // 0 if the glob is matched by its NFA
+  size_t NumStates() const {
+    return accepting_.size();
+  }
+
+  size_t NumClasses() const {
+    return num_classes_;
+  }
+
+ private:
+  uint32_t ClassOf(charT c) const {
+    if (static_cast<UChar>(c) < byte_classes_.size()) {
+      return byte_classes_[static_cast<UChar>(c)];
+    }
+    return std::upper_bound(bounds_.begin(), bounds_.end(),
+        static_cast<typename Compiler::Code>(c)) - bounds_.begin();
+  }
+
+  // the sets of the NFA states the prefixes of the string lead to
+  bool MatchNfa(const charT* begin, const charT* end) const {
+    std::vector<bool> seen(nfa_.size());
+    std::vector<size_t> states{nfa_start_}, next;
+    Compiler::Closure(nfa_, states, seen);
+    for (const charT* it = begin; it != end; ++it) {
+      uint32_t c = ClassOf(*it);
+      next.clear();
+      for (size_t state : states) {
+        for (auto& [classes, to] : nfa_[state].moves) {
+          if (classes[c]) {
+            next.push_back(to);
+          }
+        }
+      }
+      if (next.empty()) {
+        return false;
+      }
+      Compiler::Closure(nfa_, next, seen);
+      states.swap(next);
+    }
+    return std::binary_search(states.begin(), states.end(), nfa_end_);
+  }
+
+  uint32_t num_classes_;
+  std::vector<typename Compiler::Code> bounds_;
+  // the classes of the characters below 256, all of them for char
+  std::array<uint32_t, 256> byte_classes_;
+  std::vector<uint32_t> rows_;
+  std::vector<bool> accepting_;
+  // empty unless the DFA would have too many states
+  typename Compiler::Nfa nfa_;
+  size_t nfa_start_ = 0;
+  size_t nfa_end_ = 0;
+};
+
 template<class charT>
 using extended_glob = ExtendedGlob<charT>;
 
 template<class charT>
 using no_extended_glob = SimpleGlob<charT>;
 
+template<class charT>
+using dfa_glob = DfaGlob<charT>;
+
 template<class charT>
 class MatchResults;
 
@@ -1712,26 +2331,13 @@ class BasicGlob {
     return glob_.GetAutomata();
   }
 
- private:
-  bool Exec(const String<charT>& str) {
-    return glob_.Exec(str);
+  // the glob is only read, so it may be matched by several threads at once,
+  // each with its own ctx
+  bool Exec(const String<charT>& str, MatchContext<charT>& ctx) const {
+    return glob_.Exec(str, ctx);
   }
 
-  template<class charU, class globU>
-  friend bool glob_match(const String<charU>& str,
-      BasicGlob<charU, globU>& glob);
-
-  template<class charU, class globU>
-  friend bool glob_match(const charU* str, BasicGlob<charU, globU>& glob);
-
-  template<class charU, class globU>
-  friend bool glob_match(const String<charU>& str, MatchResults<charU>& res,
-      BasicGlob<charU, globU>& glob);
-
-  template<class charU, class globU>
-  friend bool glob_match(const charU* str, MatchResults<charU>& res,
-    BasicGlob<charU, globU>& glob);
-
+ private:
   globT glob_;
 };
 
@@ -1791,48 +2397,47 @@ class MatchResults {
     results_ = std::move(results);
   }
 
-  template<class charU, class globU>
-  friend bool glob_match(const String<charU>& str,
-      BasicGlob<charU, globU>& glob);
-
-  template<class charU, class globU>
-  friend bool glob_match(const charU* str, BasicGlob<charU, globU>& glob);
-
   template<class charU, class globU>
   friend bool glob_match(const String<charU>& str, MatchResults<charU>& res,
-      BasicGlob<charU, globU>& glob);
-
-  template<class charU, class globU>
-  friend bool glob_match(const charU* str, MatchResults<charU>& res,
-    BasicGlob<charU, globU>& glob);
+      const BasicGlob<charU, globU>& glob);
 
   std::vector<String<charT>> results_;
 };
 
+// the matching functions only read the glob, the state of the match is in
+// ctx, a context on the stack of the caller if none is given
+template<class charT, class globT=extended_glob<charT>>
+bool glob_match(const String<charT>& str,
+    const BasicGlob<charT, globT>& glob, MatchContext<charT>& ctx) {
+  return glob.Exec(str, ctx);
+}
+
 template<class charT, class globT=extended_glob<charT>>
-bool glob_match(const String<charT>& str, BasicGlob<charT, globT>& glob) {
-  return glob.Exec(str);
+bool glob_match(const String<charT>& str,
+    const BasicGlob<charT, globT>& glob) {
+  MatchContext<charT> ctx;
+  return glob.Exec(str, ctx);
 }
 
 template<class charT, class globT=extended_glob<charT>>
-bool glob_match(const charT* str, BasicGlob<charT, globT>& glob) {
-  return glob.Exec(str);
+bool glob_match(const charT* str, const BasicGlob<charT, globT>& glob) {
+  MatchContext<charT> ctx;
+  return glob.Exec(str, ctx);
 }
 
 template<class charT, class globT=extended_glob<charT>>
 bool glob_match(const String<charT>& str, MatchResults<charT>& res,
-    BasicGlob<charT, globT>& glob) {
-  bool r = glob.Exec(str);
-  res.SetResults(glob.GetAutomata().GetMatchedStrings());
+    const BasicGlob<charT, globT>& glob) {
+  MatchContext<charT> ctx(true);
+  bool r = glob.Exec(str, ctx);
+  res.SetResults(glob.GetAutomata().GetMatchedStrings(ctx));
   return r;
 }
 
 template<class charT, class globT=extended_glob<charT>>
 bool glob_match(const charT* str, MatchResults<charT>& res,
-    BasicGlob<charT, globT>& glob) {
-  bool r = glob.Exec(str);
-  res.SetResults(glob.GetAutomata().GetMatchedStrings());
-  return r;
+    const BasicGlob<charT, globT>& glob) {
+  return glob_match(String<charT>(str), res, glob);
 }
 
 template<class charT, class globT=extended_glob<charT>>
@@ -1842,6 +2447,10 @@ using glob = basic_glob<char, extended_glob<char>>;
 
 using wglob = basic_glob<wchar_t, extended_glob<wchar_t>>;
 
+using dfa_glob_t = basic_glob<char, dfa_glob<char>>;
+
+using wdfa_glob_t = basic_glob<wchar_t, dfa_glob<wchar_t>>;
+
 using cmatch = MatchResults<char>;
 
 using wmatch = MatchResults<wchar_t>;
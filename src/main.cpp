@@ -4,6 +4,23 @@
 #include <filesystem>
 #include "Dictionary.h"
 #include "GrammarFormGuesser.h"
+#include "Segmenter.h"
+#include "Batch.h"
+#include "ResultSerializer.h"
+#include "Server.h"
+#include "Metrics.h"
+#include "SearchTrace.h"
+#include "Replay.h"
+#include "Normalizer.h"
+#include <fstream>
+#include <sstream>
+#include <optional>
+#include <csignal>
+#include <charconv>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
 
 /// Decides whether the \p s is an exit command for a prompt (e/q/exit/quit, case insensitive)
 bool IsExitCommand(const std::string &s) {
@@ -15,11 +32,96 @@ bool IsExitCommand(const std::string &s) {
   return false;
 }
 
-bool Prompt(const GrammarFormGuesser &guesser) {
-  std::cout << "> ";
+/// Parses the whole \p text as a number into \p value
+/// \return false if \p text is not a number of the type of \p value
+template<class T>
+bool ParseNumber(std::string_view text, T &value) {
+  auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+  return error == std::errc() && end == text.data() + text.size();
+}
+
+/// Prints to stderr that \p arg is not valid and the usage of the program \p program
+void PrintUsage(const std::string &arg, const char *program) {
+  std::cerr << arg << ". Usage: " << program
+			<< " [--threads=N] [--text] [--hiragana] [--fuzzy=K] [--batch[=FILE]] [--serve=SOCKET]"
+			<< " [--metrics=FILE] [--replay=FILE [--warmup=N] [--rate=QPS]] [--trace=FILE]"
+			<< " [--trace-format=chrome|json] [--output=text|jsonl|binary]" << std::endl;
+}
+
+/// Maps the image of the keys normalized with \p key_flags (see Dictionary::ImagePath) into \p dic unless it is missing
+/// or older than the dictionary files
+bool LoadDictionaryImage(Dictionary &dic, unsigned key_flags) {
+  std::error_code error;
+  auto image_time = std::filesystem::last_write_time(Dictionary::ImagePath(key_flags), error);
+  if (error) return false;
+  for (auto source : {JMDICT_XML, JMDICT_GZ}) {
+	auto source_time = std::filesystem::last_write_time(source, error);
+	if (!error && source_time > image_time) return false;
+  }
+  return dic.LoadImage(Dictionary::ImagePath(key_flags)) && dic.KeyFlags() == key_flags;
+}
+
+/// The daemon stopped by SIGINT and SIGTERM
+Server *running_server = nullptr;
+void StopServer(int) {
+  if (running_server != nullptr) running_server->Stop();
+}
+
+/// Writes \p result to stdout in a machine-readable \p format
+void PrintSerialized(const GuessResult &result, OutputFormat format) {
+  std::string out;
+  ResultSerializer::Append(result, format, out);
+  std::cout.write(out.data(), static_cast<std::streamsize>(out.size()));
   std::cout.flush();
-  std::string input;
-  std::getline(std::cin, input);
+}
+
+/// The derivations in \p all except the first one
+Generator<GuessResult> SkipFirst(Generator<GuessResult> all) {
+  all.Next();
+  for (auto &result : all) co_yield std::move(result);
+}
+
+/// Where and how the search of each query is traced (--trace), nothing is traced if the path is empty
+struct TraceOutput {
+  std::string path;
+  /// the Chrome trace event format, otherwise the plain JSON of SearchTrace::WriteJson
+  bool chrome = true;
+};
+
+/// Writes \p trace of the last query to the file of \p output, replacing the previous one
+void WriteTrace(const SearchTrace &trace, const TraceOutput &output) {
+  std::ofstream file(output.path);
+  if (output.chrome) trace.WriteChromeTrace(file);
+  else trace.WriteJson(file);
+  if (!file) std::cerr << "Cannot write the trace to " << output.path << std::endl;
+}
+
+/// Prints that \p input has no derivation, and its closest derivation within \p fuzzy_distance edits if any
+void PrintNoResult(const GrammarFormGuesser &guesser, const std::string &input, unsigned fuzzy_distance) {
+  std::cout << "No result :(" << std::endl;
+  if (fuzzy_distance == 0) return;
+  auto result = guesser.GuessFuzzy(input, fuzzy_distance);
+  if (result.success)
+	std::cout << "Did you mean (" << result.distance << (result.distance == 1 ? " edit" : " edits") << "):"
+			  << std::endl << result << std::endl;
+}
+
+/// Reads and answers a single query
+/// \param pool If not nullptr, the first derivation is searched for in parallel
+/// \param segmenter If not nullptr, the query is running text split into words
+/// \param alternatives The remaining derivations of the previous query, printed one by one by the :more command
+/// \param format Format of the derivations. The prompt and the messages are always text, on stderr unless the format
+/// is TEXT, so that stdout carries only the records
+/// \param fuzzy_distance Edits a dictionary key may differ by from the derived form, when there is no exact derivation
+/// \param trace_output The search for the first derivation is traced there
+bool Prompt(const GrammarFormGuesser &guesser, ThreadPool *pool, Segmenter *segmenter, OutputFormat format,
+			unsigned fuzzy_distance, const TraceOutput &trace_output,
+			Generator<GuessResult> &alternatives) {
+  std::ostream &out = format == OutputFormat::TEXT ? std::cout : std::cerr;
+  out << "> ";
+  out.flush();
+  std::string line, input;
+  std::getline(std::cin, line);
 
   // handle cin errors
   if (std::cin.bad()) {
@@ -30,33 +132,233 @@ bool Prompt(const GrammarFormGuesser &guesser) {
 	std::cerr << "EOF exiting." << std::endl;
 	return false;
   }
+  // normalized like the dictionary keys before anything else
+  if (!Normalizer::Normalize(line, input, guesser.GetDictionary().QueryFlags())) {
+	out << "The query is not valid UTF-8." << std::endl;
+	return true;
+  }
 
   if (IsExitCommand(input)) return false;
-  auto result = guesser.Guess(input);
-  if (result.success) std::cout << result << std::endl;
-  else std::cout << "No result :(" << std::endl;
+  if (input == ":stats") {
+	Metrics::WriteText(out);
+	return true;
+  }
+  if (input.starts_with(":complete ")) {
+	auto completions = guesser.GetDictionary().Complete(input.substr(std::string(":complete ").size()));
+	if (completions.empty()) out << "No completions." << std::endl;
+	for (auto &completion : completions) out << completion.key << ": " << *completion.entry << std::endl;
+	return true;
+  }
+  if (input.starts_with(":glob ")) {
+	// one more to tell whether there are more
+	constexpr size_t shown = 20;
+	std::vector<Dictionary::Completion> matches;
+	auto status = guesser.GetDictionary().GlobSearch(input.substr(std::string(":glob ").size()), shown + 1, matches);
+	if (status == Dictionary::GlobStatus::INVALID) {
+	  out << "The pattern is not a valid glob." << std::endl;
+	  return true;
+	}
+	if (status == Dictionary::GlobStatus::TOO_COMPLEX) {
+	  out << "The pattern is too complex." << std::endl;
+	  return true;
+	}
+	if (matches.empty()) out << "No matches." << std::endl;
+	for (size_t i = 0; i < std::min(matches.size(), shown); ++i)
+	  out << matches[i].key << ": " << *matches[i].entry << std::endl;
+	if (matches.size() > shown) out << "More matches not shown." << std::endl;
+	return true;
+  }
+  if (input.starts_with(":en ")) {
+	auto matches = guesser.GetDictionary().GlossSearch(input.substr(std::string(":en ").size()), 10);
+	if (matches.empty()) out << "No matches." << std::endl;
+	for (auto &match : matches) out << *match.entry << std::endl;
+	return true;
+  }
+  if (input.starts_with(":kanji ")) {
+	// CHARS required, +CHARS any of them, -CHARS none of them
+	std::string all, any, none;
+	std::istringstream terms(input.substr(std::string(":kanji ").size()));
+	for (std::string term; terms >> term;) {
+	  if (term.starts_with('+')) any += term.substr(1);
+	  else if (term.starts_with('-')) none += term.substr(1);
+	  else all += term;
+	}
+	auto &dictionary = guesser.GetDictionary();
+	auto entries = dictionary.KanjiSearch(all, any, none);
+	constexpr size_t shown = 20;
+	if (entries.empty()) out << "No matches." << std::endl;
+	size_t printed = 0;
+	entries.ForEach([&](uint32_t index) {
+	  out << dictionary.Entry(index) << std::endl;
+	  return ++printed < shown;
+	});
+	if (size_t count = entries.Cardinality(); count > shown)
+	  out << count - shown << " more matches not shown." << std::endl;
+	return true;
+  }
+  if (input == ":more") {
+	auto alternative = alternatives.Next();
+	if (!alternative) out << "No more results." << std::endl;
+	else if (format == OutputFormat::TEXT) out << *alternative << std::endl;
+	else PrintSerialized(*alternative, format);
+	return true;
+  }
+  if (segmenter != nullptr) {
+	auto segments = segmenter->Segment(input);
+	for (size_t i = 0; i < segments.size(); ++i) out << (i == 0 ? "" : " | ") << segments[i].text;
+	out << std::endl;
+	for (auto &segment : segments) out << segment << std::endl;
+	return true;
+  }
+  if (pool != nullptr) {
+	auto result = guesser.Guess(input, *pool);
+	if (format != OutputFormat::TEXT) PrintSerialized(result, format);
+	else if (result.success) out << result << std::endl;
+	else PrintNoResult(guesser, input, fuzzy_distance);
+	// the other derivations are only searched for by :more
+	alternatives = SkipFirst(guesser.GuessAll(input));
+	return true;
+  }
+  alternatives = guesser.GuessAll(input);
+  std::optional<GuessResult> result;
+  if (!trace_output.path.empty()) {
+	SearchTrace trace;
+	{
+	  SearchTrace::Scope scope(trace);
+	  result = alternatives.Next();
+	}
+	WriteTrace(trace, trace_output);
+  } else {
+	result = alternatives.Next();
+  }
+  if (format != OutputFormat::TEXT) {
+	// a record of the query without derivation
+	if (!result) result = GuessResult(input);
+	PrintSerialized(*result, format);
+  } else if (result) out << *result << std::endl;
+  else PrintNoResult(guesser, input, fuzzy_distance);
   return true;
 }
 
-int main() {
-  Grammar gr;
-  gr.LoadGrammarRules();
-
-  // Make sure JMDICT_XML exists, otherwise try extracting JMDICT_GZ
-  if (!std::filesystem::exists(JMDICT_XML)) {
-	std::cout << "Decompressing dictionary..." << std::endl;
-	if (!Dictionary::InflateDictionary()) {
-	  std::cerr << "An error occurred while decompressing the dictionary file. Make sure the file " << JMDICT_GZ
-				<< " exists in the current directory." << std::endl;
+int main(int argc, char *argv[]) {
+  // --threads=N searches each query on N threads, --text splits each query into words,
+  // --batch[=FILE] answers each line of FILE or stdin without prompts, on N threads or all cores,
+  // --output=text|jsonl|binary selects the format of the derivations,
+  // --serve=SOCKET answers clients of a Unix domain socket on N threads or all cores until interrupted,
+  // --metrics=FILE writes the metrics in the Prometheus format to FILE on SIGUSR1 and at exit (stderr on SIGUSR1 without it),
+  // --trace=FILE writes the search tree of each query to FILE in the Chrome trace event format, or in plain JSON
+  // with --trace-format=json, if built with OSHI_TRACE,
+  // --hiragana converts katakana in the queries and the dictionary keys to hiragana, with an image of its own,
+  // --fuzzy=K shows the closest derivation within K edits of a dictionary key if there is none (0 never, 1 by default),
+  // --replay=FILE answers each line of FILE once on N threads (one by default) and reports the latency percentiles,
+  // throughput and the slowest queries, after --warmup=N unmeasured queries and at most --rate=QPS queries per second
+  unsigned threads = 0;
+  OutputFormat format = OutputFormat::TEXT;
+  bool text = false;
+  unsigned key_flags = Normalizer::FOLD_WIDTH;
+  unsigned fuzzy_distance = 1;
+  bool batch = false;
+  std::string batch_path;
+  std::string socket_path;
+  std::string replay_path;
+  Replay::Options replay_options;
+  static std::string metrics_path;
+  TraceOutput trace_output;
+  for (int i = 1; i < argc; ++i) {
+	std::string arg = argv[i];
+	std::string_view value = std::string_view(arg).substr(arg.find('=') + 1);
+	bool valid = true;
+	if (arg.starts_with("--threads=")) {
+	  valid = ParseNumber(value, threads);
+	} else if (arg == "--text") {
+	  text = true;
+	} else if (arg.starts_with("--fuzzy=")) {
+	  valid = ParseNumber(value, fuzzy_distance);
+	} else if (arg == "--hiragana") {
+	  key_flags |= Normalizer::KATAKANA_TO_HIRAGANA;
+	} else if (arg == "--batch" || arg.starts_with("--batch=")) {
+	  batch = true;
+	  if (arg != "--batch") batch_path = arg.substr(std::string("--batch=").size());
+	} else if (arg.starts_with("--serve=")) {
+	  socket_path = arg.substr(std::string("--serve=").size());
+	} else if (arg.starts_with("--replay=")) {
+	  replay_path = arg.substr(std::string("--replay=").size());
+	} else if (arg.starts_with("--warmup=")) {
+	  valid = ParseNumber(value, replay_options.warmup);
+	} else if (arg.starts_with("--rate=")) {
+	  valid = ParseNumber(value, replay_options.rate) && replay_options.rate >= 0;
+	} else if (arg.starts_with("--metrics=")) {
+	  metrics_path = arg.substr(std::string("--metrics=").size());
+	} else if (arg.starts_with("--trace=")) {
+	  trace_output.path = arg.substr(std::string("--trace=").size());
+	} else if (arg == "--trace-format=json" || arg == "--trace-format=chrome") {
+	  trace_output.chrome = arg == "--trace-format=chrome";
+	} else if (arg.starts_with("--output=")) {
+	  if (!ResultSerializer::ParseFormat(arg.substr(std::string("--output=").size()), format)) {
+		std::cerr << "Unknown output format " << arg << ", use text, jsonl or binary" << std::endl;
+		return 1;
+	  }
+	} else {
+	  PrintUsage("Unknown argument " + arg, argv[0]);
+	  return 1;
+	}
+	if (!valid) {
+	  PrintUsage("Invalid number in " + arg, argv[0]);
 	  return 1;
 	}
   }
+  if (batch && text) {
+	std::cerr << "--text cannot be combined with --batch" << std::endl;
+	return 1;
+  }
+  if (text && format != OutputFormat::TEXT) {
+	std::cerr << "--text prints the segmentation as text, it cannot be combined with --output=jsonl or binary"
+			  << std::endl;
+	return 1;
+  }
+#ifndef OSHI_TRACE
+  if (!trace_output.path.empty()) {
+	std::cerr << "--trace needs a build with tracing, configure with -DOSHI_TRACE=ON" << std::endl;
+	return 1;
+  }
+#endif
+  if (!trace_output.path.empty() && (batch || text || !socket_path.empty() || threads > 1)) {
+	std::cerr << "--trace traces the sequential search of the prompt, it cannot be combined with --batch, --text,"
+			  << " --serve or --threads" << std::endl;
+	return 1;
+  }
+  if (!socket_path.empty() && (batch || text)) {
+	std::cerr << "--serve cannot be combined with --batch or --text" << std::endl;
+	return 1;
+  }
+  if (!replay_path.empty() && (batch || text || !socket_path.empty() || !trace_output.path.empty())) {
+	std::cerr << "--replay cannot be combined with --batch, --text, --serve or --trace" << std::endl;
+	return 1;
+  }
+  // before any thread is started, so that the signal goes to the dumping thread
+  Metrics::DumpOnSignal(metrics_path);
+  if (!metrics_path.empty()) std::atexit([] { Metrics::Dump(metrics_path); });
+  // in batch and replay modes and with a machine-readable format stdout carries only the results
+  std::ostream &status = batch || !replay_path.empty() || format != OutputFormat::TEXT ? std::cerr : std::cout;
+
+  Grammar gr;
+  gr.LoadGrammarRules();
 
   Dictionary dic;
-  {
+  if (!LoadDictionaryImage(dic, key_flags)) {
+	// Make sure JMDICT_XML exists, otherwise try extracting JMDICT_GZ
+	if (!std::filesystem::exists(JMDICT_XML)) {
+	  status << "Decompressing dictionary..." << std::endl;
+	  if (!Dictionary::InflateDictionary()) {
+		std::cerr << "An error occurred while decompressing the dictionary file. Make sure the file " << JMDICT_GZ
+				  << " exists in the current directory." << std::endl;
+		return 1;
+	  }
+	}
+
 	// Parse JMDICT_XML into pugi::xml_document
 	std::unique_ptr<pugi::xml_document> doc = std::make_unique<pugi::xml_document>(pugi::xml_document());
-	std::cout << "Parsing dictionary..." << std::endl;
+	status << "Parsing dictionary..." << std::endl;
 	pugi::xml_parse_result result = doc->load_file(JMDICT_XML);
 	if (result.status != pugi::status_ok) {
 	  std::cerr << "An error occurred during parsing of the dictionary file " << JMDICT_XML << ". Error description: "
@@ -64,12 +366,58 @@ int main() {
 	  return 1;
 	}
 	// move the XML document into a Dictionary class instance
-	dic.LoadDictionary(*doc);
+	dic.LoadDictionary(*doc, key_flags);
+	// the next start maps the image instead of parsing
+	auto image_path = Dictionary::ImagePath(key_flags);
+	if (!dic.SaveImage(image_path)) std::cerr << "Cannot write the dictionary image " << image_path << std::endl;
   }
   bool loop = true;
   GrammarFormGuesser guesser(std::move(gr), std::move(dic));
+#ifdef _WIN32
+  // binary records must not get their newlines translated
+  if (format == OutputFormat::BINARY) _setmode(_fileno(stdout), _O_BINARY);
+#endif
+  if (batch) {
+	if (!Batch::Run(guesser, batch_path, threads > 0 ? threads : std::thread::hardware_concurrency(), stdout,
+					format)) {
+	  std::cerr << "Cannot read " << batch_path << std::endl;
+	  return 1;
+	}
+	return 0;
+  }
+  if (!replay_path.empty()) {
+	std::vector<std::string> queries;
+	if (!Replay::ReadLog(replay_path, queries)) {
+	  std::cerr << "Cannot read " << replay_path << std::endl;
+	  return 1;
+	}
+	replay_options.threads = threads > 0 ? threads : 1;
+	Replay::Run(guesser, queries, replay_options).Write(std::cout);
+	return 0;
+  }
+  if (!socket_path.empty()) {
+	Server server(guesser, threads > 0 ? threads : std::thread::hardware_concurrency(), format);
+	std::string error;
+	if (!server.Listen(socket_path, error)) {
+	  std::cerr << "Cannot listen on " << socket_path << ": " << error << std::endl;
+	  return 1;
+	}
+	running_server = &server;
+	std::signal(SIGINT, StopServer);
+	std::signal(SIGTERM, StopServer);
+	status << "Listening on " << socket_path << std::endl;
+	server.Run();
+	running_server = nullptr;
+	return 0;
+  }
+  std::unique_ptr<ThreadPool> pool;
+  if (threads > 1) pool = std::make_unique<ThreadPool>(threads);
+  std::unique_ptr<Segmenter> segmenter;
+  if (text) segmenter = std::make_unique<Segmenter>(guesser);
+  Generator<GuessResult> alternatives;
   while (loop) {
-	loop = Prompt(guesser);
+	loop = Prompt(guesser, pool.get(), segmenter.get(), format, fuzzy_distance, trace_output,
+				  alternatives);
   }
   return 0;
 }
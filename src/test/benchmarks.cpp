@@ -0,0 +1,316 @@
+//
+// Created by praza on 18.10.2026.
+//
+
+#include <benchmark/benchmark.h>
+#include "Grammar.h"
+#include "Dictionary.h"
+#include "GrammarFormGuesser.h"
+#include "Normalizer.h"
+#include "pugixml.hpp"
+#include "glob-cpp/glob.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/// The JMdict subset bundled in test/data, copied next to the benchmarks by CMake
+#define BENCHMARK_DICTIONARY "JMdict_subset.xml"
+
+namespace {
+/// Allocations made by operator new in the whole process
+std::atomic<uint64_t> allocations{0};
+
+void *CountedAllocation(size_t size, size_t alignment = 0) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  // aligned_alloc requires the size to be a multiple of the alignment
+  void *p = alignment == 0 ? std::malloc(size == 0 ? 1 : size)
+						   : std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+}
+
+void *operator new(size_t size) { return CountedAllocation(size); }
+void *operator new[](size_t size) { return CountedAllocation(size); }
+void *operator new(size_t size, std::align_val_t alignment) {
+  return CountedAllocation(size, static_cast<size_t>(alignment));
+}
+void *operator new[](size_t size, std::align_val_t alignment) {
+  return CountedAllocation(size, static_cast<size_t>(alignment));
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { std::free(p); }
+
+namespace {
+/// Reports the allocations per iteration of the benchmark loop it outlives as the "allocs" counter
+class AllocationCounter {
+ public:
+  explicit AllocationCounter(benchmark::State &state)
+	  : state_(state), start_(allocations.load(std::memory_order_relaxed)) {}
+  AllocationCounter(const AllocationCounter &other) = delete;
+  AllocationCounter &operator=(const AllocationCounter &other) = delete;
+  ~AllocationCounter() {
+	double count = static_cast<double>(allocations.load(std::memory_order_relaxed) - start_);
+	state_.counters["allocs"] = benchmark::Counter(count, benchmark::Counter::kAvgIterations);
+  }
+ private:
+  benchmark::State &state_;
+  uint64_t start_;
+};
+
+/// Conjugated forms searched by the Guess benchmarks: the README examples, common conjugations of the verbs and
+/// adjectives of the subset, and forms without a derivation
+const std::vector<std::string> corpus{
+	"書いてた", "良くなかった", "知っていた", "書く", "書かない", "書きました", "書かれる", "書かせる", "書ける", "書こう",
+	"書いています", "書かなかった", "食べた", "食べられる", "食べさせられる", "食べませんでした", "見ている", "読んだ",
+	"読まれた", "行った", "行きます", "来た", "来られる", "良くない", "話して", "飲みたい", "待っている", "買わない",
+	"遊んだ", "死ねば", "泳げる", "高かった", "分からない", "作られた", "勉強した", "xyz", "書道", "たべた",
+};
+/// Dictionary writings of the subset and strings that are not
+const std::vector<std::string> hits{"書く", "良い", "知る", "食べる", "見る", "読む", "行く", "来る", "する", "学校",
+									"漢字", "今日", "話す", "高い", "静か", "作る"};
+const std::vector<std::string> misses{"書いた", "良くない", "知って", "食べない", "xyz", "", "書道家", "わからない",
+									  "高すぎる", "つくれ", "きょうか", "しずかだ", "漢", "学", "読ま", "来い"};
+/// Triples the grammar rules are matched with and applied to, the first step of the searches of the corpus
+const std::vector<GrammarTriple> triples{
+	{"書いてた", "*", ""}, {"良くなかった", "*", ""}, {"知っていた", "*", ""}, {"書いている", "@(v1)", "continuous"},
+	{"食べさせられる", "*", ""}, {"良くない", "@(adj-i)", "plain"}, {"読んだ", "*", ""}, {"来られる", "*", ""},
+};
+
+/// The inputs shared by the benchmarks, loaded once
+struct Fixture {
+  pugi::xml_document doc;
+  size_t xml_size = std::filesystem::file_size(BENCHMARK_DICTIONARY);
+  Grammar gr;
+  Dictionary dic;
+  std::string image_path = (std::filesystem::temp_directory_path() / "oshi_benchmarks.oshi").string();
+  std::unique_ptr<GrammarFormGuesser> guesser;
+  Fixture() {
+	if (!doc.load_file(BENCHMARK_DICTIONARY)) throw std::runtime_error("Cannot parse " BENCHMARK_DICTIONARY);
+	gr.LoadGrammarRules();
+	dic.LoadDictionary(doc);
+	if (!dic.SaveImage(image_path)) throw std::runtime_error("Cannot write " + image_path);
+	Grammar guesser_gr = gr;
+	Dictionary guesser_dic;
+	guesser_dic.LoadDictionary(doc);
+	guesser = std::make_unique<GrammarFormGuesser>(std::move(guesser_gr), std::move(guesser_dic));
+  }
+  ~Fixture() { std::filesystem::remove(image_path); }
+};
+Fixture &GetFixture() {
+  static Fixture fixture;
+  return fixture;
+}
+
+void BM_LoadDictionary(benchmark::State &state) {
+  auto &fixture = GetFixture();
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+	Dictionary dic;
+	dic.LoadDictionary(fixture.doc);
+	benchmark::DoNotOptimize(dic);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * fixture.xml_size));
+}
+BENCHMARK(BM_LoadDictionary);
+
+/// Mapping the saved image, which replaced building the lookup map at every start
+void BM_LoadImage(benchmark::State &state) {
+  auto &fixture = GetFixture();
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+	Dictionary dic;
+	if (!dic.LoadImage(fixture.image_path)) state.SkipWithError("Cannot load the image");
+	benchmark::DoNotOptimize(dic);
+  }
+}
+BENCHMARK(BM_LoadImage);
+
+void BM_Query(benchmark::State &state, const std::vector<std::string> &keys) {
+  auto &dic = GetFixture().dic;
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+	for (auto &key : keys) benchmark::DoNotOptimize(dic.Query(key));
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * keys.size()));
+}
+BENCHMARK_CAPTURE(BM_Query, hit, hits);
+BENCHMARK_CAPTURE(BM_Query, miss, misses);
+
+/// Prefixes of a single kana, of a kanji and of no key
+void BM_Complete(benchmark::State &state) {
+  auto &dic = GetFixture().dic;
+  std::vector<std::string> prefixes{"か", "た", "し", "書", "学校", "x"};
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+	for (auto &prefix : prefixes) benchmark::DoNotOptimize(dic.Complete(prefix));
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * prefixes.size()));
+}
+BENCHMARK(BM_Complete);
+
+/// A pattern with a literal prefix, with inner and final literals, with a set and without a literal
+void BM_GlobSearch(benchmark::State &state) {
+  auto &dic = GetFixture().dic;
+  std::vector<std::string> patterns{"書*", "*べ*", "?く", "[書読]*", "*"};
+  std::vector<Dictionary::Completion> matches;
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+	for (auto &pattern : patterns) benchmark::DoNotOptimize(dic.GlobSearch(pattern, 20, matches));
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * patterns.size()));
+}
+BENCHMARK(BM_GlobSearch);
+
+/// A rare word, a common one, two words and a phrase
+void BM_GlossSearch(benchmark::State &state) {
+  auto &dic = GetFixture().dic;
+  std::vector<std::string> queries{"calligraphy", "to", "write paint", "\"to write\""};
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+	for (auto &query : queries) benchmark::DoNotOptimize(dic.GlossSearch(query, 10));
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * queries.size()));
+}
+BENCHMARK(BM_GlossSearch);
+
+/// A rare pair, a common kanji with a difference, and a union
+void BM_KanjiSearch(benchmark::State &state) {
+  auto &dic = GetFixture().dic;
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+	benchmark::DoNotOptimize(dic.KanjiSearch("書道"));
+	benchmark::DoNotOptimize(dic.KanjiSearch("る", {}, "見"));
+	benchmark::DoNotOptimize(dic.KanjiSearch({}, "書読行"));
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * 3));
+}
+BENCHMARK(BM_KanjiSearch);
+
+/// The misses one edit away from a key and those that are not
+void BM_FuzzyQuery(benchmark::State &state) {
+  auto &dic = GetFixture().dic;
+  PosMask any_pos;
+  any_pos.set();
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+	for (auto &key : misses) benchmark::DoNotOptimize(dic.FuzzyQuery(key, 1, any_pos, 1));
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * misses.size()));
+}
+BENCHMARK(BM_FuzzyQuery);
+
+void BM_IsApplicable(benchmark::State &state) {
+  auto &gr = GetFixture().gr;
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+	for (auto &triple : triples) {
+	  for (auto &rule : gr.rules) benchmark::DoNotOptimize(rule.IsApplicable(triple));
+	}
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * triples.size() * gr.rules.size()));
+}
+BENCHMARK(BM_IsApplicable);
+
+/// The forms of the triples with the role of the first step and with the target role of every rule, items are rules
+void BM_ForEachApplicable(benchmark::State &state) {
+  auto &gr = GetFixture().gr;
+  std::vector<unsigned> role_ids{Grammar::any_role_id};
+  for (auto &rule : gr.rules) role_ids.push_back(rule.target_id);
+  std::sort(role_ids.begin(), role_ids.end());
+  role_ids.erase(std::unique(role_ids.begin(), role_ids.end()), role_ids.end());
+  size_t rules = 0;
+  for (unsigned role_id : role_ids) rules += gr.RuleCount(role_id);
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+	for (auto &triple : triples) {
+	  for (unsigned role_id : role_ids)
+		gr.ForEachApplicable(triple.form, role_id, Grammar::any_glob_id,
+							 [](const GrammarRule &rule) { benchmark::DoNotOptimize(&rule); });
+	}
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * triples.size() * rules));
+}
+BENCHMARK(BM_ForEachApplicable);
+
+/// The POS globs of the rules matched with the POS of the rules, by the automata or by the DFA of the globs
+template<class Glob>
+void BM_GlobMatch(benchmark::State &state) {
+  auto &gr = GetFixture().gr;
+  std::vector<std::string> patterns{"@(v5*|v1)", "@(adj-i)", "@(v5r|v5r-i|v5aru)", "@(n|vs|adj-na)", "*"};
+  std::vector<std::unique_ptr<const glob::basic_glob<char, Glob>>> globs;
+  for (auto &pattern : patterns) globs.push_back(std::make_unique<const glob::basic_glob<char, Glob>>(pattern));
+  glob::MatchContext<char> context;
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+	for (auto &g : globs) {
+	  for (auto &rule : gr.rules) benchmark::DoNotOptimize(glob::glob_match(rule.pos, *g, context));
+	}
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * globs.size() * gr.rules.size()));
+}
+BENCHMARK_TEMPLATE(BM_GlobMatch, glob::extended_glob<char>);
+BENCHMARK_TEMPLATE(BM_GlobMatch, glob::dfa_glob<char>);
+
+void BM_Apply(benchmark::State &state) {
+  auto &gr = GetFixture().gr;
+  std::vector<std::pair<const GrammarRule *, const GrammarTriple *>> applicable;
+  for (auto &triple : triples) {
+	for (auto &rule : gr.rules) {
+	  if (rule.IsApplicable(triple)) applicable.emplace_back(&rule, &triple);
+	}
+  }
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+	for (auto [rule, triple] : applicable) benchmark::DoNotOptimize(rule->Apply(*triple));
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * applicable.size()));
+}
+BENCHMARK(BM_Apply);
+
+void BM_Normalize(benchmark::State &state) {
+  std::string out;
+  size_t bytes = 0;
+  for (auto &query : corpus) bytes += query.size();
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+	for (auto &query : corpus) benchmark::DoNotOptimize(Normalizer::Normalize(query, out));
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * corpus.size()));
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * bytes));
+}
+BENCHMARK(BM_Normalize);
+
+void BM_Guess(benchmark::State &state) {
+  auto &guesser = *GetFixture().guesser;
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+	for (auto &query : corpus) benchmark::DoNotOptimize(guesser.Guess(query));
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * corpus.size()));
+}
+BENCHMARK(BM_Guess);
+
+/// The README examples alone, the first queries of the corpus
+void BM_GuessQuery(benchmark::State &state) {
+  auto &guesser = *GetFixture().guesser;
+  auto &query = corpus[state.range(0)];
+  state.SetLabel(query);
+  AllocationCounter counter(state);
+  for (auto _ : state) benchmark::DoNotOptimize(guesser.Guess(query));
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GuessQuery)->DenseRange(0, 2);
+}
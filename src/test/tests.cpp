@@ -1,6 +1,57 @@
 #include <gtest/gtest.h>
 #include "Grammar.h"
+#include "GrammarFormGuesser.h"
+#include "Segmenter.h"
+#include "Batch.h"
+#include "ResultSerializer.h"
+#include "BoundedQueue.h"
+#include "Server.h"
+#include "Metrics.h"
+#include "SearchTrace.h"
+#include "Replay.h"
+#include "Normalizer.h"
+#include "RoaringBitmap.h"
+#include "glob-cpp/glob.h"
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include "ThreadPool.h"
+#include <numeric>
+#include <random>
+#include <set>
 #include <vector>
+#ifdef SERVER_EPOLL
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+/// A tiny JMdict excerpt
+const char *test_dictionary_xml = R"(<JMdict>
+<entry><ent_seq>1327650</ent_seq><k_ele><keb>書く</keb></k_ele><r_ele><reb>かく</reb></r_ele>
+<sense><pos>&v5k;</pos><pos>&vt;</pos><gloss>to write</gloss></sense></entry>
+<entry><k_ele><keb>良い</keb></k_ele><r_ele><reb>よい</reb></r_ele>
+<sense><pos>&adj-i;</pos><gloss>good</gloss></sense></entry>
+<entry><k_ele><keb>書いた</keb></k_ele><r_ele><reb>かいた</reb></r_ele>
+<sense><pos>&n;</pos><gloss>written thing (homograph of a verb form)</gloss></sense></entry>
+</JMdict>)";
+
+GrammarFormGuesser MakeTestGuesser() {
+  Grammar gr;
+  gr.LoadGrammarRules();
+  Dictionary dic;
+  pugi::xml_document doc;
+  doc.load_string(test_dictionary_xml);
+  dic.LoadDictionary(doc);
+  return {std::move(gr), std::move(dic)};
+}
+
+Generator<int> CountTo(int n, int &resumed) {
+  for (int i = 1; i <= n; ++i) {
+	++resumed;
+	co_yield i;
+  }
+}
 
 TEST(TestUtilities, StringIsWhitespaceOrEmpty) {
   EXPECT_TRUE(Utilities::StringIsWhitespaceOrEmpty("    "));
@@ -119,4 +170,846 @@ TEST(TestGrammar, GrammarRule_Apply) {
   grammar_triple = GrammarTriple{"良くなかった", "*", ""};
   final_triple = GrammarTriple{"良くない", "@(adj-i)", "plain"};
   EXPECT_EQ(final_triple, gr.Apply(grammar_triple));
-}
\ No newline at end of file
+}
+
+TEST(TestGenerator, YieldsLazily) {
+  int resumed = 0;
+  auto generator = CountTo(3, resumed);
+  EXPECT_EQ(0, resumed);
+  EXPECT_EQ(1, generator.Next());
+  EXPECT_EQ(1, resumed);
+  std::vector<int> rest;
+  for (int i : generator) rest.push_back(i);
+  EXPECT_EQ((std::vector<int>{2, 3}), rest);
+  EXPECT_EQ(std::nullopt, generator.Next());
+}
+
+TEST(TestGrammarFormGuesser, Guess) {
+  auto guesser = MakeTestGuesser();
+  auto result = guesser.Guess("良くなかった");
+  ASSERT_TRUE(result.success);
+  ASSERT_EQ(2, result.rules.size());
+  EXPECT_EQ("past", result.rules[0]->rule);
+  EXPECT_EQ("negative", result.rules[1]->rule);
+  ASSERT_EQ(1, result.entry->writings.size());
+  EXPECT_EQ("良い", result.entry->writings[0]);
+
+  EXPECT_FALSE(guesser.Guess("xyz").success);
+}
+
+TEST(TestGrammarFormGuesser, Guess_ResultOutlivesGuesser) {
+  std::optional<GuessResult> result;
+  {
+	auto guesser = MakeTestGuesser();
+	result = guesser.Guess("良くなかった");
+  }
+  ASSERT_TRUE(result->success);
+  ASSERT_EQ(2, result->rules.size());
+  EXPECT_EQ("past", result->rules[0]->rule);
+  EXPECT_EQ("良くない", result->Form(0));
+  EXPECT_EQ("良い", result->Form(1));
+  EXPECT_EQ("良い", result->entry->writings[0]);
+}
+
+TEST(TestGrammarFormGuesser, GuessMemo_SameForms) {
+  auto guesser = MakeTestGuesser();
+  GuessMemo memo;
+  guesser.Guess("良くない", memo);
+  // the rest of the derivation comes from the memo
+  auto result = guesser.Guess("良くなかった", memo);
+  ASSERT_EQ(2, result.rules.size());
+  EXPECT_EQ("良くない", result.Form(0));
+  EXPECT_EQ("良い", result.Form(1));
+}
+
+TEST(TestGrammarFormGuesser, GuessK_ShortestFirst) {
+  auto guesser = MakeTestGuesser();
+  auto results = guesser.Guess("書かれる", 5);
+  ASSERT_EQ(2, results.size());
+  ASSERT_EQ(1, results[0].rules.size());
+  EXPECT_EQ("passive", results[0].rules[0]->rule);
+  ASSERT_EQ(1, results[1].rules.size());
+  EXPECT_EQ("archaic-potential", results[1].rules[0]->rule);
+
+  EXPECT_TRUE(guesser.Guess("書かれる", 0).empty());
+}
+
+TEST(TestGrammarFormGuesser, Guess_SkipsEntryWithOtherPos) {
+  auto guesser = MakeTestGuesser();
+  // the noun 書いた cannot be the continuous form the derivation passes through
+  auto result = guesser.Guess("書いてた");
+  ASSERT_TRUE(result.success);
+  ASSERT_EQ(1, result.entry->writings.size());
+  EXPECT_EQ("書く", result.entry->writings[0]);
+  EXPECT_EQ(5, result.rules.size());
+  // without a derivation any entry matches
+  result = guesser.Guess("書いた");
+  ASSERT_TRUE(result.success);
+  EXPECT_TRUE(result.rules.empty());
+  EXPECT_EQ("書いた", result.entry->writings[0]);
+}
+
+TEST(TestGrammarFormGuesser, GuessFuzzy) {
+  auto guesser = MakeTestGuesser();
+  // a typo in the stem
+  auto result = guesser.GuessFuzzy("譖いてた", 1);
+  ASSERT_TRUE(result.success);
+  EXPECT_EQ(1, result.distance);
+  EXPECT_EQ("書く", result.entry->writings[0]);
+  EXPECT_FALSE(result.rules.empty());
+  EXPECT_EQ(0, guesser.GuessFuzzy("良くなかった", 1).distance);
+  EXPECT_FALSE(guesser.GuessFuzzy("譖いてた", 0).success);
+  EXPECT_FALSE(guesser.GuessFuzzy("xyz", 1).success);
+}
+
+TEST(TestThreadPool, ParallelFor_Nested) {
+  ThreadPool pool(4);
+  std::vector<int> sums(20);
+  pool.ParallelFor(sums.size(), [&](size_t i) {
+	std::vector<int> values(i);
+	pool.ParallelFor(values.size(), [&](size_t j) { values[j] = static_cast<int>(j); });
+	sums[i] = std::accumulate(values.begin(), values.end(), 0);
+  });
+  for (size_t i = 0; i < sums.size(); ++i) EXPECT_EQ(i * (i - 1) / 2, sums[i]);
+  EXPECT_THROW(pool.ParallelFor(3, [](size_t) { throw std::runtime_error("task"); }), std::runtime_error);
+}
+
+TEST(TestGlob, SharedAcrossThreads) {
+  // the globs are compiled once and matched by all the workers, each with its own context
+  std::vector<std::string> patterns{"+(ab)c", "@(v5*|v1)", "[ab]*", "x*(y)z", "!(ab)c"};
+  std::vector<std::unique_ptr<const glob::glob>> globs;
+  for (auto &pattern : patterns) globs.push_back(std::make_unique<const glob::glob>(pattern));
+  std::vector<std::string> strings{"abc", "ababc", "c", "v5k", "v1", "v2", "ab", "ba", "xz", "xyyz", "abxc", "zc"};
+  std::vector<char> expected, matched(1000 * patterns.size());
+  for (size_t i = 0; i < matched.size(); ++i) {
+	glob::glob fresh(patterns[i % patterns.size()]);
+	expected.push_back(glob::glob_match(strings[i / patterns.size() % strings.size()], fresh));
+  }
+  ThreadPool pool(4);
+  pool.ParallelFor(matched.size(), [&](size_t i) {
+	glob::MatchContext<char> context;
+	matched[i] = glob::glob_match(strings[i / patterns.size() % strings.size()], *globs[i % patterns.size()], context);
+  });
+  EXPECT_EQ(expected, matched);
+  // the captures of a match do not leak into the next one
+  glob::glob star("*");
+  glob::cmatch results;
+  ASSERT_TRUE(glob::glob_match(std::string("xy"), results, star));
+  EXPECT_EQ("xy", *results.begin());
+  ASSERT_TRUE(glob::glob_match(std::string(""), results, star));
+  EXPECT_EQ("", *results.begin());
+}
+
+TEST(TestGlob, Dfa_SameAsAutomata) {
+  std::vector<std::string> patterns{"+(ab)c", "@(v5*|v1)", "[ab]?", "x*(y)z", "?(a|b)c", "[!a-c]x", "abc", "*"};
+  std::vector<std::string> strings{"abc", "ababc", "c", "v5k", "v1", "v2", "ab", "ba", "xz", "xyyz", "ac", "dx", "ax"};
+  for (auto &pattern : patterns) {
+	glob::glob automata(pattern);
+	glob::dfa_glob_t dfa(pattern);
+	for (auto &s : strings) EXPECT_EQ(glob::glob_match(s, automata), glob::glob_match(s, dfa)) << pattern << " " << s;
+  }
+  // a star gives back what the rest of the glob needs, !(...) matches whatever the group does not
+  EXPECT_TRUE(glob::glob_match("acc", glob::dfa_glob_t("[ab]*c")));
+  EXPECT_TRUE(glob::glob_match("aba", glob::dfa_glob_t("*a")));
+  EXPECT_TRUE(glob::glob_match("xacy", glob::dfa_glob_t("x!(ab|c)y")));
+  EXPECT_FALSE(glob::glob_match("xaby", glob::dfa_glob_t("x!(ab|c)y")));
+  EXPECT_FALSE(glob::glob_match("a.txt", glob::dfa_glob_t("*.!(txt)")));
+  glob::basic_glob<char32_t, glob::dfa_glob<char32_t>> wide(U"食べ?(る|た)");
+  EXPECT_TRUE(glob::glob_match(std::u32string(U"食べた"), wide));
+  EXPECT_FALSE(glob::glob_match(std::u32string(U"食べろ"), wide));
+}
+
+TEST(TestGlob, Dfa_TooManyStates) {
+  // the DFA of *a???????????? remembers which of the last 13 characters are a
+  std::string pattern = "*a" + std::string(12, '?');
+  glob::dfa_glob_t dfa(pattern);
+  EXPECT_EQ(0, glob::dfa_glob<char>(pattern).NumStates());
+  EXPECT_TRUE(glob::glob_match("xa" + std::string(12, 'b'), dfa));
+  EXPECT_TRUE(glob::glob_match("aa" + std::string(12, 'a'), dfa));
+  EXPECT_FALSE(glob::glob_match("ba" + std::string(11, 'b'), dfa));
+  EXPECT_FALSE(glob::glob_match("xa" + std::string(13, 'b'), dfa));
+  EXPECT_NE(0, glob::dfa_glob<char>("*a" + std::string(10, '?')).NumStates());
+  EXPECT_THROW(glob::dfa_glob_t("!(" + pattern + ")"), glob::ComplexityError);
+  EXPECT_THROW(glob::dfa_glob_t("[a"), glob::Error);
+}
+
+TEST(TestGrammarFormGuesser, GuessParallel_SameAsSequential) {
+  auto guesser = MakeTestGuesser();
+  ThreadPool pool(4);
+  for (auto &form : {"書く", "書かれる", "書いてた", "書かせられなかった", "良くなかった", "良くなくて", "xyz", "書"}) {
+	auto sequential = guesser.Guess(form);
+	auto parallel = guesser.Guess(form, pool);
+	ASSERT_EQ(sequential.success, parallel.success) << form;
+	ASSERT_EQ(sequential.rules.size(), parallel.rules.size()) << form;
+	for (size_t i = 0; i < sequential.rules.size(); ++i)
+	  EXPECT_EQ(sequential.rules[i]->rule, parallel.rules[i]->rule) << form;
+	EXPECT_EQ(sequential.entry, parallel.entry) << form;
+  }
+}
+
+TEST(TestGrammarFormGuesser, GuessBatch_SameAsGuess) {
+  auto guesser = MakeTestGuesser();
+  ThreadPool pool(3);
+  // repeated inputs and inputs sharing search states
+  std::vector<std::string> inputs{"書かなかった", "書かない", "書かなかった", "xyz", "書かせられなかった", "書かせられない",
+								  "良くなくて", "書かれる", "良くなかった", "書いてた", "xyz", "書かない"};
+  for (int round = 0; round < 3; ++round) inputs.insert(inputs.end(), inputs.begin(), inputs.begin() + 12);
+  auto batch = guesser.GuessBatch(inputs, pool);
+  ASSERT_EQ(inputs.size(), batch.size());
+  for (size_t i = 0; i < inputs.size(); ++i) {
+	auto single = guesser.Guess(inputs[i]);
+	EXPECT_EQ(inputs[i], batch[i].original_query);
+	ASSERT_EQ(single.success, batch[i].success) << inputs[i];
+	ASSERT_EQ(single.rules.size(), batch[i].rules.size()) << inputs[i];
+	for (size_t j = 0; j < single.rules.size(); ++j) EXPECT_EQ(single.rules[j]->rule, batch[i].rules[j]->rule) << inputs[i];
+	EXPECT_EQ(single.entry, batch[i].entry) << inputs[i];
+  }
+  EXPECT_TRUE(guesser.GuessBatch({}, pool).empty());
+}
+
+TEST(TestSegmenter, Segment) {
+  auto guesser = MakeTestGuesser();
+  Segmenter segmenter(guesser);
+  auto segments = segmenter.Segment("良くなかったxy書かない書いてた");
+  ASSERT_EQ(4, segments.size());
+  EXPECT_EQ("良くなかった", segments[0].text);
+  EXPECT_EQ("良い", segments[0].result.entry->writings[0]);
+  EXPECT_EQ("xy", segments[1].text);
+  EXPECT_FALSE(segments[1].result.success);
+  EXPECT_EQ("書かない", segments[2].text);
+  EXPECT_EQ(1, segments[2].result.rules.size());
+  EXPECT_EQ("書いてた", segments[3].text);
+  EXPECT_EQ("書く", segments[3].result.entry->writings[0]);
+  EXPECT_TRUE(segmenter.Segment("").empty());
+}
+
+TEST(TestSegmenter, Segment_MemoDoesNotGrowAcrossTexts) {
+  auto guesser = MakeTestGuesser();
+  Segmenter segmenter(guesser);
+  segmenter.Segment("良くなかったxy書かない書いてた");
+  size_t first = segmenter.GetMemo().Size();
+  EXPECT_LT(0, first);
+  segmenter.Segment("食べさせられる見ている");
+  segmenter.Segment("良くなかったxy書かない書いてた");
+  EXPECT_EQ(first, segmenter.GetMemo().Size());
+  segmenter.Segment("");
+  EXPECT_EQ(0, segmenter.GetMemo().Size());
+}
+
+TEST(TestBoundedQueue, ManyProducersAndConsumers) {
+  BoundedQueue<int> queue(4);
+  std::atomic<long> sum = 0;
+  std::vector<std::thread> threads;
+  for (int producer = 0; producer < 3; ++producer)
+	threads.emplace_back([&] { for (int i = 1; i <= 1000; ++i) queue.Push(i); });
+  for (int consumer = 0; consumer < 3; ++consumer)
+	threads.emplace_back([&] { for (int i = 0; i < 1000; ++i) sum += queue.Pop(); });
+  for (auto &thread : threads) thread.join();
+  EXPECT_EQ(3 * 1000 * 1001 / 2, sum);
+  int value;
+  EXPECT_FALSE(queue.TryPop(value));
+}
+
+TEST(TestBatch, Run_InInputOrder) {
+  auto guesser = MakeTestGuesser();
+  std::vector<std::string> lines;
+  for (int i = 0; i < 2000; ++i) lines.insert(lines.end(), {"書かなかった", "xyz", "良くなかった", "", "書いてた"});
+  std::string input;
+  for (auto &line : lines) input += line + (line == "xyz" ? "\r\n" : "\n");
+  // without the last newline
+  input.pop_back();
+  std::string expected;
+  for (auto &line : lines) {
+	std::stringstream ss;
+	auto result = guesser.Guess(line);
+	if (result.success) ss << result << '\n';
+	else ss << "No result :(\n";
+	expected += ss.str();
+  }
+  auto path = std::filesystem::temp_directory_path() / "oshi_batch_test.txt";
+  std::ofstream(path, std::ios::binary) << input;
+  for (unsigned threads : {1, 4}) {
+	FILE *out = std::tmpfile();
+	ASSERT_TRUE(Batch::Run(guesser, path.string(), threads, out));
+	std::string output(std::ftell(out), '\0');
+	std::rewind(out);
+	ASSERT_EQ(output.size(), std::fread(output.data(), 1, output.size(), out));
+	std::fclose(out);
+	EXPECT_EQ(expected, output);
+  }
+  std::filesystem::remove(path);
+  EXPECT_FALSE(Batch::Run(guesser, path.string(), 2, stdout));
+}
+
+TEST(TestBatch, Run_NormalizesQueries) {
+  Grammar gr;
+  gr.LoadGrammarRules();
+  Dictionary dic;
+  pugi::xml_document doc;
+  doc.load_string(R"(<JMdict><entry><k_ele><keb>Ｔシャツ</keb></k_ele><r_ele><reb>ティーシャツ</reb></r_ele>
+<sense><pos>&n;</pos><gloss>T-shirt</gloss></sense></entry></JMdict>)");
+  dic.LoadDictionary(doc);
+  GrammarFormGuesser guesser(std::move(gr), std::move(dic));
+  auto path = std::filesystem::temp_directory_path() / "oshi_batch_normalize_test.txt";
+  std::ofstream(path, std::ios::binary) << "Ｔシャツ\n　Ｔｼｬﾂ \nＴ\xff\n";
+  FILE *out = std::tmpfile();
+  ASSERT_TRUE(Batch::Run(guesser, path.string(), 2, out));
+  std::string output(std::ftell(out), '\0');
+  std::rewind(out);
+  ASSERT_EQ(output.size(), std::fread(output.data(), 1, output.size(), out));
+  std::fclose(out);
+  std::filesystem::remove(path);
+  std::stringstream expected;
+  expected << guesser.Guess("Tシャツ") << '\n' << guesser.Guess("Tシャツ") << "\nNo result :(\n";
+  EXPECT_TRUE(guesser.Guess("Tシャツ").success);
+  EXPECT_EQ(expected.str(), output);
+}
+
+TEST(TestResultSerializer, AppendJson) {
+  auto guesser = MakeTestGuesser();
+  std::string out;
+  ResultSerializer::AppendJson(guesser.Guess("書かない"), out);
+  EXPECT_EQ(R"({"query":"書かない","success":true,"derivation":[{"rule":"negative","form":"書く"}],)"
+			R"("entry":{"id":1327650,"writings":["書く"],"readings":["かく"],)"
+			R"("senses":[{"pos":["v5k","vt"],"glosses":["to write"]}]}})" "\n", out);
+  out.clear();
+  ResultSerializer::AppendJson(guesser.Guess("x\"\\\n"), out);
+  EXPECT_EQ(R"({"query":"x\"\\\u000a","success":false})" "\n", out);
+  // a raw batch line with an invalid byte and a truncated sequence still gives valid JSON
+  out.clear();
+  ResultSerializer::AppendJson(GuessResult("x\xff" "書" "\xe6\x9b"), out);
+  EXPECT_EQ("{\"query\":\"x\uFFFD書\uFFFD\uFFFD\",\"success\":false}\n", out);
+}
+
+TEST(TestResultSerializer, AppendBinary) {
+  auto guesser = MakeTestGuesser();
+  std::string out = "prefix";
+  ResultSerializer::AppendBinary(guesser.Guess("書かない"), out);
+  std::string_view record = std::string_view(out).substr(6);
+  uint32_t length = 0;
+  for (int i = 0; i < 4; ++i) length |= static_cast<uint32_t>(static_cast<unsigned char>(record[i])) << (8 * i);
+  EXPECT_EQ(record.size() - 4, length);
+  // the query as a varint length and bytes, then success
+  EXPECT_EQ(std::string("書かない").size(), record[4]);
+  EXPECT_EQ("書かない", record.substr(5, record[4]));
+  EXPECT_EQ(1, record[5 + record[4]]);
+  // 1327650 as a varint ends the rule chain of a single rule: negative, 書く
+  EXPECT_NE(std::string_view::npos, record.find("\xa2\x84\x51"));
+}
+
+#ifdef SERVER_EPOLL
+TEST(TestServer, PipelinedRequests) {
+  auto guesser = MakeTestGuesser();
+  auto path = (std::filesystem::temp_directory_path() / "oshi_server_test.sock").string();
+  Server server(guesser, 4, OutputFormat::JSONL);
+  std::string error;
+  ASSERT_TRUE(server.Listen(path, error)) << error;
+  std::thread serving([&] { server.Run(); });
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  std::strcpy(address.sun_path, path.c_str());
+  ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)));
+  // all the requests are sent before any response is read
+  std::vector<std::string> queries;
+  for (int i = 0; i < 100; ++i) queries.insert(queries.end(), {"書かなかった", "xyz", "良くなかった"});
+  std::string requests, expected;
+  for (auto &query : queries) {
+	uint32_t length = query.size();
+	requests.append(reinterpret_cast<const char *>(&length), 4) += query;
+	std::string record;
+	ResultSerializer::AppendJson(guesser.Guess(query), record);
+	length = record.size();
+	expected.append(reinterpret_cast<const char *>(&length), 4) += record;
+  }
+  ASSERT_EQ(requests.size(), write(fd, requests.data(), requests.size()));
+  shutdown(fd, SHUT_WR);
+  // the server closes the connection after the last response
+  std::string responses;
+  char buffer[4096];
+  for (ssize_t n; (n = read(fd, buffer, sizeof(buffer))) > 0;) responses.append(buffer, n);
+  close(fd);
+  EXPECT_EQ(expected, responses);
+
+  server.Stop();
+  serving.join();
+}
+#endif
+
+TEST(TestMetrics, Buckets) {
+  for (uint64_t value : {0ull, 15ull, 16ull, 17ull, 1000ull, 123456789ull, 1ull << 39}) {
+	size_t bucket = Metrics::BucketOf(value);
+	EXPECT_LE(Metrics::BucketStart(bucket), value);
+	EXPECT_GT(Metrics::BucketStart(bucket + 1), value);
+	// at most 1/16 of the value apart
+	EXPECT_LE((Metrics::BucketStart(bucket + 1) - Metrics::BucketStart(bucket)) * 16, std::max<uint64_t>(value, 16));
+  }
+  EXPECT_EQ(Metrics::bucket_count - 1, Metrics::BucketOf(UINT64_MAX));
+
+  Metrics::HistogramSnapshot snapshot;
+  for (uint64_t value = 1; value <= 1000; ++value) {
+	++snapshot.buckets[Metrics::BucketOf(value * 1000)];
+	++snapshot.count;
+  }
+  snapshot.max = 1000 * 1000;
+  EXPECT_NEAR(500 * 1000, snapshot.Quantile(0.5), 500 * 1000 / 16);
+  EXPECT_NEAR(990 * 1000, snapshot.Quantile(0.99), 990 * 1000 / 16);
+  EXPECT_EQ(1000 * 1000, snapshot.Quantile(1));
+  EXPECT_EQ(1, snapshot.CountBelow(1024));
+}
+
+TEST(TestMetrics, CountsGuesses) {
+  auto guesser = MakeTestGuesser();
+  uint64_t guesses = Metrics::Total(Metrics::GUESSES);
+  uint64_t latencies = Metrics::Snapshot(Metrics::GUESS_LATENCY).count;
+  uint64_t nodes = Metrics::Total(Metrics::NODES_EXPANDED);
+  // the counters of a finished thread are kept
+  std::thread([&] { guesser.Guess("良くなかった"); }).join();
+  EXPECT_EQ(guesses + 1, Metrics::Total(Metrics::GUESSES));
+  EXPECT_EQ(latencies + 1, Metrics::Snapshot(Metrics::GUESS_LATENCY).count);
+  EXPECT_LT(nodes, Metrics::Total(Metrics::NODES_EXPANDED));
+  EXPECT_LE(Metrics::Total(Metrics::RULES_MATCHED), Metrics::Total(Metrics::RULES_TESTED));
+
+  std::stringstream ss;
+  Metrics::WritePrometheus(ss);
+  EXPECT_NE(std::string::npos, ss.str().find("# TYPE oshi_guess_latency_seconds histogram\n"));
+  // the values below 256 ns, which are not greater than 255 ns
+  EXPECT_NE(std::string::npos, ss.str().find("oshi_guess_latency_seconds_bucket{le=\"2.55e-07\"} "));
+  EXPECT_NE(std::string::npos, ss.str().find("oshi_guesses_total " + std::to_string(guesses + 1) + "\n"));
+}
+
+TEST(TestSearchTrace, RecordsSearchTree) {
+  auto guesser = MakeTestGuesser();
+  SearchTrace trace;
+  {
+	SearchTrace::Scope scope(trace);
+	guesser.Guess("良くなかった");
+  }
+  // outside of the scope nothing is recorded
+  guesser.Guess("書かない");
+#ifdef OSHI_TRACE
+  ASSERT_FALSE(trace.nodes.empty());
+  EXPECT_EQ("良くなかった", trace.nodes[0].form);
+  EXPECT_EQ(SIZE_MAX, trace.nodes[0].parent);
+  // the derivation ends at a node found in the dictionary, two rules below the query
+  auto &last = trace.nodes.back();
+  ASSERT_NE(nullptr, last.entry);
+  EXPECT_EQ("良い", last.form);
+  EXPECT_EQ(2, last.depth);
+  EXPECT_EQ("negative", last.rule->rule);
+  EXPECT_EQ("past", trace.nodes[last.parent].rule->rule);
+  // every rule of the role is tested on an expanded node
+  EXPECT_FALSE(trace.nodes[0].rules.empty());
+  EXPECT_TRUE(std::any_of(trace.nodes[0].rules.begin(), trace.nodes[0].rules.end(), [](auto &test) {
+	return test.rule->rule == "past" && test.outcome == SearchTrace::APPLIED;
+  }));
+  EXPECT_GE(trace.SubtreeDurations()[0], trace.nodes[0].duration);
+  std::stringstream ss;
+  trace.WriteChromeTrace(ss);
+  EXPECT_NE(std::string::npos, ss.str().find(R"("name":"良い","cat":"search","ph":"X")"));
+#else
+  EXPECT_TRUE(trace.nodes.empty());
+#endif
+}
+
+TEST(TestReplay, Run) {
+  auto guesser = MakeTestGuesser();
+  std::vector<std::string> queries{"書いてた", "良くなかった", "xyz", "書かない", "良い", "なにこれ", "書いた", ""};
+  Replay::Options options;
+  options.threads = 3;
+  options.warmup = 20;
+  options.outliers = 3;
+  auto report = Replay::Run(guesser, queries, options);
+  EXPECT_EQ(queries.size(), report.queries);
+  // xyz, なにこれ and the empty string
+  EXPECT_EQ(3, report.unanswered);
+  ASSERT_EQ(queries.size(), report.latencies.size());
+  EXPECT_TRUE(std::is_sorted(report.latencies.begin(), report.latencies.end()));
+  EXPECT_EQ(report.latencies.front(), report.Quantile(0));
+  EXPECT_EQ(report.latencies[3], report.Quantile(0.5));
+  EXPECT_EQ(report.latencies.back(), report.Quantile(0.999));
+  ASSERT_EQ(3, report.outliers.size());
+  EXPECT_EQ(report.latencies.back(), report.outliers[0].first);
+  EXPECT_GE(report.outliers[0].first, report.outliers[2].first);
+  EXPECT_GT(report.Throughput(), 0);
+  std::stringstream ss;
+  report.Write(ss);
+  EXPECT_TRUE(ss.str().starts_with("Replayed 8 queries on 3 threads"));
+}
+
+TEST(TestReplay, Run_Rate) {
+  auto guesser = MakeTestGuesser();
+  std::vector<std::string> queries(21, "書いてた");
+  Replay::Options options;
+  options.rate = 1000;
+  auto report = Replay::Run(guesser, queries, options);
+  // the last query starts 20 ms after the first one
+  EXPECT_GE(report.wall_ns, 20'000'000);
+  EXPECT_EQ(0, report.unanswered);
+}
+
+TEST(TestNormalizer, Normalize) {
+  std::string out;
+  ASSERT_TRUE(Normalizer::Normalize(" \t　書いてた　\n", out));
+  EXPECT_EQ("書いてた", out);
+  ASSERT_TRUE(Normalizer::Normalize("ＡＢＣ　１２３！", out));
+  EXPECT_EQ("ABC 123!", out);
+  // the voiced sound marks join the preceding kana where the voiced kana exists
+  ASSERT_TRUE(Normalizer::Normalize("ｶﾞｯｺｳ ﾊﾟﾝ ｳﾞ ｱﾞ", out));
+  EXPECT_EQ("ガッコウ パン ヴ ア゛", out);
+  ASSERT_TRUE(Normalizer::Normalize("ｶﾞｯｺｳ ヴ ヽ", out, Normalizer::FOLD_WIDTH | Normalizer::KATAKANA_TO_HIRAGANA));
+  EXPECT_EQ("がっこう ゔ ゝ", out);
+  // nothing but the trimming without flags
+  ASSERT_TRUE(Normalizer::Normalize(" ｶﾞ ＡＢ ", out, Normalizer::TRIM));
+  EXPECT_EQ("ｶﾞ ＡＢ", out);
+  ASSERT_TRUE(Normalizer::Normalize("", out));
+  EXPECT_EQ("", out);
+}
+
+TEST(TestNormalizer, Normalize_InvalidUtf8) {
+  std::string out;
+  EXPECT_FALSE(Normalizer::Normalize("\xE6\x9B", out));
+  // overlong, surrogate, beyond U+10FFFF, a lone continuation byte
+  EXPECT_FALSE(Normalizer::Normalize("\xC0\xAF", out));
+  EXPECT_FALSE(Normalizer::Normalize("\xE0\x80\xAF", out));
+  EXPECT_FALSE(Normalizer::Normalize("\xED\xA0\x80", out));
+  EXPECT_FALSE(Normalizer::Normalize("\xF4\x90\x80\x80", out));
+  EXPECT_FALSE(Normalizer::Normalize("abc\x80", out));
+  // inside a run the vectorized path would take
+  EXPECT_FALSE(Normalizer::Normalize("書いてた書いて\xED\xA0\x80書いてた書いてた", out));
+  EXPECT_FALSE(Normalizer::Normalize("書いてた書いて\xE6\x9Bた書いてた書いてた", out));
+  EXPECT_TRUE(Normalizer::Normalize("\xF0\x9F\x98\x80\xE2\x82\xAC\xC3\xA9", out));
+}
+
+TEST(TestNormalizer, Normalize_LongTextSameAsPieces) {
+  // the runs copied at once in a SIMD register must give the same result as the characters one by one
+  std::vector<std::string> pieces{"書いてた", "ｶﾞｯｺｳ", "カタカナ", "ＡＢＣ", "ascii text", "　", "良くなかった", "ﾊﾟ", "。"};
+  for (unsigned flags : {0u, +Normalizer::FOLD_WIDTH, Normalizer::FOLD_WIDTH | Normalizer::KATAKANA_TO_HIRAGANA}) {
+	std::string text, expected, out;
+	for (size_t i = 0; i < 200; ++i) {
+	  auto &piece = pieces[i * 7 % pieces.size()];
+	  text += piece;
+	  ASSERT_TRUE(Normalizer::Normalize(piece, out, flags));
+	  expected += out;
+	}
+	ASSERT_TRUE(Normalizer::Normalize(text, out, flags));
+	EXPECT_EQ(expected, out);
+  }
+}
+
+TEST(TestRoaringBitmap, SetOperations_SameAsStdSet) {
+  // sparse and dense containers, so that every pair of the array and the bitmap containers is combined
+  std::mt19937 random(7);
+  auto make_set = [&](double dense_share) {
+	std::set<uint32_t> set;
+	for (uint32_t key = 0; key < 6; ++key) {
+	  std::bernoulli_distribution take(random() % 2 ? dense_share : 0.01);
+	  for (uint32_t low = 0; low < 65536; ++low) {
+		if (take(random)) set.insert(key << 16 | low);
+	  }
+	}
+	return set;
+  };
+  auto to_bitmap = [](const std::set<uint32_t> &set) {
+	std::vector<uint32_t> values(set.begin(), set.end());
+	return RoaringBitmap::FromSorted(values);
+  };
+  auto to_set = [](const RoaringBitmap &bitmap) {
+	std::set<uint32_t> set;
+	bitmap.ForEach([&](uint32_t value) { return set.insert(value), true; });
+	return set;
+  };
+  for (int round = 0; round < 4; ++round) {
+	auto a = make_set(0.5), b = make_set(0.2);
+	auto bitmap_a = to_bitmap(a), bitmap_b = to_bitmap(b);
+	EXPECT_EQ(a.size(), bitmap_a.Cardinality());
+	EXPECT_EQ(a, to_set(bitmap_a));
+	std::set<uint32_t> expected;
+	std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::inserter(expected, expected.end()));
+	EXPECT_EQ(expected, to_set(bitmap_a & bitmap_b));
+	EXPECT_EQ(to_bitmap(expected), bitmap_a & bitmap_b);
+	expected.clear();
+	std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::inserter(expected, expected.end()));
+	EXPECT_EQ(expected, to_set(bitmap_a | bitmap_b));
+	EXPECT_EQ(to_bitmap(expected), bitmap_a | bitmap_b);
+	expected.clear();
+	std::set_difference(a.begin(), a.end(), b.begin(), b.end(), std::inserter(expected, expected.end()));
+	EXPECT_EQ(expected, to_set(bitmap_a - bitmap_b));
+	EXPECT_EQ(to_bitmap(expected), bitmap_a - bitmap_b);
+	EXPECT_TRUE((bitmap_a - bitmap_a).empty());
+	EXPECT_EQ(b.contains(3 << 16 | 100), bitmap_b.Contains(3 << 16 | 100));
+  }
+}
+
+TEST(TestDictionary, Query_Normalized) {
+  Dictionary dic;
+  pugi::xml_document doc;
+  doc.load_string(R"(<JMdict><entry><k_ele><keb>Ｔシャツ</keb></k_ele><r_ele><reb>ティーシャツ</reb></r_ele>
+<sense><pos>&n;</pos><gloss>T-shirt</gloss></sense></entry></JMdict>)");
+  dic.LoadDictionary(doc);
+  std::string query;
+  ASSERT_TRUE(Normalizer::Normalize("Ｔｼｬﾂ", query));
+  EXPECT_NE(nullptr, dic.Query(query));
+  EXPECT_EQ(dic.QueryFlags(), Normalizer::query_flags);
+  ASSERT_TRUE(Normalizer::Normalize("Ｔシャツ", query, Normalizer::FOLD_WIDTH | Normalizer::KATAKANA_TO_HIRAGANA));
+  EXPECT_EQ("Tしゃつ", query);
+  // the keys are in hiragana only if the dictionary is loaded so
+  EXPECT_EQ(nullptr, dic.Query(query));
+  EXPECT_EQ(nullptr, dic.Query("Ｔシャツ"));
+  Dictionary hiragana;
+  hiragana.LoadDictionary(doc, Normalizer::FOLD_WIDTH | Normalizer::KATAKANA_TO_HIRAGANA);
+  EXPECT_NE(0u, hiragana.QueryFlags() & Normalizer::KATAKANA_TO_HIRAGANA);
+  EXPECT_NE(nullptr, hiragana.Query(query));
+  EXPECT_EQ(nullptr, hiragana.Query("Tシャツ"));
+}
+
+TEST(TestDictionary, Query_PosMask) {
+  Dictionary dic;
+  pugi::xml_document doc;
+  doc.load_string(test_dictionary_xml);
+  dic.LoadDictionary(doc);
+  PosMask verbs = dic.PosMaskMatching("v5*");
+  PosMask nouns = dic.PosMaskMatching("n");
+  EXPECT_TRUE(verbs.any());
+  EXPECT_FALSE((verbs & nouns).any());
+  EXPECT_EQ(nullptr, dic.Query("書いた", verbs));
+  EXPECT_NE(nullptr, dic.Query("書いた", nouns));
+  EXPECT_NE(nullptr, dic.Query("書く", verbs));
+  EXPECT_EQ(nullptr, dic.Query("書けない", verbs));
+  // a trailing star also matches the empty string
+  EXPECT_EQ(dic.PosMaskMatching("vt"), dic.PosMaskMatching("vt*"));
+  EXPECT_TRUE(dic.PosMaskMatching("vt").any());
+}
+
+TEST(TestDictionary, SaveImage_LoadImage) {
+  auto path = (std::filesystem::temp_directory_path() / "oshi_dictionary_test.oshi").string();
+  {
+	Dictionary dic;
+	pugi::xml_document doc;
+	doc.load_string(test_dictionary_xml);
+	dic.LoadDictionary(doc);
+	ASSERT_TRUE(dic.SaveImage(path));
+  }
+  Dictionary dic;
+  ASSERT_TRUE(dic.LoadImage(path));
+  auto entry = dic.Query("書く");
+  ASSERT_NE(nullptr, entry);
+  EXPECT_EQ(1327650, entry->id);
+  ASSERT_EQ(1, entry->senses.size());
+  EXPECT_EQ("to write", entry->senses[0].glosses[0]);
+  EXPECT_EQ("vt", entry->senses[0].part_of_speech[1]);
+  EXPECT_EQ(nullptr, dic.Query("書いた", dic.PosMaskMatching("v*")));
+  EXPECT_TRUE(dic.HasKeyWithPrefix("良"));
+
+  // a truncated image is rejected
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+  Dictionary truncated;
+  EXPECT_FALSE(truncated.LoadImage(path));
+  EXPECT_EQ(nullptr, truncated.Query("書く"));
+  std::filesystem::remove(path);
+}
+
+TEST(TestDictionary, HasKeyWithPrefix) {
+  Dictionary dic;
+  pugi::xml_document doc;
+  doc.load_string(test_dictionary_xml);
+  dic.LoadDictionary(doc);
+  EXPECT_TRUE(dic.HasKeyWithPrefix("書"));
+  EXPECT_TRUE(dic.HasKeyWithPrefix("書く"));
+  EXPECT_TRUE(dic.HasKeyWithPrefix(""));
+  EXPECT_FALSE(dic.HasKeyWithPrefix("書くる"));
+  EXPECT_FALSE(dic.HasKeyWithPrefix("譖"));
+}
+
+TEST(TestDictionary, Complete) {
+  Dictionary dic;
+  pugi::xml_document doc;
+  doc.load_string(test_dictionary_xml);
+  dic.LoadDictionary(doc);
+  // by the readings too, the shorter key first
+  auto completions = dic.Complete("かい");
+  ASSERT_EQ(1, completions.size());
+  EXPECT_EQ("かいた", completions[0].key);
+  completions = dic.Complete("書");
+  ASSERT_EQ(2, completions.size());
+  EXPECT_EQ("書く", completions[0].key);
+  EXPECT_EQ("書いた", completions[1].key);
+  EXPECT_EQ(1, dic.Complete("書", 1).size());
+  EXPECT_TRUE(dic.Complete("x").empty());
+}
+
+TEST(TestDictionary, Complete_ManyKeys) {
+  // more keys with the prefix than are read, completed from the precomputed nodes
+  std::string xml = "<JMdict>";
+  for (int i = 0; i < 500; ++i) {
+	xml += "<entry><ent_seq>" + std::to_string(i) + "</ent_seq><r_ele><reb>か" + std::to_string(i) + "</reb>";
+	if (i == 321) xml += "<re_pri>ichi1</re_pri>";
+	if (i == 123) xml += "<re_pri>news2</re_pri><re_pri>nf30</re_pri>";
+	xml += "</r_ele><sense><pos>&n;</pos><gloss>" + std::to_string(i) + "</gloss></sense></entry>";
+  }
+  xml += "</JMdict>";
+  Dictionary dic;
+  pugi::xml_document doc;
+  doc.load_string(xml.c_str());
+  dic.LoadDictionary(doc);
+  auto completions = dic.Complete("か", 4);
+  ASSERT_EQ(4, completions.size());
+  EXPECT_EQ(321, completions[0].entry->id);
+  EXPECT_EQ(123, completions[1].entry->id);
+  // then the shorter keys in the key order
+  EXPECT_EQ("か0", completions[2].key);
+  EXPECT_EQ("か1", completions[3].key);
+  EXPECT_EQ(Dictionary::completion_top_k, dic.Complete("", 100).size());
+  completions = dic.Complete("か32");
+  ASSERT_EQ(Dictionary::completion_top_k, completions.size());
+  EXPECT_EQ("か321", completions[0].key);
+  EXPECT_EQ("か32", completions[1].key);
+}
+
+TEST(TestDictionary, GlobSearch) {
+  Dictionary dic;
+  pugi::xml_document doc;
+  doc.load_string(test_dictionary_xml);
+  dic.LoadDictionary(doc);
+  std::vector<Dictionary::Completion> matches;
+  ASSERT_EQ(Dictionary::GlobStatus::OK, dic.GlobSearch("*書*", 10, matches));
+  ASSERT_EQ(2, matches.size());
+  EXPECT_EQ("書いた", matches[0].key);
+  EXPECT_EQ("書く", matches[1].key);
+  // a code point, not a byte, and the reading of the same entry first
+  ASSERT_EQ(Dictionary::GlobStatus::OK, dic.GlobSearch("?く", 10, matches));
+  ASSERT_EQ(1, matches.size());
+  EXPECT_EQ("かく", matches[0].key);
+  EXPECT_EQ("書く", matches[0].entry->writings[0]);
+  ASSERT_EQ(Dictionary::GlobStatus::OK, dic.GlobSearch("[良書]*", 10, matches));
+  EXPECT_EQ(3, matches.size());
+  ASSERT_EQ(Dictionary::GlobStatus::OK, dic.GlobSearch("[良書]*", 2, matches));
+  EXPECT_EQ(2, matches.size());
+  ASSERT_EQ(Dictionary::GlobStatus::OK, dic.GlobSearch("書@(く|いた)", 10, matches));
+  EXPECT_EQ(2, matches.size());
+  ASSERT_EQ(Dictionary::GlobStatus::OK, dic.GlobSearch("*かな*", 10, matches));
+  EXPECT_TRUE(matches.empty());
+  EXPECT_EQ(Dictionary::GlobStatus::INVALID, dic.GlobSearch("[書", 10, matches));
+  // too many DFA states, matched by the NFA
+  ASSERT_EQ(Dictionary::GlobStatus::OK, dic.GlobSearch("@(書く|*か" + std::string(12, '?') + ")", 10, matches));
+  ASSERT_EQ(1, matches.size());
+  EXPECT_EQ("書く", matches[0].key);
+  // the complement of such a group needs its DFA
+  EXPECT_EQ(Dictionary::GlobStatus::TOO_COMPLEX, dic.GlobSearch("!(*か" + std::string(12, '?') + ")", 10, matches));
+}
+
+TEST(TestDictionary, GlossSearch) {
+  Dictionary dic;
+  pugi::xml_document doc;
+  // the subset copied next to the tests, with senses of several glosses
+  doc.load_file("JMdict_subset.xml");
+  dic.LoadDictionary(doc);
+  auto matches = dic.GlossSearch("WRITE", 10);
+  ASSERT_EQ(1, matches.size());
+  EXPECT_EQ("書く", matches[0].entry->writings[0]);
+  EXPECT_GT(matches[0].score, 0);
+  // every word, in any gloss
+  EXPECT_EQ(1, dic.GlossSearch("write paint", 10).size());
+  EXPECT_TRUE(dic.GlossSearch("write eat", 10).empty());
+  EXPECT_TRUE(dic.GlossSearch("writes", 10).empty());
+  // a phrase only within a gloss, in order
+  EXPECT_EQ(1, dic.GlossSearch("\"to write\"", 10).size());
+  EXPECT_TRUE(dic.GlossSearch("\"write to\"", 10).empty());
+  EXPECT_TRUE(dic.GlossSearch("\"pen to\"", 10).empty());
+
+  matches = dic.GlossSearch("to", 100);
+  ASSERT_GT(matches.size(), 2);
+  EXPECT_TRUE(std::is_sorted(matches.begin(), matches.end(), [](auto &a, auto &b) { return a.score > b.score; }));
+  EXPECT_EQ(2, dic.GlossSearch("to", 2).size());
+}
+
+TEST(TestDictionary, KanjiSearch) {
+  Dictionary dic;
+  pugi::xml_document doc;
+  doc.load_file("JMdict_subset.xml");
+  dic.LoadDictionary(doc);
+  auto writings = [&](const RoaringBitmap &entries) {
+	std::vector<std::string_view> writings;
+	entries.ForEach([&](uint32_t index) { return writings.push_back(dic.Entry(index).writings[0]), true; });
+	return writings;
+  };
+  EXPECT_EQ(std::vector<std::string_view>{"書道"}, writings(dic.KanjiSearch("書道")));
+  EXPECT_EQ((std::vector<std::string_view>{"書く", "書道", "書"}), writings(dic.KanjiSearch("書")));
+  EXPECT_EQ((std::vector<std::string_view>{"書く", "書"}), writings(dic.KanjiSearch("書", {}, "道")));
+  EXPECT_EQ((std::vector<std::string_view>{"書く", "読む", "書道", "書"}), writings(dic.KanjiSearch({}, "書読")));
+  EXPECT_EQ(std::vector<std::string_view>{"書道"}, writings(dic.KanjiSearch("道", "書字")));
+  EXPECT_TRUE(dic.KanjiSearch("書鬱").empty());
+  EXPECT_TRUE(dic.KanjiSearch({}, {}, "書").empty());
+}
+
+TEST(TestDictionary, FuzzyQuery) {
+  Dictionary dic;
+  pugi::xml_document doc;
+  doc.load_string(test_dictionary_xml);
+  dic.LoadDictionary(doc);
+  PosMask any_pos;
+  any_pos.set();
+  auto matches = dic.FuzzyQuery("書いく", 1, any_pos, 10);
+  // ties in the order of the keys
+  ASSERT_EQ(2, matches.size());
+  EXPECT_EQ("書いた", matches[0].key);
+  EXPECT_EQ(1, matches[0].distance);
+  EXPECT_EQ("書く", matches[1].key);
+  EXPECT_EQ("書く", matches[1].entry->writings[0]);
+  EXPECT_EQ(1, dic.FuzzyQuery("書いく", 1, any_pos, 1).size());
+  matches = dic.FuzzyQuery("書いく", 1, dic.PosMaskMatching("v5*"), 10);
+  ASSERT_EQ(1, matches.size());
+  EXPECT_EQ("書く", matches[0].key);
+
+  matches = dic.FuzzyQuery("良い", 2, any_pos, 10);
+  ASSERT_EQ(3, matches.size());
+  EXPECT_EQ("良い", matches[0].key);
+  EXPECT_EQ(0, matches[0].distance);
+  EXPECT_EQ(2, matches[2].distance);
+  EXPECT_EQ(1, dic.FuzzyQuery("良い", 0, any_pos, 10).size());
+  EXPECT_TRUE(dic.FuzzyQuery("書かない", 1, any_pos, 10).empty());
+  EXPECT_TRUE(dic.FuzzyQuery("xyz", 1, any_pos, 10).empty());
+}
+
+TEST(TestGrammar, ForEachApplicable_SameAsIsApplicable) {
+  Grammar gr;
+  gr.LoadGrammarRules();
+  for (auto &form : {"", "る", "書いてた", "書かせられなかった", "良くない", "読まれる", "ありませんでした", "x"}) {
+	for (unsigned role_id : {Grammar::any_role_id, gr.rules[0].target_id, gr.rules[7].rule_id, gr.rules[42].role_id}) {
+	  for (unsigned glob_id = 0; glob_id < gr.GlobCount(); ++glob_id) {
+		std::vector<const GrammarRule *> expected, applicable;
+		for (auto &rule : gr.rules)
+		  if (gr.IsApplicable(rule, form, role_id, glob_id)) expected.push_back(&rule);
+		gr.ForEachApplicable(form, role_id, glob_id, [&](const GrammarRule &rule) { applicable.push_back(&rule); });
+		EXPECT_EQ(expected, applicable) << form << " " << gr.Role(role_id) << " " << gr.Glob(glob_id);
+	  }
+	}
+  }
+}
+
+TEST(TestGrammar, FixedPrefixLength) {
+  Grammar gr;
+  gr.LoadGrammarRules();
+  // kanji do not appear in the patterns, た and い do
+  EXPECT_EQ(std::string("書").size(), gr.FixedPrefixLength("書いた"));
+  EXPECT_EQ(std::string("書道").size(), gr.FixedPrefixLength("書道"));
+  EXPECT_EQ(0, gr.FixedPrefixLength("いた"));
+}
+
+TEST(TestGrammar, IsApplicable_InternedMatchesGrammarRule) {
+  Grammar gr;
+  gr.LoadGrammarRules();
+  for (auto &rule : gr.rules) {
+	for (auto &form : {"書いてた", "書いている", "良くない", "読まれる"}) {
+	  // the triples every rule may produce
+	  GrammarTriple grammar_triple{form, gr.Glob(rule.pos_globs_id), gr.Role(rule.target_id)};
+	  for (auto &other : gr.rules) {
+		EXPECT_EQ(other.IsApplicable(grammar_triple),
+				  gr.IsApplicable(other, form, rule.target_id, rule.pos_globs_id)) << other << " " << grammar_triple;
+	  }
+	}
+	EXPECT_EQ(rule.IsApplicable(GrammarTriple{"書いてた", "*", ""}),
+			  gr.IsApplicable(rule, "書いてた", Grammar::any_role_id, Grammar::any_glob_id));
+  }
+}